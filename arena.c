@@ -0,0 +1,45 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS, MAP_NORESERVE */
+
+#include "arena.h"
+
+#include <errno.h> /* errno */
+#include <sys/mman.h> /* MAP_ANONYMOUS, MAP_FAILED, MAP_NORESERVE, MAP_PRIVATE,
+                         PROT_READ, PROT_WRITE, mmap */
+
+arena run_arena;
+
+int arena_init(arena* const a, size_t const reserve)
+{
+    void* const base = mmap(0, reserve, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return errno;
+
+    a->base = (char*)base;
+    a->size = reserve;
+    a->used = 0;
+    return 0;
+}
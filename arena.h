@@ -0,0 +1,106 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "inline.h" /* inline */
+
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uintptr_t */
+
+/* A bump allocator over one lazily backed mapping.  Everything the handler
+   needs on its way to execve comes from run_arena, nothing is freed
+   individually; arena_release() rolls back to an earlier mark. */
+typedef struct arena {
+    char* base;
+    size_t size;
+    size_t used;
+} arena;
+
+/* Address space only, pages are faulted in as they are used. */
+#define ARENA_RESERVE ((size_t)256 * 1024 * 1024)
+
+extern arena run_arena;
+
+int arena_init(arena* a, size_t reserve);
+
+static inline size_t arena_align_up(arena const* const a, size_t const align)
+{
+    uintptr_t const top = (uintptr_t)a->base + a->used;
+    return a->used + (size_t)(((top + align - 1) & ~(uintptr_t)(align - 1)) -
+        top);
+}
+
+/* The free space at the top, for reading data of unknown size directly into
+   the arena.  Claim what was used with arena_commit(). */
+static inline void* arena_peek(arena const* const a, size_t const align,
+    size_t* const out_space)
+{
+    size_t const start = arena_align_up(a, align);
+
+    if (start >= a->size)
+    {
+        *out_space = 0;
+        return a->base + a->size;
+    }
+    *out_space = a->size - start;
+    return a->base + start;
+}
+
+static inline void arena_commit(arena* const a, void const* const start,
+    size_t const size)
+{
+    a->used = (size_t)((char const*)start - a->base) + size;
+}
+
+static inline void* arena_alloc(arena* const a, size_t const size,
+    size_t const align)
+{
+    size_t space;
+    void* const ptr = arena_peek(a, align, &space);
+
+    if (space < size)
+        return 0;
+    arena_commit(a, ptr, size);
+    return ptr;
+}
+
+/* Enough for any object the handler stores. */
+#define ARENA_ALIGN 16
+
+#define arena_new(a, type, count) \
+    ((type*)arena_alloc((a), sizeof(type) * (count), ARENA_ALIGN))
+
+static inline size_t arena_mark(arena const* const a)
+{
+    return a->used;
+}
+
+static inline void arena_release(arena* const a, size_t const mark)
+{
+    a->used = mark;
+}
+
+#endif
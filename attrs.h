@@ -37,6 +37,12 @@
 #define attr_const
 #endif
 
+#if __GNUC__ > 2 || (__GNUC__ == 2 && __GNUC_MINOR__ >= 7) || (defined(__clang__) && __has_attribute(format))
+#define attr_printf(f, a) __attribute__ ((format (printf, f, a)))
+#else
+#define attr_printf(f, a)
+#endif
+
 #ifndef NO_ATTR_ALIASES
 #define pure attr_pure
 #define fconst attr_const
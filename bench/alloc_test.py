@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Checks that handing off to a running osu! does not touch the heap.
+
+Runs the handler against a procfs_fixture.py tree with malloc_count.so
+preloaded, once with a cold discovery cache and once warm, and fails if
+either run allocated before it exec'd wine.  A run with coalescing, which
+does allocate, makes sure the counter works.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+import procfs_fixture
+
+
+def run(handler, counter, fixture, runtime_dir, count_file, extra_env=None):
+    env = procfs_fixture.handler_env(fixture, runtime_dir, LD_PRELOAD=counter,
+        MALLOC_COUNT_FILE=count_file, **(extra_env or {}))
+    if os.path.exists(count_file):
+        os.unlink(count_file)
+    subprocess.run([handler, 'osu://b/1'], env=env, check=True,
+        stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    with open(count_file) as f:
+        return int(f.readline())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('handler')
+    parser.add_argument('counter', help='path of malloc_count.so')
+    parser.add_argument('-n', '--processes', type=int, default=500)
+    args = parser.parse_args()
+
+    handler = os.path.abspath(args.handler)
+    counter = os.path.abspath(args.counter)
+    with tempfile.TemporaryDirectory() as tmp:
+        fixture = os.path.join(tmp, 'fixture')
+        runtime_dir = os.path.join(tmp, 'run')
+        count_file = os.path.join(tmp, 'count')
+        os.mkdir(runtime_dir, 0o700)
+        procfs_fixture.create(fixture, args.processes)
+
+        failed = False
+        for name in ('cold', 'warm'):
+            count = run(handler, counter, fixture, runtime_dir, count_file)
+            print('{}: {} allocations'.format(name, count))
+            failed = failed or count != 0
+
+        control = run(handler, counter, fixture, runtime_dir, count_file,
+            {'OSU_HANDLER_COALESCE_MS': '1'})
+        print('coalescing: {} allocations'.format(control))
+        if control == 0:
+            print('the counter did not see any allocation')
+            failed = True
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Runs the handler against procfs fixtures and reports discovery latency.
+
+Without fixture directories, temporary ones of the --processes sizes are
+made with procfs_fixture.py.  Each run starts with an empty runtime
+directory, so the discovery cache and the env snapshot are cold unless
+--warm is given.  With --relay, the handler starts relay_stub.py in an
+untimed first run and hands off to it from then on; its socket is kept
+between runs.  Every fixture is run once for each OSU_HANDLER_SCAN_THREADS
+value of --scan-threads, 1 being the serial scan.  The numbers come from the
+OSU_HANDLER_TRACE events of the handler:
+
+  discovery  first event to the moment just before execve or the relay send
+  environ    read_environ plus envp construction
+  total      wall time until the stub preloader or the handler has exited
+"""
+
+import argparse
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import tempfile
+import time
+
+import procfs_fixture
+
+
+RELAY_STUB = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+    'relay_stub.py')
+
+
+def clear_runtime_dir(runtime_dir, keep_relays):
+    if not keep_relays:
+        shutil.rmtree(runtime_dir, ignore_errors=True)
+        os.mkdir(runtime_dir, 0o700)
+        return
+    os.makedirs(runtime_dir, 0o700, exist_ok=True)
+    state = os.path.join(runtime_dir, 'osu-handler-wine')
+    for name in os.listdir(state) if os.path.isdir(state) else []:
+        if not (name.startswith('relay-') and name.endswith('.sock')):
+            os.unlink(os.path.join(state, name))
+
+
+def run_once(handler, fixture, runtime_dir, trace_path, warm, relay,
+        scan_threads='1'):
+    if not warm:
+        clear_runtime_dir(runtime_dir, relay)
+    env = procfs_fixture.handler_env(fixture, runtime_dir,
+        OSU_HANDLER_TRACE=trace_path,
+        OSU_HANDLER_SCAN_THREADS=scan_threads)
+    if relay:
+        env['OSU_HANDLER_RELAY'] = RELAY_STUB
+    open(trace_path, 'w').close()
+
+    start = time.monotonic_ns()
+    subprocess.run([handler, 'bench.osz'], env=env, check=True,
+        stdout=subprocess.DEVNULL)
+    total = time.monotonic_ns() - start
+
+    with open(trace_path) as f:
+        events = [json.loads(line) for line in f]
+    handoff = [e for e in events if e['phase'] == 'execve' or
+        (e['phase'] in ('relay_send', 'relay_start') and e['error'] == 0)]
+    if not handoff:
+        raise RuntimeError('{}: osu! was not found'.format(fixture))
+    environ = sum(e['dur_ns'] for e in events
+        if e['phase'] in ('read_environ', 'construct_envp'))
+    return {
+        'discovery': handoff[0]['ts_ns'] - events[0]['ts_ns'],
+        'environ': environ,
+        'total': total,
+    }
+
+
+def wait_for_relay(runtime_dir, timeout=5):
+    state = os.path.join(runtime_dir, 'osu-handler-wine')
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if any(name.startswith('relay-') and name.endswith('.sock')
+                for name in os.listdir(state)):
+            return
+        time.sleep(0.01)
+    raise RuntimeError('the relay did not come up')
+
+
+def check_record(fixture):
+    with open(os.path.join(fixture, 'record', 'argv'), 'rb') as f:
+        argv = f.read().split(b'\0')
+    if b'bench.osz' not in argv:
+        raise RuntimeError('{}: unexpected argv {}'.format(fixture, argv))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('fixtures', nargs='*',
+        help='directories created by procfs_fixture.py')
+    parser.add_argument('-n', '--processes', default='1000,10000,100000',
+        help='comma separated sizes of temporary fixtures to make if no '
+            'fixture is given')
+    parser.add_argument('--handler', default='./osu-handler-wine')
+    parser.add_argument('-r', '--runs', type=int, default=20)
+    parser.add_argument('--warm', action='store_true',
+        help='keep the discovery cache and env snapshot between runs')
+    parser.add_argument('--relay', action='store_true',
+        help='hand off through relay_stub.py instead of the stub preloader')
+    parser.add_argument('--scan-threads', default='1',
+        help='comma separated OSU_HANDLER_SCAN_THREADS values to compare')
+    args = parser.parse_args()
+
+    handler = os.path.abspath(args.handler)
+    with tempfile.TemporaryDirectory() as tmp:
+        runtime_dir = os.path.join(tmp, 'run')
+        trace_path = os.path.join(tmp, 'trace.jsonl')
+        if args.warm:
+            os.mkdir(runtime_dir, 0o700)
+
+        print('{:<32} {:>8} {:>8} {:>14} {:>14} {:>14}'.format('fixture',
+            'pids', 'threads', 'discovery_us', 'environ_us', 'total_us'))
+        sources = [(f, None) for f in args.fixtures] or \
+            [(None, int(n)) for n in args.processes.split(',')]
+        for path, processes in sources:
+            with procfs_fixture.fixture(path, processes) as fixture:
+                if args.relay:
+                    run_once(handler, fixture, runtime_dir, trace_path,
+                        args.warm, True)
+                    wait_for_relay(runtime_dir)
+                pids = len(os.listdir(os.path.join(fixture, 'proc')))
+                for threads in args.scan_threads.split(','):
+                    results = [run_once(handler, fixture, runtime_dir,
+                        trace_path, args.warm, args.relay, threads)
+                        for _ in range(args.runs)]
+                    check_record(fixture)
+                    print('{:<32} {:>8} {:>8} {:>14.1f} {:>14.1f} {:>14.1f}'
+                        .format(os.path.basename(fixture), pids, threads,
+                            *(statistics.median(r[k] for r in results) / 1000
+                                for k in ('discovery', 'environ', 'total'))))
+
+
+if __name__ == '__main__':
+    main()
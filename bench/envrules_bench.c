@@ -0,0 +1,133 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+/* Driver of envrules_bench.py.  Matches every variable of a NUL-separated
+   environ file against the rules of an envrules.h, once through the
+   generated matcher and once by walking the rule table like the handler
+   did before, and prints the time per variable of both as JSON. */
+
+#define _POSIX_C_SOURCE 200809L /* CLOCK_MONOTONIC, clock_gettime */
+
+#include <stddef.h> /* size_t */
+#include <stdio.h> /* FILE, fclose, fopen, fprintf, fread, printf, stderr */
+#include <stdlib.h> /* free, malloc, strtoul */
+#include <string.h> /* strlen, strncmp */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+
+/* The same types as in environ.c. */
+typedef enum env_rule_action {
+    ENV_RULE_STRIP,
+    ENV_RULE_OVERRIDE,
+    ENV_RULE_INJECT
+} env_rule_action;
+
+typedef struct env_rule {
+    env_rule_action action;
+    char const* name;
+    size_t length;
+    char const* value;
+} env_rule;
+
+#include "envrules.h" /* ENV_RULE_COUNT, env_rules, match_env_rule */
+
+static int match_linear(char const* const envar)
+{
+    int i;
+
+    for (i = 0; i < ENV_RULE_COUNT; ++i)
+        if (strncmp(envar, env_rules[i].name, env_rules[i].length) == 0 &&
+            envar[env_rules[i].length] == '=')
+            return i;
+    return -1;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Keeps the compiler from dropping the matching. */
+static volatile int sink;
+
+int main(int argc, char* argv[])
+{
+    static char data[1024 * 1024];
+    char const* vars[4096];
+    size_t count = 0;
+    size_t size;
+    size_t pos;
+    unsigned long iterations;
+    unsigned long i;
+    size_t j;
+    int matches = 0;
+    long long start;
+    long long trie_ns;
+    long long linear_ns;
+    FILE* f;
+
+    if (argc != 3 || !(f = fopen(argv[1], "rb")))
+    {
+        fprintf(stderr, "usage: %s ENVIRON ITERATIONS\n", argv[0]);
+        return 2;
+    }
+    size = fread(data, 1, sizeof(data) - 1, f);
+    fclose(f);
+    iterations = strtoul(argv[2], 0, 10);
+
+    for (pos = 0; pos < size && count < sizeof(vars) / sizeof(vars[0]);
+        pos += strlen(&data[pos]) + 1)
+        vars[count++] = &data[pos];
+
+    for (j = 0; j < count; ++j)
+    {
+        int const index = match_env_rule(vars[j]);
+
+        if (index != match_linear(vars[j]))
+        {
+            fprintf(stderr, "matchers disagree on %s\n", vars[j]);
+            return 1;
+        }
+        matches += index != -1;
+    }
+
+    start = now_ns();
+    for (i = 0; i < iterations; ++i)
+        for (j = 0; j < count; ++j)
+            sink = match_env_rule(vars[j]);
+    trie_ns = now_ns() - start;
+
+    start = now_ns();
+    for (i = 0; i < iterations; ++i)
+        for (j = 0; j < count; ++j)
+            sink = match_linear(vars[j]);
+    linear_ns = now_ns() - start;
+
+    printf("{\"vars\":%zu,\"matches\":%d,\"trie_ns\":%.2f,"
+        "\"linear_ns\":%.2f}\n", count, matches,
+        (double)trie_ns / (double)(iterations * count),
+        (double)linear_ns / (double)(iterations * count));
+    return 0;
+}
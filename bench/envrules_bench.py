@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Compares the generated environment rule matcher with a linear scan.
+
+For --rules rule sets of growing size, taken from environ.rules plus
+synthetic names with the prefixes wine setups use, runs gen_envrules.py,
+builds envrules_bench.c against the result and matches a typical desktop
+environment of about a hundred variables with both matchers.  Prints the
+time per variable of each.
+"""
+
+import argparse
+import json
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+PREFIXES = ['WINE', 'DXVK_', 'VKD3D_', 'PROTON_', 'MESA_', '__GL_', 'XDG_',
+    'LC_', 'STAGING_', 'PULSE_', 'SDL_', 'VK_']
+
+DESKTOP = ['PATH', 'HOME', 'USER', 'LOGNAME', 'SHELL', 'TERM', 'LANG',
+    'DISPLAY', 'WAYLAND_DISPLAY', 'DBUS_SESSION_BUS_ADDRESS', 'PWD', 'OLDPWD',
+    'XDG_RUNTIME_DIR', 'XDG_SESSION_TYPE', 'XDG_CURRENT_DESKTOP',
+    'XDG_DATA_DIRS', 'XDG_CONFIG_DIRS', 'XDG_SESSION_ID', 'XDG_SEAT',
+    'XDG_VTNR', 'LC_ALL', 'LC_CTYPE', 'LC_TIME', 'LC_NUMERIC', 'EDITOR',
+    'PAGER', 'LESS', 'MANPATH', 'SSH_AUTH_SOCK', 'GPG_AGENT_INFO', 'MAIL',
+    'HOSTNAME', 'SHLVL', 'COLORTERM', 'DESKTOP_SESSION', 'GDMSESSION',
+    'QT_QPA_PLATFORMTHEME', 'GTK_MODULES', 'MOZ_ENABLE_WAYLAND',
+    'SYSTEMD_EXEC_PID', 'INVOCATION_ID', 'JOURNAL_STREAM', 'MANAGERPID',
+    'WINEPREFIX', 'WINEARCH', 'WINEESYNC', 'WINEFSYNC', 'WINEDEBUG',
+    'WINELOADERNOEXEC', 'WINEPRELOADRESERVE', 'WINESERVERSOCKET',
+    'WINEDLLOVERRIDES', 'WINE_LARGE_ADDRESS_AWARE', 'STAGING_AUDIO_PERIOD',
+    'STAGING_AUDIO_DURATION', 'PULSE_LATENCY_MSEC', 'DXVK_HUD',
+    'DXVK_STATE_CACHE_PATH', 'VKD3D_CONFIG', '__GL_THREADED_OPTIMIZATIONS',
+    '__GL_SHADER_DISK_CACHE', 'MESA_GLTHREAD', 'SDL_VIDEODRIVER',
+    'VK_ICD_FILENAMES', 'OSU_HANDLER_TRACE', 'vblank_mode']
+
+
+def shipped_rules(path):
+    with open(path) as f:
+        return [line.rstrip('\n') for line in f
+            if line.strip() and not line.lstrip().startswith('#')]
+
+
+def rule_set(shipped, size, rng):
+    rules = list(shipped)
+    names = {line.split(' ', 1)[1].split('=', 1)[0] for line in rules}
+    candidates = [name for name in DESKTOP
+        if name not in names and name.isupper()]
+    rng.shuffle(candidates)
+    while len(rules) < size:
+        if candidates:
+            name = candidates.pop()
+        else:
+            name = rng.choice(PREFIXES) + ''.join(
+                rng.choice('ABCDEFGHIJKLMNOPQRSTUVWXYZ_') for _ in range(8))
+        if name in names:
+            continue
+        names.add(name)
+        rules.append('strip ' + name)
+    return rules
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--rules', type=int, nargs='+',
+        default=[3, 8, 32, 128])
+    parser.add_argument('-i', '--iterations', type=int, default=20000)
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'))
+    parser.add_argument('--seed', type=int, default=0)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    shipped = shipped_rules(os.path.join(here, '..', 'environ.rules'))
+    environ = b''.join('{}=value-{}\0'.format(name, i).encode()
+        for i, name in enumerate(DESKTOP))
+
+    with tempfile.TemporaryDirectory() as tmp:
+        environ_path = os.path.join(tmp, 'environ')
+        with open(environ_path, 'wb') as f:
+            f.write(environ)
+
+        print('{:<6} {:>6} {:>8} {:>10} {:>10}'.format('rules', 'vars',
+            'matches', 'trie_ns', 'linear_ns'))
+        for size in args.rules:
+            rules_path = os.path.join(tmp, 'environ.rules')
+            header = os.path.join(tmp, 'envrules.h')
+            driver = os.path.join(tmp, 'envrules_bench')
+            with open(rules_path, 'w') as f:
+                f.write('\n'.join(rule_set(shipped, size, rng)) + '\n')
+            subprocess.run([sys.executable,
+                os.path.join(here, '..', 'gen_envrules.py'), rules_path,
+                header], check=True)
+            subprocess.run([args.cc, '-std=gnu99', '-O2', '-I', tmp, '-o',
+                driver, os.path.join(here, 'envrules_bench.c')], check=True)
+            result = json.loads(subprocess.run([driver, environ_path,
+                str(args.iterations)], check=True, capture_output=True,
+                text=True).stdout)
+            print('{:<6} {:>6} {:>8} {:>10.2f} {:>10.2f}'.format(size,
+                result['vars'], result['matches'], result['trie_ns'],
+                result['linear_ns']))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Compares importing beatmap packs with OSU_HANDLER_IMPORT and the argv handoff.
+
+A pack of --count archives of --size-mb each is written once to --source
+(by default next to the fixture, put it on another filesystem to see the
+copy fallbacks).  For every mode the handler is run on the whole pack and
+the paths the stub wine received are then read back completely, standing
+in for osu! reading the archives:
+
+  argv   the original paths, osu! reads them where they were downloaded
+  copy   reflinked or copied into Songs first
+  move   renamed into Songs first, from hard links of the pack
+
+  handoff_ms  handler wall time, including the import
+  read_ms     reading the handed-off archives
+  gb_s        pack size over handoff plus read time
+
+Without --drop-caches the reads mostly come from the page cache, which
+shows the cost of the handoff itself.
+"""
+
+import argparse
+import os
+import shutil
+import statistics
+import subprocess
+import tempfile
+import time
+
+import procfs_fixture
+
+CHUNK = 4 * 1024 * 1024
+
+
+def make_pack(directory, count, size):
+    os.makedirs(directory, exist_ok=True)
+    paths = []
+    for i in range(count):
+        path = os.path.join(directory, 'pack-{:03}.osz'.format(i))
+        if not os.path.exists(path) or os.path.getsize(path) != size:
+            with open(path, 'wb') as f:
+                left = size
+                while left:
+                    n = min(left, CHUNK)
+                    f.write(os.urandom(n))
+                    left -= n
+        paths.append(path)
+    return paths
+
+
+def drop_caches():
+    os.sync()
+    with open('/proc/sys/vm/drop_caches', 'w') as f:
+        f.write('3\n')
+
+
+def read_back(fixture):
+    with open(os.path.join(fixture, 'record', 'argv'), 'rb') as f:
+        args = f.read().split(b'\0')[1:-1]
+    total = 0
+    for arg in args:
+        with open(arg, 'rb') as f:
+            while True:
+                n = len(f.read(CHUNK))
+                if not n:
+                    break
+                total += n
+    return total
+
+
+def run_once(handler, fixture, pack, mode, runtime_dir, caches):
+    songs = os.path.join(fixture, 'prefix', 'drive_c', 'osu!', 'Songs')
+    shutil.rmtree(songs, ignore_errors=True)
+    staging = os.path.join(os.path.dirname(pack[0]), 'staging')
+    shutil.rmtree(staging, ignore_errors=True)
+    if mode == 'move':
+        os.mkdir(staging)
+        args = []
+        for path in pack:
+            link = os.path.join(staging, os.path.basename(path))
+            os.link(path, link)
+            args.append(link)
+    else:
+        args = pack
+
+    env = procfs_fixture.handler_env(fixture, runtime_dir)
+    if mode != 'argv':
+        env['OSU_HANDLER_IMPORT'] = mode
+    if caches:
+        drop_caches()
+
+    start = time.monotonic_ns()
+    subprocess.run([handler] + args, env=env, check=True,
+        stdout=subprocess.DEVNULL)
+    handoff = time.monotonic_ns() - start
+
+    if caches:
+        drop_caches()
+    start = time.monotonic_ns()
+    size = read_back(fixture)
+    read = time.monotonic_ns() - start
+    if size != sum(os.path.getsize(p) for p in pack):
+        raise RuntimeError('{}: osu! got {} bytes'.format(mode, size))
+    return {'handoff': handoff, 'read': read, 'bytes': size}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('fixture', nargs='?',
+        help='directory created by procfs_fixture.py, default a temporary one')
+    parser.add_argument('-n', '--processes', type=int, default=1000,
+        help='processes in the temporary fixture')
+    parser.add_argument('--handler', default='./osu-handler-wine')
+    parser.add_argument('--source', help='where to write the pack')
+    parser.add_argument('-c', '--count', type=int, default=8)
+    parser.add_argument('-s', '--size-mb', type=int, default=256)
+    parser.add_argument('-r', '--runs', type=int, default=3)
+    parser.add_argument('--modes', default='argv,copy,move')
+    parser.add_argument('--drop-caches', action='store_true',
+        help='drop the page cache before each phase, needs root')
+    args = parser.parse_args()
+
+    handler = os.path.abspath(args.handler)
+    with procfs_fixture.fixture(args.fixture, args.processes) as fixture:
+        source = os.path.abspath(args.source or os.path.join(fixture, 'pack'))
+        pack = make_pack(source, args.count, args.size_mb * 1024 * 1024)
+
+        with tempfile.TemporaryDirectory() as runtime_dir:
+            print('{:<8} {:>10} {:>12} {:>12} {:>8}'.format('mode', 'pack_mb',
+                'handoff_ms', 'read_ms', 'gb_s'))
+            for mode in args.modes.split(','):
+                results = [run_once(handler, fixture, pack, mode, runtime_dir,
+                    args.drop_caches) for _ in range(args.runs)]
+                handoff = statistics.median(r['handoff'] for r in results)
+                read = statistics.median(r['read'] for r in results)
+                size = results[0]['bytes']
+                print('{:<8} {:>10} {:>12.1f} {:>12.1f} {:>8.2f}'.format(mode,
+                    size // (1024 * 1024), handoff / 1e6, read / 1e6,
+                    size / (handoff + read)))
+
+
+if __name__ == '__main__':
+    main()
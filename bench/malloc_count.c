@@ -0,0 +1,123 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+/* Preloaded into the handler by alloc_test.py.  Counts the heap allocations
+   made after it was loaded and appends the count to $MALLOC_COUNT_FILE when
+   the process execs or exits.  It goes straight to glibc's __libc_*
+   functions, dlsym() would allocate itself. */
+
+#define _GNU_SOURCE /* SYS_execve */
+
+#include <errno.h> /* ENOMEM */
+#include <fcntl.h> /* O_APPEND, O_CLOEXEC, O_CREAT, O_WRONLY, open */
+#include <stddef.h> /* size_t */
+#include <stdio.h> /* snprintf */
+#include <stdlib.h> /* getenv */
+#include <sys/syscall.h> /* SYS_execve */
+#include <unistd.h> /* close, syscall, write */
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+static unsigned long count;
+static int reported;
+
+static inline void counted(void)
+{
+    __atomic_add_fetch(&count, 1, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t const size)
+{
+    counted();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t const n, size_t const size)
+{
+    counted();
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* const ptr, size_t const size)
+{
+    counted();
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t const alignment, size_t const size)
+{
+    counted();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t const alignment, size_t const size)
+{
+    counted();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** const out_ptr, size_t const alignment,
+    size_t const size)
+{
+    void* const ptr = memalign(alignment, size);
+    if (!ptr)
+        return ENOMEM;
+    *out_ptr = ptr;
+    return 0;
+}
+
+static void report(void)
+{
+    char const* const path = getenv("MALLOC_COUNT_FILE");
+    char line[32];
+    int len;
+    int fd;
+
+    if (reported || !path)
+        return;
+    reported = 1;
+
+    len = snprintf(line, sizeof(line), "%lu\n", count);
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return;
+    if (write(fd, line, (size_t)len) != len)
+        len = 0;
+    close(fd);
+}
+
+/* The handler execs wine with the environment of osu!, so the count of the
+   wine stub is never mixed in. */
+int execve(char const* const path, char* const argv[], char* const envp[])
+{
+    report();
+    return (int)syscall(SYS_execve, path, argv, envp);
+}
+
+__attribute__((destructor)) static void report_at_exit(void)
+{
+    report();
+}
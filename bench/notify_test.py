@@ -0,0 +1,303 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Checks that an error notification arrives, or gives up in time.
+
+Loads notify.so and calls osu_handler_notify, once with the session bus
+address pointing at a socket that accepts connections but never answers,
+once against a private dbus-daemon without a notification server, and once
+with a stub org.freedesktop.Notifications on that bus.  All must return
+within the timeout plus some slack for process startup, and the stub must
+receive the summary and body.  The stub speaks the D-Bus wire protocol
+itself, so the test needs no Python bindings.
+"""
+
+import argparse
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+METHOD_CALL = 1
+METHOD_RETURN = 2
+
+FIELD_PATH = 1
+FIELD_INTERFACE = 2
+FIELD_MEMBER = 3
+FIELD_REPLY_SERIAL = 5
+FIELD_DESTINATION = 6
+FIELD_SENDER = 7
+FIELD_SIGNATURE = 8
+# Not a header field, receive() puts the serial of a message here.
+FIELD_SERIAL = 0
+
+CALL = '''
+import ctypes, sys
+module = ctypes.CDLL(sys.argv[1])
+module.osu_handler_notify(b'test', ctypes.c_ulong(int(sys.argv[2])))
+'''
+
+
+def unix_socket_path(address):
+    for entry in address.split(';'):
+        kind, _, options = entry.partition(':')
+        if kind != 'unix':
+            continue
+        for option in options.split(','):
+            key, _, value = option.partition('=')
+            if key == 'path':
+                return value
+            if key == 'abstract':
+                return '\0' + value
+    raise RuntimeError('no unix socket in {}'.format(address))
+
+
+def align(data, alignment):
+    return data + b'\0' * (-len(data) % alignment)
+
+
+def marshal(signature, values, data=b''):
+    """Appends values of the basic types in signature to data, which starts
+    at an 8 byte boundary of the message."""
+    for code, value in zip(signature, values):
+        if code == 'y':
+            data += struct.pack('<B', value)
+        elif code == 'u':
+            data = align(data, 4) + struct.pack('<I', value)
+        elif code == 'g':
+            data += struct.pack('<B', len(value)) + value.encode() + b'\0'
+        else:
+            encoded = value.encode()
+            data = (align(data, 4) + struct.pack('<I', len(encoded)) +
+                encoded + b'\0')
+    return data
+
+
+def message(kind, serial, fields, signature='', body=()):
+    body = marshal(signature, body)
+    if signature:
+        fields = fields + [(FIELD_SIGNATURE, 'g', signature)]
+    array = b''
+    for code, field_signature, value in fields:
+        array = marshal(field_signature, [value],
+            marshal('yg', [code, field_signature], align(array, 8)))
+    header = struct.pack('<cBBBIII', b'l', kind, 0, 1, len(body), serial,
+        len(array)) + array
+    return align(header, 8) + body
+
+
+def unmarshal(data, pos, code, order):
+    if code == 'y':
+        return data[pos], pos + 1
+    if code == 'g':
+        size = data[pos]
+        return data[pos + 1:pos + 1 + size].decode(), pos + size + 2
+    pos += -pos % 4
+    value, = struct.unpack_from(order + ('i' if code == 'i' else 'I'), data,
+        pos)
+    pos += 4
+    if code in 'ui':
+        return value, pos
+    return data[pos:pos + value].decode(), pos + value + 1
+
+
+def recv_all(sock, size):
+    data = b''
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+def receive(sock):
+    """Returns the type, header fields and leading basic body values of the
+    next message."""
+    fixed = recv_all(sock, 16)
+    order = '<' if fixed[0:1] == b'l' else '>'
+    kind = fixed[1]
+    body_size, serial, array_size = struct.unpack_from(order + 'III', fixed,
+        4)
+    data = fixed + recv_all(sock, array_size + -array_size % 8 + body_size)
+
+    fields = {FIELD_SERIAL: serial}
+    pos = 16
+    while pos < 16 + array_size:
+        pos += -pos % 8
+        code, pos = unmarshal(data, pos, 'y', order)
+        signature, pos = unmarshal(data, pos, 'g', order)
+        fields[code], pos = unmarshal(data, pos, signature, order)
+
+    values = []
+    pos = 16 + array_size + -array_size % 8
+    for code in fields.get(FIELD_SIGNATURE, ''):
+        if code not in 'ysogui':
+            break
+        value, pos = unmarshal(data, pos, code, order)
+        values.append(value)
+    return kind, fields, values
+
+
+class NotificationStub:
+    """Owns org.freedesktop.Notifications on the bus at address and records
+    the app name, summary and body of every Notify call."""
+
+    def __init__(self, address):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.settimeout(5)
+        self.sock.connect(unix_socket_path(address))
+        self.sock.sendall(b'\0AUTH EXTERNAL ' +
+            str(os.getuid()).encode().hex().encode() + b'\r\n')
+        line = b''
+        while not line.endswith(b'\r\n'):
+            chunk = self.sock.recv(1)
+            if not chunk:
+                raise EOFError
+            line += chunk
+        if not line.startswith(b'OK '):
+            raise RuntimeError('the bus refused the stub: {!r}'.format(line))
+        self.sock.sendall(b'BEGIN\r\n')
+
+        self.serial = 0
+        self.notifications = []
+        self.stopped = threading.Event()
+        self.call_bus('Hello')
+        if self.call_bus('RequestName', 'su',
+                ('org.freedesktop.Notifications', 4)) != [1]:
+            raise RuntimeError('the stub could not own the name')
+        self.sock.settimeout(0.1)
+        self.thread = threading.Thread(target=self.serve)
+        self.thread.start()
+
+    def send(self, kind, fields, signature='', body=()):
+        self.serial += 1
+        self.sock.sendall(message(kind, self.serial, fields, signature,
+            body))
+        return self.serial
+
+    def call_bus(self, member, signature='', body=()):
+        serial = self.send(METHOD_CALL, [
+            (FIELD_PATH, 'o', '/org/freedesktop/DBus'),
+            (FIELD_INTERFACE, 's', 'org.freedesktop.DBus'),
+            (FIELD_MEMBER, 's', member),
+            (FIELD_DESTINATION, 's', 'org.freedesktop.DBus')],
+            signature, body)
+        while True:
+            kind, fields, values = receive(self.sock)
+            if fields.get(FIELD_REPLY_SERIAL) != serial:
+                continue
+            if kind != METHOD_RETURN:
+                raise RuntimeError('{} failed'.format(member))
+            return values
+
+    def serve(self):
+        while not self.stopped.is_set():
+            try:
+                kind, fields, values = receive(self.sock)
+            except socket.timeout:
+                continue
+            except (EOFError, OSError):
+                return
+            if kind != METHOD_CALL:
+                continue
+            if fields.get(FIELD_MEMBER) == 'Notify' and len(values) == 5:
+                self.notifications.append((values[0], values[3], values[4]))
+            self.send(METHOD_RETURN, [
+                (FIELD_REPLY_SERIAL, 'u', fields[FIELD_SERIAL]),
+                (FIELD_DESTINATION, 's', fields[FIELD_SENDER])],
+                'u', (len(self.notifications),))
+
+    def close(self):
+        self.stopped.set()
+        self.thread.join()
+        self.sock.close()
+
+
+def notify(module, address, timeout_ms, limit):
+    env = dict(os.environ, DBUS_SESSION_BUS_ADDRESS=address)
+    start = time.monotonic()
+    try:
+        subprocess.run([sys.executable, '-c', CALL, module, str(timeout_ms)],
+            env=env, check=True, timeout=limit * 10)
+    except subprocess.TimeoutExpired:
+        return None
+    return time.monotonic() - start
+
+
+def timed(name, module, address, timeout_ms, limit):
+    """Whether the notification returned in time."""
+    elapsed = notify(module, address, timeout_ms, limit)
+    if elapsed is None:
+        print('{}: did not return'.format(name))
+        return False
+    print('{}: {:.0f} ms'.format(name, elapsed * 1000))
+    return elapsed <= limit
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('module', help='path of notify.so')
+    parser.add_argument('dbus_daemon', help='path of dbus-daemon')
+    parser.add_argument('-t', '--timeout-ms', type=int, default=200)
+    parser.add_argument('-s', '--slack', type=float, default=1.0)
+    args = parser.parse_args()
+
+    module = os.path.abspath(args.module)
+    limit = args.timeout_ms / 1000 + args.slack
+    ok = True
+    with tempfile.TemporaryDirectory() as tmp:
+        stalled = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        stalled.bind(os.path.join(tmp, 'stalled'))
+        stalled.listen(16)
+
+        daemon = subprocess.Popen([args.dbus_daemon, '--session', '--nofork',
+            '--nopidfile', '--print-address'], stdout=subprocess.PIPE,
+            universal_newlines=True)
+        try:
+            address = daemon.stdout.readline().strip()
+            ok = timed('stalled bus', module,
+                'unix:path=' + os.path.join(tmp, 'stalled'),
+                args.timeout_ms, limit) and ok
+            ok = timed('no notification server', module, address,
+                args.timeout_ms, limit) and ok
+
+            stub = NotificationStub(address)
+            try:
+                ok = timed('notification server', module, address,
+                    args.timeout_ms, limit) and ok
+            finally:
+                stub.close()
+            print('received: {}'.format(stub.notifications))
+            ok = ok and stub.notifications == [
+                ('osu-handler-wine', 'Error', 'test')]
+        finally:
+            daemon.terminate()
+            daemon.wait()
+            stalled.close()
+
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
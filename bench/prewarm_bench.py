@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Measures time to delivery with cold wine libraries, with and without prewarm.
+
+Puts a fake wine build next to the stub wine of the fixture: ntdll.so of
+--size-mb and a few DLLs of a quarter of that, in the build and in the
+prefix, and lists them in bin/faults so that the stub reads them like wine
+would.  Before every run they are evicted from the page cache with
+posix_fadvise(DONTNEED).  The time to delivery is from the start of the
+handler until the stub has recorded its argv.
+
+  off       no prewarm, the stub faults everything in
+  resident  nothing is evicted, which is what the daemon's
+            OSU_HANDLER_PREWARM=lock keeps up while osu! runs; the daemon
+            itself cannot run on the fixture, whose PIDs have no pidfd
+"""
+
+import argparse
+import os
+import shutil
+import statistics
+import subprocess
+import tempfile
+import time
+
+import procfs_fixture
+
+CHUNK = 1024 * 1024
+
+BUILD_FILES = ['lib/wine/i386-windows/ntdll.dll',
+    'lib/wine/i386-windows/kernel32.dll',
+    'lib/wine/i386-windows/kernelbase.dll']
+PREFIX_FILES = ['drive_c/windows/syswow64/ntdll.dll',
+    'drive_c/windows/syswow64/kernel32.dll',
+    'drive_c/windows/syswow64/kernelbase.dll']
+
+
+def make_file(path, size):
+    if os.path.exists(path) and os.path.getsize(path) == size:
+        return
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'wb') as f:
+        for _ in range(size // CHUNK):
+            f.write(os.urandom(CHUNK))
+        os.fdatasync(f.fileno())
+
+
+def make_build(fixture, size):
+    files = [(os.path.join(fixture, 'lib/wine/x86_64-unix/ntdll.so'), size)]
+    files += [(os.path.join(fixture, p), size // 4) for p in BUILD_FILES]
+    files += [(os.path.join(fixture, 'prefix', p), size // 4)
+        for p in PREFIX_FILES]
+    for path, file_size in files:
+        make_file(path, file_size)
+    paths = [p for p, _ in files]
+    with open(os.path.join(fixture, 'bin', 'faults'), 'w') as f:
+        f.write(''.join(p + '\n' for p in paths))
+    return paths
+
+
+def evict(paths):
+    for path in paths:
+        fd = os.open(path, os.O_RDONLY)
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+        os.close(fd)
+
+
+def deliver(handler, env, fixture, paths, cold):
+    argv_path = os.path.join(fixture, 'record', 'argv')
+    if os.path.exists(argv_path):
+        os.unlink(argv_path)
+    if cold:
+        evict(paths)
+    start = time.monotonic_ns()
+    process = subprocess.Popen([handler, 'osu://b/1'], env=env,
+        stdout=subprocess.DEVNULL)
+    while not os.path.exists(argv_path):
+        time.sleep(0.0005)
+    delivery = time.monotonic_ns() - start
+    if process.wait() != 0:
+        raise RuntimeError('the handler failed')
+    return delivery
+
+
+def run_mode(handler, fixture, runtime_dir, paths, mode, runs):
+    shutil.rmtree(runtime_dir, ignore_errors=True)
+    os.mkdir(runtime_dir, 0o700)
+    env = procfs_fixture.handler_env(fixture, runtime_dir)
+    # Untimed, so that the discovery cache is warm in every mode.
+    deliver(handler, env, fixture, paths, False)
+    return [deliver(handler, env, fixture, paths, mode != 'resident')
+        for _ in range(runs)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('fixture', nargs='?',
+        help='directory created by procfs_fixture.py, default a temporary one')
+    parser.add_argument('-n', '--processes', type=int, default=1000,
+        help='processes in the temporary fixture')
+    parser.add_argument('--handler', default='./osu-handler-wine')
+    parser.add_argument('-s', '--size-mb', type=int, default=64)
+    parser.add_argument('-r', '--runs', type=int, default=10)
+    args = parser.parse_args()
+
+    handler = os.path.abspath(args.handler)
+    with procfs_fixture.fixture(args.fixture, args.processes) as fixture:
+        paths = make_build(fixture, args.size_mb * CHUNK)
+        total = sum(os.path.getsize(p) for p in paths)
+
+        with tempfile.TemporaryDirectory() as tmp:
+            runtime_dir = os.path.join(tmp, 'run')
+            print('{:<8} {:>8} {:>14} {:>14}'.format('mode', 'files_mb',
+                'delivery_ms', 'max_ms'))
+            for mode in ('off', 'resident'):
+                results = run_mode(handler, fixture, runtime_dir, paths, mode,
+                    args.runs)
+                print('{:<8} {:>8} {:>14.1f} {:>14.1f}'.format(mode,
+                    total // CHUNK, statistics.median(results) / 1e6,
+                    max(results) / 1e6))
+
+
+if __name__ == '__main__':
+    main()
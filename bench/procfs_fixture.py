@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Builds a synthetic procfs tree for benchmarking discovery.
+
+The tree has one directory per PID with comm, stat, cmdline, environ and an
+exe symlink.  Exactly one process looks like osu! running in wine, in a
+prefix next to the tree whose C: drive holds an empty osu! folder.  Its exe
+points to a wine-preloader in the fixture, next to a stub wine that the
+handler execs.  The stub records the argv and environment it was started
+with, then exits, unless it is asked to start a relay such as
+relay_stub.py.  A few decoys are named
+osu!.exe but are not wine.  When run as root, the PID directories are
+spread over several uids.
+
+Point the handler at it with OSU_HANDLER_PROCFS=<dir>/proc, or use
+bench/bench.py.  The benchmarks make a temporary one with fixture() when
+they are not given one, and run the handler on it with handler_env().
+"""
+
+import argparse
+import contextlib
+import io
+import os
+import random
+import tempfile
+
+STUB_WINE = '''#!/bin/sh
+# Relays are run on the host, as wine would run them inside the prefix.
+case "$1" in *relay*) exec "$@";; esac
+# Stub wine of the procfs fixture.  It reads the files listed in "faults"
+# next to it first, like wine faulting in its libraries.
+if [ -f "$(dirname "$0")/faults" ]; then
+    while read -r f; do cat "$f"; done < "$(dirname "$0")/faults" > /dev/null
+fi
+dir=${OSU_BENCH_RECORD:-$(dirname "$0")/record}
+mkdir -p "$dir"
+printf '%s\\0' "$0" "$@" > "$dir/argv"
+env -0 > "$dir/envp"
+'''
+
+COMMS = ['bash', 'systemd', 'kworker/0:1', 'Xwayland', 'pipewire', 'firefox',
+    'wineserver', 'services.exe', 'explorer.exe', 'sh']
+
+
+def write(path, data, mode='w'):
+    with open(path, mode) as f:
+        f.write(data)
+
+
+def stat_line(pid, comm, starttime):
+    # Fields 3 to 21 are filler, starttime is field 22.
+    return '{} ({}) S 1 {} {} 0 -1 4194560 0 0 0 0 0 0 0 0 20 0 1 0 {} ' \
+        '0 0\n'.format(pid, comm, pid, pid, starttime)
+
+
+def environ(size, record, prefix):
+    entries = [
+        'HOME=/home/bench',
+        'WINEPREFIX=' + prefix,
+        'WINESERVERSOCKET=5',
+        'WINELOADERNOEXEC=1',
+        'WINEPRELOADRESERVE=80000000-90000000',
+        'WINEDEBUG=-all',
+        'OSU_BENCH_RECORD=' + record,
+    ]
+    i = 0
+    while sum(len(e) + 1 for e in entries) < size:
+        entries.append('BENCH_PADDING_{}={}'.format(i, 'x' * 48))
+        i += 1
+    return ''.join(e + '\0' for e in entries).encode()
+
+
+def generate(args):
+    rng = random.Random(args.seed)
+    root = os.path.abspath(args.output)
+    proc = os.path.join(root, 'proc')
+    bin_dir = os.path.join(root, 'bin')
+    record = os.path.join(root, 'record')
+    prefix = os.path.join(root, 'prefix')
+    os.makedirs(proc)
+    os.makedirs(bin_dir)
+
+    # Like a fresh prefix, wine shows osu! by its Windows path in cmdline.
+    os.makedirs(os.path.join(prefix, 'dosdevices'))
+    os.makedirs(os.path.join(prefix, 'drive_c', 'osu!'))
+    os.symlink('../drive_c', os.path.join(prefix, 'dosdevices', 'c:'))
+    os.symlink('/', os.path.join(prefix, 'dosdevices', 'z:'))
+    osu_cmdline = 'C:\\osu!\\osu!.exe\0'
+
+    wine = os.path.join(bin_dir, 'wine')
+    write(wine, STUB_WINE)
+    os.chmod(wine, 0o755)
+    # Only the name matters, the handler execs wine next to it.
+    preloader = os.path.join(bin_dir, 'wine-preloader')
+    os.symlink('wine', preloader)
+
+    uid = os.getuid()
+    uids = [uid] + ([uid + 1, uid + 2, 0] if os.geteuid() == 0 else [])
+    first_pid = 1000
+    pids = range(first_pid, first_pid + args.processes)
+    target = first_pid + int((args.processes - 1) * args.position)
+    decoys = set(rng.sample(pids, min(args.decoys, args.processes - 1)))
+    decoys.discard(target)
+
+    small_environ = environ(0, record, prefix)
+    for pid in pids:
+        d = os.path.join(proc, str(pid))
+        os.mkdir(d)
+        if pid == target:
+            comm = 'osu!.exe'
+            exe = preloader
+            env = environ(args.environ_size, record, prefix)
+            cmdline = osu_cmdline
+            owner = uid
+        else:
+            comm = 'osu!.exe' if pid in decoys else rng.choice(COMMS)
+            exe = '/usr/bin/' + comm.split('/')[0]
+            env = small_environ
+            cmdline = exe + '\0'
+            owner = rng.choice(uids)
+        write(os.path.join(d, 'comm'), comm + '\n')
+        write(os.path.join(d, 'stat'), stat_line(pid, comm, pid * 7))
+        write(os.path.join(d, 'cmdline'), cmdline)
+        write(os.path.join(d, 'environ'), env, 'wb')
+        os.symlink(exe, os.path.join(d, 'exe'))
+        if owner != uid:
+            os.chown(d, owner, -1)
+
+    print('{}: {} processes, osu! is PID {}'.format(root, args.processes,
+        target))
+
+
+def make_parser():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('output', help='fixture directory to create')
+    parser.add_argument('-n', '--processes', type=int, default=1000)
+    parser.add_argument('--environ-size', type=int, default=4096,
+        help='size of the osu! environ in bytes')
+    parser.add_argument('--position', type=float, default=0.5,
+        help='position of osu! in the PID range, 0 to 1')
+    parser.add_argument('--decoys', type=int, default=8,
+        help='processes named osu!.exe that are not wine')
+    parser.add_argument('--seed', type=int, default=0)
+    return parser
+
+
+def create(output, processes):
+    """Generates a fixture with the default options and that many processes,
+    quietly."""
+    with contextlib.redirect_stdout(io.StringIO()):
+        generate(make_parser().parse_args([output, '-n', str(processes)]))
+
+
+@contextlib.contextmanager
+def fixture(path, processes):
+    """Yields path, or a temporary fixture with that many processes if path
+    is None."""
+    if path:
+        yield os.path.abspath(path)
+        return
+    with tempfile.TemporaryDirectory() as tmp:
+        output = os.path.join(tmp, 'fixture')
+        create(output, processes)
+        yield output
+
+
+def handler_env(fixture, runtime_dir, **extra):
+    """The environment that points the handler at fixture, with its state in
+    runtime_dir, plus the variables in extra."""
+    env = {
+        'PATH': os.environ.get('PATH', '/usr/bin:/bin'),
+        'HOME': os.environ.get('HOME', '/'),
+        'XDG_RUNTIME_DIR': runtime_dir,
+        'XDG_CONFIG_HOME': runtime_dir,
+        'OSU_HANDLER_PROCFS': os.path.join(fixture, 'proc'),
+        'OSU_HANDLER_ENUM': 'full',
+    }
+    env.update(extra)
+    return env
+
+
+def main():
+    generate(make_parser().parse_args())
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+"""Checks that a relay is handed the imported archives, not the downloads.
+
+Runs the handler against a procfs_fixture.py tree with relay_stub.py as the
+relay and OSU_HANDLER_IMPORT=move, once starting the relay and once handing
+off to the running one.  Both times the relay must receive the path in
+Songs, and the download must be gone.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+import procfs_fixture
+
+RELAY_STUB = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+    'relay_stub.py')
+
+
+def run(handler, fixture, runtime_dir, download):
+    with open(download, 'w') as f:
+        f.write(os.path.basename(download))
+    env = procfs_fixture.handler_env(fixture, runtime_dir,
+        OSU_HANDLER_RELAY=RELAY_STUB,
+        OSU_HANDLER_IMPORT='move')
+    subprocess.run([handler, download], env=env, check=True,
+        stdout=subprocess.DEVNULL)
+    with open(os.path.join(fixture, 'record', 'argv'), 'rb') as f:
+        argv = f.read().split(b'\0')[:-1]
+    return [os.fsdecode(arg) for arg in argv]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('handler')
+    parser.add_argument('-n', '--processes', type=int, default=100)
+    args = parser.parse_args()
+
+    handler = os.path.abspath(args.handler)
+    failed = False
+    with tempfile.TemporaryDirectory() as tmp:
+        fixture = os.path.join(tmp, 'fixture')
+        runtime_dir = os.path.join(tmp, 'run')
+        downloads = os.path.join(tmp, 'downloads')
+        os.mkdir(runtime_dir, 0o700)
+        os.mkdir(downloads)
+        procfs_fixture.create(fixture, args.processes)
+        songs = os.path.join(fixture, 'prefix', 'drive_c', 'osu!', 'Songs')
+
+        for name in ('start', 'running'):
+            download = os.path.join(downloads, name + '.osz')
+            argv = run(handler, fixture, runtime_dir, download)
+            expected = os.path.join(songs, name + '.osz')
+            ok = (argv[:1] == [RELAY_STUB] and argv[1:] == [expected] and
+                not os.path.exists(download) and os.path.exists(expected))
+            print('{}: {}'.format(name, ' '.join(argv[1:])))
+            failed = failed or not ok
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
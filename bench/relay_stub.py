@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""A Linux stand-in for the in-prefix relay, for tests and benchmarks.
+
+Started by the handler through the wine loader of an osu! instance, with the
+path of the relay socket as its argument; the stub wine of procfs_fixture.py
+runs it on the host.  Every request is recorded like the stub wine records
+its argv, as the relay's own path followed by the handler's arguments, then
+acknowledged with status 0.  The record goes to OSU_BENCH_RECORD, which
+procfs_fixture.py sets for osu!, or else to a directory in the temporary
+directory.  The working directory the handler sends first is not
+recorded.
+
+A real relay exits with its osu! instance.  The stand-in has no instance to
+watch and exits once its socket has been removed or taken over instead.
+"""
+
+import os
+import socket
+import struct
+import sys
+import tempfile
+
+# Matches IPC_MAX_REQUEST_SIZE in ipc.c.
+MAX_REQUEST_SIZE = 1024 * 1024
+
+
+def recv_all(conn, size):
+    data = b''
+    while len(data) < size:
+        chunk = conn.recv(size - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+def listen(path):
+    # Like ipc_listen, leave a socket that is still served alone.
+    probe = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        probe.connect(path)
+        sys.exit(0)
+    except OSError:
+        pass
+    finally:
+        probe.close()
+    try:
+        os.unlink(path)
+    except FileNotFoundError:
+        pass
+
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    server.bind(path)
+    server.listen()
+    server.settimeout(1)
+    return server, os.stat(path).st_ino
+
+
+def still_ours(path, ino):
+    try:
+        return os.stat(path).st_ino == ino
+    except FileNotFoundError:
+        return False
+
+
+def handle(conn, record):
+    size, = struct.unpack('=I', recv_all(conn, 4))
+    if size > MAX_REQUEST_SIZE:
+        return
+    strings = recv_all(conn, size).split(b'\0')[:-1]
+    os.makedirs(record, exist_ok=True)
+    with open(os.path.join(record, 'argv'), 'wb') as f:
+        for arg in [os.fsencode(sys.argv[0])] + strings[1:]:
+            f.write(arg + b'\0')
+    conn.sendall(struct.pack('=i', 0))
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('usage: {} SOCKET'.format(sys.argv[0]))
+    path = sys.argv[1]
+    record = os.environ.get('OSU_BENCH_RECORD',
+        os.path.join(tempfile.gettempdir(),
+            'relay_stub-record-{}'.format(os.getuid())))
+
+    server, ino = listen(path)
+    while still_ours(path, ino):
+        try:
+            conn, _ = server.accept()
+        except socket.timeout:
+            continue
+        with conn:
+            conn.settimeout(1)
+            try:
+                handle(conn, record)
+            except (EOFError, OSError):
+                pass
+
+
+if __name__ == '__main__':
+    main()
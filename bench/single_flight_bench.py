@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Starts many handlers at once on a cold runtime directory.
+
+Every round clears the runtime directory and starts --clients handlers
+together, as a browser restoring a session with many beatmap links would.
+Without OSU_HANDLER_SINGLE_FLIGHT_MS every one of them scans the fixture's
+/proc; with it one scans and the others take its result.  Reported are the
+CPU time of all handlers of a round and the latency of a single handler,
+from its start until it has exited, over all rounds.
+"""
+
+import argparse
+import os
+import shutil
+import statistics
+import subprocess
+import tempfile
+import time
+
+import procfs_fixture
+
+
+def run_round(handler, fixture, runtime_dir, clients, wait_ms):
+    shutil.rmtree(runtime_dir, ignore_errors=True)
+    os.mkdir(runtime_dir, 0o700)
+    env = procfs_fixture.handler_env(fixture, runtime_dir,
+        OSU_HANDLER_SINGLE_FLIGHT_MS=str(wait_ms))
+
+    # The Popen objects are kept, subprocess reaps dropped ones itself.
+    processes = []
+    started = {}
+    for i in range(clients):
+        processes.append(subprocess.Popen([handler, 'osu://b/{}'.format(i)],
+            env=env, stdout=subprocess.DEVNULL))
+        started[processes[-1].pid] = time.monotonic_ns()
+
+    cpu = 0
+    latencies = []
+    while started:
+        pid, status, usage = os.wait4(-1, 0)
+        if pid not in started:
+            continue
+        latencies.append(time.monotonic_ns() - started.pop(pid))
+        if os.waitstatus_to_exitcode(status) != 0:
+            raise RuntimeError('a handler failed with {}'.format(status))
+        cpu += usage.ru_utime + usage.ru_stime
+    return cpu, latencies
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('fixture', nargs='?',
+        help='directory created by procfs_fixture.py, default a temporary one')
+    parser.add_argument('-n', '--processes', type=int, default=1000,
+        help='processes in the temporary fixture')
+    parser.add_argument('--handler', default='./osu-handler-wine')
+    parser.add_argument('-c', '--clients', type=int, default=50)
+    parser.add_argument('-r', '--runs', type=int, default=10)
+    parser.add_argument('-w', '--wait-ms', type=int, default=1000,
+        help='OSU_HANDLER_SINGLE_FLIGHT_MS for the single-flight rounds')
+    args = parser.parse_args()
+
+    handler = os.path.abspath(args.handler)
+    with procfs_fixture.fixture(args.fixture, args.processes) as fixture:
+        with tempfile.TemporaryDirectory() as tmp:
+            runtime_dir = os.path.join(tmp, 'run')
+
+            print('{:<14} {:>8} {:>10} {:>10} {:>10} {:>10}'.format('mode',
+                'clients', 'cpu_ms', 'p50_ms', 'p99_ms', 'max_ms'))
+            for mode, wait_ms in (('independent', 0), ('single-flight',
+                    args.wait_ms)):
+                cpu = []
+                latencies = []
+                for _ in range(args.runs):
+                    round_cpu, round_latencies = run_round(handler, fixture,
+                        runtime_dir, args.clients, wait_ms)
+                    cpu.append(round_cpu)
+                    latencies += round_latencies
+                print('{:<14} {:>8} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}'
+                    .format(mode, args.clients, statistics.median(cpu) * 1000,
+                        percentile(latencies, 0.5) / 1e6,
+                        percentile(latencies, 0.99) / 1e6,
+                        max(latencies) / 1e6))
+
+
+if __name__ == '__main__':
+    main()
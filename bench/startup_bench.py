@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Compares the handler's time to execve with and without GIO loaded.
+
+The handler only loads GIO, through notify.so, when it has to show a
+notification.  To see what linking it into the executable would cost,
+every other run preloads libgio-2.0 into the same handler, which maps,
+relocates and constructs GLib just like a DT_NEEDED entry would.  Runs go
+against a procfs_fixture.py tree with a warm discovery cache.  The time to
+execve goes from just before the handler is spawned to its execve trace
+point, both on CLOCK_MONOTONIC, so the handler must be built with the
+trace option.
+"""
+
+import argparse
+import ctypes.util
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+
+import procfs_fixture
+import time
+
+
+def run_once(handler, fixture, runtime_dir, trace_path, preload):
+    env = procfs_fixture.handler_env(fixture, runtime_dir,
+        OSU_HANDLER_TRACE=trace_path)
+    if preload:
+        env['LD_PRELOAD'] = preload
+    open(trace_path, 'w').close()
+
+    start = time.monotonic_ns()
+    subprocess.run([handler, 'bench.osz'], env=env, check=True,
+        stdout=subprocess.DEVNULL)
+
+    with open(trace_path) as f:
+        events = [json.loads(line) for line in f]
+    execve = [e for e in events if e['phase'] == 'execve']
+    if not execve:
+        raise RuntimeError('{}: osu! was not found'.format(fixture))
+    return execve[0]['ts_ns'] - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--handler', default='./osu-handler-wine')
+    parser.add_argument('--gio', default=ctypes.util.find_library('gio-2.0'),
+        help='GIO library to preload for the linked case')
+    parser.add_argument('-n', '--processes', type=int, default=500)
+    parser.add_argument('-r', '--runs', type=int, default=50)
+    args = parser.parse_args()
+
+    if not args.gio:
+        sys.exit('libgio-2.0 was not found, pass --gio')
+
+    handler = os.path.abspath(args.handler)
+    with tempfile.TemporaryDirectory() as tmp:
+        fixture = os.path.join(tmp, 'fixture')
+        runtime_dir = os.path.join(tmp, 'run')
+        trace_path = os.path.join(tmp, 'trace.jsonl')
+        os.mkdir(runtime_dir, 0o700)
+        procfs_fixture.create(fixture, args.processes)
+
+        # Fills the discovery cache and the env snapshot.
+        run_once(handler, fixture, runtime_dir, trace_path, None)
+
+        results = {'dlopen': [], 'linked': []}
+        for _ in range(args.runs):
+            results['dlopen'].append(run_once(handler, fixture, runtime_dir,
+                trace_path, None))
+            results['linked'].append(run_once(handler, fixture, runtime_dir,
+                trace_path, args.gio))
+
+        print('{:<8} {:>14} {:>14}'.format('gio', 'median_us', 'min_us'))
+        for name, times in results.items():
+            print('{:<8} {:>14.1f} {:>14.1f}'.format(name,
+                statistics.median(times) / 1000, min(times) / 1000))
+
+
+if __name__ == '__main__':
+    main()
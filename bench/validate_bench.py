@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+"""Measures the archive validator of OSU_HANDLER_VALIDATE on large archives.
+
+Writes --count deflated archives of about --size-mb each, half random and
+half compressible data like a beatmap with its audio and background, and
+runs the handler on all of them with 1 and with --threads validator threads.
+The validation time comes from the validate_archives trace event.  A
+truncated and a bit-flipped copy are then each passed along with an intact
+archive, which must still be delivered without the damaged one.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import tempfile
+import zipfile
+
+import procfs_fixture
+
+CHUNK = 1024 * 1024
+
+
+def make_archive(path, size, seed):
+    if os.path.exists(path):
+        return
+    text = ''.join('{},{},{},1,0\n'.format(i * 7 % 512, i * 3 % 384, i * 50)
+        for i in range(CHUNK // 16)).encode()[:CHUNK]
+    with zipfile.ZipFile(path + '.tmp', 'w', zipfile.ZIP_DEFLATED) as z:
+        for i in range(max(1, size // (2 * CHUNK))):
+            z.writestr('audio-{}.mp3'.format(i), os.urandom(CHUNK))
+            z.writestr('map-{}-{}.osu'.format(seed, i), text)
+    os.rename(path + '.tmp', path)
+
+
+def run(handler, fixture, runtime_dir, trace_path, archives, threads):
+    env = procfs_fixture.handler_env(fixture, runtime_dir,
+        OSU_HANDLER_TRACE=trace_path,
+        OSU_HANDLER_VALIDATE='1',
+        OSU_HANDLER_VALIDATE_THREADS=str(threads))
+    open(trace_path, 'w').close()
+    result = subprocess.run([handler] + archives, env=env,
+        stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    with open(trace_path) as f:
+        events = [json.loads(line) for line in f]
+    validate = [e for e in events if e['phase'] == 'validate_archives']
+    return result.returncode, validate[0]['dur_ns'], validate[0]['error']
+
+
+def read_record(fixture):
+    with open(os.path.join(fixture, 'record', 'argv'), 'rb') as f:
+        return f.read().split(b'\0')
+
+
+def damaged_copies(directory, source):
+    truncated = os.path.join(directory, 'truncated.osz')
+    flipped = os.path.join(directory, 'flipped.osz')
+    shutil.copyfile(source, truncated)
+    with open(truncated, 'r+b') as f:
+        f.truncate(os.path.getsize(source) * 2 // 3)
+    shutil.copyfile(source, flipped)
+    with open(flipped, 'r+b') as f:
+        f.seek(os.path.getsize(source) // 2)
+        byte = f.read(1)
+        f.seek(-1, os.SEEK_CUR)
+        f.write(bytes([byte[0] ^ 0x10]))
+    return [truncated, flipped]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('fixture', nargs='?',
+        help='directory created by procfs_fixture.py, default a temporary one')
+    parser.add_argument('-n', '--processes', type=int, default=1000,
+        help='processes in the temporary fixture')
+    parser.add_argument('--handler', default='./osu-handler-wine')
+    parser.add_argument('-c', '--count', type=int, default=8)
+    parser.add_argument('-s', '--size-mb', type=int, default=128)
+    parser.add_argument('-t', '--threads', type=int,
+        default=os.cpu_count() or 1)
+    parser.add_argument('-r', '--runs', type=int, default=5)
+    args = parser.parse_args()
+
+    handler = os.path.abspath(args.handler)
+    with procfs_fixture.fixture(args.fixture, args.processes) as fixture:
+        directory = os.path.join(fixture, 'archives')
+        os.makedirs(directory, exist_ok=True)
+        archives = [os.path.join(directory, 'pack-{:03}.osz'.format(i))
+            for i in range(args.count)]
+        for i, path in enumerate(archives):
+            make_archive(path, args.size_mb * CHUNK, i)
+        total = sum(os.path.getsize(p) for p in archives)
+
+        with tempfile.TemporaryDirectory() as tmp:
+            runtime_dir = os.path.join(tmp, 'run')
+            trace_path = os.path.join(tmp, 'trace.jsonl')
+            os.mkdir(runtime_dir, 0o700)
+
+            print('{:<8} {:>10} {:>14} {:>8}'.format('threads', 'pack_mb',
+                'validate_ms', 'gb_s'))
+            for threads in sorted({1, args.threads}):
+                durations = []
+                for _ in range(args.runs):
+                    code, duration, error = run(handler, fixture, runtime_dir,
+                        trace_path, archives, threads)
+                    if code != 0 or error != 0:
+                        raise RuntimeError('intact pack rejected')
+                    durations.append(duration)
+                duration = statistics.median(durations)
+                print('{:<8} {:>10} {:>14.1f} {:>8.2f}'.format(threads,
+                    total // CHUNK, duration / 1e6, total / duration))
+
+            for path in damaged_copies(tmp, archives[0]):
+                code, _, error = run(handler, fixture, runtime_dir, trace_path,
+                    [path, archives[0]], 1)
+                delivered = read_record(fixture)
+                if error == 0 or path.encode() in delivered:
+                    raise RuntimeError('{} was not rejected'.format(path))
+                if code != 0 or archives[0].encode() not in delivered:
+                    raise RuntimeError('the intact archive was not delivered')
+                print('rejected {}'.format(os.path.basename(path)))
+
+
+if __name__ == '__main__':
+    main()
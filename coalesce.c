@@ -0,0 +1,235 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _GNU_SOURCE /* accept4, SOCK_CLOEXEC */
+
+#include "coalesce.h"
+#include "inline.h" /* inline */
+#include "ipc.h" /* ipc_connect, ipc_listen, ipc_listener, ipc_recv_status,
+                    ipc_recv_strings, ipc_send_status, ipc_send_strings,
+                    ipc_set_timeout, ipc_unlisten */
+
+#include <errno.h> /* EADDRINUSE, EINTR, ENOMEM, errno */
+#include <limits.h> /* PATH_MAX */
+#include <poll.h> /* POLLIN, poll, struct pollfd */
+#include <stddef.h> /* size_t */
+#include <stdlib.h> /* free, malloc, realloc, realpath */
+#include <string.h> /* memcpy, strstr */
+#include <sys/socket.h> /* accept4 */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+#include <unistd.h> /* F_OK, access, close */
+
+#define COALESCE_SOCKET_NAME "coalesce.sock"
+
+/* Connections of the senders whose arguments were collected, answered by
+   reply_to_senders(). */
+static int* sender_fds;
+static size_t sender_count;
+
+static inline long long monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* The collector runs wine in its own working directory, so relative file
+   names are resolved before they are sent. */
+static int send_arguments(int const fd, char* argv[])
+{
+    size_t count;
+    char const** strings;
+    char (*paths)[PATH_MAX];
+    size_t i;
+    int error;
+
+    for (count = 0; argv[count + 1]; ++count);
+
+    strings = (char const**)malloc(sizeof(char const*) * (count + 1) +
+        sizeof(*paths) * count);
+    if (!strings)
+        return ENOMEM;
+    paths = (char (*)[PATH_MAX])&strings[count + 1];
+
+    for (i = 0; i < count; ++i)
+    {
+        char const* const arg = argv[i + 1];
+
+        strings[i] = arg;
+        if (arg[0] != '/' && !strstr(arg, "://") && access(arg, F_OK) == 0 &&
+            realpath(arg, paths[i]))
+            strings[i] = paths[i];
+    }
+
+    error = ipc_send_strings(fd, count, strings);
+    free(strings);
+    return error;
+}
+
+static int hand_off(char* argv[])
+{
+    int error;
+    int fd;
+    int status;
+
+    if ((error = ipc_connect(COALESCE_SOCKET_NAME, &fd)) != 0)
+        return error;
+
+    if ((error = send_arguments(fd, argv)) == 0)
+        error = ipc_recv_status(fd, &status);
+    close(fd);
+
+    return error ? error : status;
+}
+
+static inline bool append_arguments(char*** const argv, size_t* const argc,
+    char* const* const args, size_t const count)
+{
+    char** const new_argv = (char**)realloc(*argv,
+        sizeof(char*) * (*argc + count + 1));
+    if (!new_argv)
+        return false;
+
+    memcpy(&new_argv[*argc], args, sizeof(char*) * count);
+    *argc += count;
+    new_argv[*argc] = 0;
+    *argv = new_argv;
+    return true;
+}
+
+static inline bool add_sender(int const fd)
+{
+    int* const fds = (int*)realloc(sender_fds,
+        sizeof(int) * (sender_count + 1));
+    if (!fds)
+        return false;
+
+    fds[sender_count++] = fd;
+    sender_fds = fds;
+    return true;
+}
+
+static void collect(int const listen_fd, unsigned long const window_ms,
+    char*** const argv, size_t* const argc)
+{
+    long long const deadline = monotonic_ms() + (long long)window_ms;
+    long long remaining;
+    struct pollfd pfd;
+
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+
+    while ((remaining = deadline - monotonic_ms()) > 0)
+    {
+        int fd;
+        char** strings;
+        size_t count;
+
+        if (poll(&pfd, 1, (int)remaining) <= 0)
+            continue;
+
+        fd = accept4(listen_fd, 0, 0, SOCK_CLOEXEC);
+        if (fd == -1)
+            continue;
+
+        /* The received strings are kept until exec, the sender waits for
+           its reply until they are delivered.  A sender that stalls must
+           not hold the collector past its window. */
+        if (ipc_set_timeout(fd, (unsigned long)remaining) != 0 ||
+            ipc_recv_strings(fd, 0, &strings, &count) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        if (!add_sender(fd))
+        {
+            ipc_send_status(fd, ENOMEM);
+            close(fd);
+            free(strings);
+            continue;
+        }
+        if (!append_arguments(argv, argc, strings, count))
+        {
+            --sender_count;
+            ipc_send_status(fd, ENOMEM);
+            close(fd);
+            free(strings);
+        }
+    }
+}
+
+int coalesce_arguments(unsigned long const window_ms, char* argv[],
+    char*** const out_argv, bool* const out_handed_off)
+{
+    int error;
+    ipc_listener listener;
+    char** new_argv;
+    size_t argc;
+
+    *out_handed_off = false;
+
+    error = ipc_listen(COALESCE_SOCKET_NAME, &listener);
+    if (error == EADDRINUSE)
+    {
+        /* If the collector is gone or has already closed its window, this
+           invocation handles its arguments on its own. */
+        *out_handed_off = hand_off(argv) == 0;
+        *out_argv = argv;
+        return 0;
+    }
+    if (error != 0)
+        return error;
+
+    for (argc = 0; argv[argc]; ++argc);
+    new_argv = (char**)malloc(sizeof(char*) * (argc + 1));
+    if (!new_argv)
+    {
+        ipc_unlisten(COALESCE_SOCKET_NAME, &listener);
+        return ENOMEM;
+    }
+    memcpy(new_argv, argv, sizeof(char*) * (argc + 1));
+
+    collect(listener.fd, window_ms, &new_argv, &argc);
+
+    /* Connections that were not accepted in time get reset and their
+       handlers fall back to starting wine themselves. */
+    ipc_unlisten(COALESCE_SOCKET_NAME, &listener);
+
+    *out_argv = new_argv;
+    return 0;
+}
+
+void reply_to_senders(int const status)
+{
+    size_t i;
+
+    for (i = 0; i < sender_count; ++i)
+    {
+        ipc_send_status(sender_fds[i], status);
+        close(sender_fds[i]);
+    }
+    free(sender_fds);
+    sender_fds = 0;
+    sender_count = 0;
+}
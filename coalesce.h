@@ -0,0 +1,41 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __COALESCE_H__
+#define __COALESCE_H__
+
+#include "bool.h" /* bool */
+
+/* Collects the arguments of handler invocations started within window_ms of
+   each other.  The first invocation becomes the collector and returns with
+   *out_argv holding its own arguments followed by everyone else's; the
+   others hand their arguments to it and return with *out_handed_off set. */
+int coalesce_arguments(unsigned long window_ms, char* argv[],
+    char*** out_argv, bool* out_handed_off);
+/* The collector calls this once the collected arguments are delivered or
+   have failed.  Senders that get a nonzero status handle their arguments on
+   their own.  Does nothing after the first call. */
+void reply_to_senders(int status);
+
+#endif
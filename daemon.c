@@ -0,0 +1,351 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _GNU_SOURCE /* accept4, SOCK_CLOEXEC */
+
+#include "daemon.h"
+#include "arena.h" /* arena_mark, arena_release, run_arena */
+#include "bool.h" /* bool */
+#include "config.h" /* config_bool */
+#include "discovery.h" /* find_osu_process, preloader_to_loader */
+#include "discovery_cache.h" /* read_process_starttime */
+#include "environ.h" /* construct_envp_from_environ, load_env_rules,
+                       read_environ */
+#include "import.h" /* IMPORT_NONE, import_archives, import_mode,
+                       parse_import_mode, read_osu_exe */
+#include "inline.h" /* inline */
+#include "ipc.h" /* ipc_connect, ipc_listen, ipc_recv_status,
+                    ipc_listener, ipc_recv_strings, ipc_send_status,
+                    ipc_send_strings, ipc_set_timeout, ipc_unlisten */
+#include "prewarm.h" /* parse_prewarm_mode, prewarm_files, prewarm_set,
+                        release_prewarm */
+#include "pathmap.h" /* translate_paths */
+#include "procdir.h" /* PROCDIR_BUFFER_SIZE, close_procdir, open_procdir,
+                        parse_procdir_strategy, procdir_dirfd,
+                        procdir_handle */
+#include "trace.h" /* trace_begin, trace_end */
+#include "wineprefix.h" /* PREFIXED_NAME_SIZE, prefixed_name,
+                           start_at_prefix_wineserver */
+
+#include <errno.h> /* ECONNABORTED, EINTR, ENOENT, ENOTSUP, EPROTO, errno */
+#include <limits.h> /* PATH_MAX */
+#include <poll.h> /* POLLIN, poll, struct pollfd */
+#include <signal.h> /* SIGCHLD, SIGPIPE, SIG_DFL, SIG_IGN, signal */
+#include <stdlib.h> /* free, getenv */
+#include <sys/socket.h> /* accept4 */
+#include <sys/syscall.h> /* SYS_pidfd_open */
+#include <sys/types.h> /* pid_t */
+#include <unistd.h> /* _exit, chdir, close, execve, fork, getcwd, syscall */
+
+/* Handlers send their request right after connecting, one that takes
+   longer than this is stuck and must not block everyone else. */
+#define CLIENT_TIMEOUT_MS 500
+
+typedef struct daemon_state {
+    int pidfd; /* -1 if no instance is known */
+    size_t mark; /* arena allocations after this belong to the instance */
+    char* loader_path;
+    char const* loader_name;
+    char* environ;
+    char** envp;
+    import_mode import;
+    char* osu_exe; /* only read with an import mode */
+    prewarm_set prewarm; /* kept in the page cache while the instance runs */
+} daemon_state;
+
+static inline int pidfd_open(pid_t const pid)
+{
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+static void reset_state(daemon_state* const state)
+{
+    if (state->pidfd != -1)
+        close(state->pidfd);
+    release_prewarm(&state->prewarm);
+    arena_release(&run_arena, state->mark);
+
+    state->pidfd = -1;
+    state->loader_path = 0;
+    state->loader_name = 0;
+    state->environ = 0;
+    state->envp = 0;
+    state->osu_exe = 0;
+}
+
+/* The cold path: find the osu! process and remember everything needed to
+   start wine clients for it. */
+static int discover_instance(daemon_state* const state)
+{
+    int error;
+    char procdir_buffer[PROCDIR_BUFFER_SIZE];
+    procdir_handle pdhandle;
+    int proc_dirfd;
+    int dirfd;
+    pid_t pid;
+    size_t environ_size;
+    unsigned long long starttime;
+
+    state->mark = arena_mark(&run_arena);
+
+    if ((error = open_procdir(&pdhandle,
+            parse_procdir_strategy(getenv("OSU_HANDLER_ENUM")),
+            procdir_buffer, sizeof(procdir_buffer))) != 0)
+        return error;
+
+    if ((proc_dirfd = procdir_dirfd(pdhandle)) == -1)
+    {
+        close_procdir(pdhandle);
+        return ENOTSUP;
+    }
+    start_at_prefix_wineserver(pdhandle);
+
+    error = find_osu_process(pdhandle, proc_dirfd, &dirfd, &state->loader_path,
+        &pid);
+    close_procdir(pdhandle);
+    if (error != 0 || dirfd == -1)
+    {
+        reset_state(state);
+        return error != 0 ? error : ENOENT;
+    }
+
+    /* Reloaded for every instance, they live in the arena above the mark. */
+    load_env_rules();
+    if (!read_environ(dirfd, &state->environ, &environ_size) ||
+        !construct_envp_from_environ(state->environ, environ_size,
+            &state->envp))
+    {
+        close(dirfd);
+        reset_state(state);
+        return ENOENT;
+    }
+
+    /* Without the path of osu!.exe, archives keep their original path. */
+    if (state->import != IMPORT_NONE &&
+        read_osu_exe(dirfd, &state->osu_exe) != 0)
+        state->osu_exe = 0;
+
+    /* If the process is still alive after pidfd_open, the pidfd refers to
+       the process we inspected and not to a reused PID. */
+    state->pidfd = pidfd_open(pid);
+    if (state->pidfd == -1 || read_process_starttime(dirfd, &starttime) != 0)
+    {
+        error = state->pidfd == -1 ? errno : ENOENT;
+        close(dirfd);
+        reset_state(state);
+        return error;
+    }
+    close(dirfd);
+
+    state->loader_name = preloader_to_loader(state->loader_path);
+    return 0;
+}
+
+/* The daemon has the time to do this before the first request, so that
+   even the first client after an update of wine starts warm. */
+static void prewarm(daemon_state* const state)
+{
+    unsigned long long const start = trace_begin();
+    size_t bytes;
+    int const error = prewarm_files(
+        parse_prewarm_mode(getenv("OSU_HANDLER_PREWARM")),
+        state->loader_path, state->envp, &state->prewarm, &bytes);
+
+    trace_end(start, "prewarm", "\"error\":%d,\"bytes\":%zu,\"locked\":%zu",
+        error, bytes, state->prewarm.count);
+}
+
+static int discover(daemon_state* const state)
+{
+    unsigned long long const start = trace_begin();
+    int const error = discover_instance(state);
+
+    trace_end(start, "discover", "\"error\":%d", error);
+    if (error == 0)
+        prewarm(state);
+    return error;
+}
+
+/* The same import and translation the handler does before its own
+   handoff, in the forked client so that the daemon is not held up.  Both
+   are configured by the environment of the daemon. */
+static inline void rewrite_args(daemon_state const* const state,
+    char*** const argv)
+{
+    if (state->osu_exe)
+        import_archives(state->import, state->envp, state->osu_exe, *argv,
+            argv);
+    if (config_bool("OSU_HANDLER_TRANSLATE_PATHS", false))
+        translate_paths(state->envp, *argv, argv);
+}
+
+static int spawn_client(daemon_state const* const state, char* const cwd,
+    char* argv[])
+{
+    unsigned long long const start = trace_begin();
+    pid_t pid;
+
+    argv[0] = (char*)state->loader_name;
+
+    pid = fork();
+    if (pid == -1)
+        return errno;
+    if (pid == 0)
+    {
+        /* Ignored dispositions survive execve, the wine loader has to be
+           able to wait for its own children. */
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        if (chdir(cwd) == 0)
+        {
+            rewrite_args(state, &argv);
+            execve(state->loader_path, argv, state->envp);
+        }
+        _exit(127);
+    }
+    trace_end(start, "spawn_client", "\"child\":%ld", (long)pid);
+    return 0;
+}
+
+static void handle_client(daemon_state* const state, int const fd)
+{
+    char** strings;
+    size_t count;
+    int status;
+
+    if (ipc_set_timeout(fd, CLIENT_TIMEOUT_MS) != 0 ||
+        ipc_recv_strings(fd, 0, &strings, &count) != 0)
+        return;
+
+    /* The first string is the working directory of the handler, the rest
+       is its argv without argv[0], which we replace with the cwd slot. */
+    if (count < 1)
+        status = EPROTO;
+    else if (state->pidfd != -1 || (status = discover(state)) == 0)
+        status = spawn_client(state, strings[0], strings);
+
+    ipc_send_status(fd, status);
+    free(strings);
+}
+
+int run_daemon(void)
+{
+    int error;
+    char name[PREFIXED_NAME_SIZE];
+    ipc_listener listener;
+    daemon_state state;
+    struct pollfd fds[2];
+
+    /* Spawned wine clients are never waited for, and a handler that gave
+       up on its reply must not take the daemon down. */
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* A daemon serves the prefix it was started for. */
+    if ((error = prefixed_name(name, DAEMON_SOCKET_NAME)) != 0 ||
+        (error = ipc_listen(name, &listener)) != 0)
+        return error;
+
+    state.pidfd = -1;
+    state.mark = arena_mark(&run_arena);
+    state.loader_path = 0;
+    state.loader_name = 0;
+    state.environ = 0;
+    state.envp = 0;
+    state.import = parse_import_mode(getenv("OSU_HANDLER_IMPORT"));
+    state.osu_exe = 0;
+    state.prewarm.count = 0;
+
+    /* Not finding osu! yet is fine, it is retried on the first request. */
+    discover(&state);
+
+    for (;;)
+    {
+        int nfds;
+        int fd;
+
+        fds[0].fd = listener.fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = state.pidfd;
+        fds[1].events = POLLIN;
+        nfds = state.pidfd == -1 ? 1 : 2;
+
+        if (poll(fds, nfds, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            error = errno;
+            break;
+        }
+
+        /* A pidfd becomes readable when the process exits. */
+        if (nfds == 2 && fds[1].revents)
+            reset_state(&state);
+
+        if (!fds[0].revents)
+            continue;
+
+        fd = accept4(listener.fd, 0, 0, SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            error = errno;
+            break;
+        }
+        handle_client(&state, fd);
+        close(fd);
+    }
+
+    reset_state(&state);
+    ipc_unlisten(name, &listener);
+    return error;
+}
+
+int send_to_daemon(int const argc, char* argv[])
+{
+    char name[PREFIXED_NAME_SIZE];
+    char cwd[PATH_MAX];
+    char* argv0;
+    int error;
+    int fd;
+    int status;
+
+    if (!getcwd(cwd, sizeof(cwd)))
+        return errno;
+
+    if ((error = prefixed_name(name, DAEMON_SOCKET_NAME)) != 0 ||
+        (error = ipc_connect(name, &fd)) != 0)
+        return error;
+
+    /* argv[0] is replaced by the working directory. */
+    argv0 = argv[0];
+    argv[0] = cwd;
+    if ((error = ipc_send_strings(fd, (size_t)argc,
+            (char const* const*)argv)) == 0)
+        error = ipc_recv_status(fd, &status);
+    argv[0] = argv0;
+    close(fd);
+
+    return error ? error : status;
+}
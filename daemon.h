@@ -0,0 +1,40 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#define DAEMON_SOCKET_NAME "daemon.sock"
+
+/* Serves handler requests on DAEMON_SOCKET_NAME, suffixed with the targeted
+   prefix, until a fatal error occurs.  Returns an errno value.  Archive
+   import and path translation of the requests follow OSU_HANDLER_IMPORT
+   and OSU_HANDLER_TRANSLATE_PATHS of the daemon, not of the handlers. */
+int run_daemon(void);
+
+/* Hands argv off to a running daemon.  Returns 0 if the daemon started the
+   wine client, otherwise the handler has to do it itself. */
+int send_to_daemon(int argc, char* argv[]);
+
+#endif
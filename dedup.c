@@ -0,0 +1,182 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _DEFAULT_SOURCE /* ftruncate, realpath */
+
+#include "dedup.h"
+#include "inline.h" /* inline */
+#include "osu_uri.h" /* normalize_osu_uri, osu_uri, parse_osu_uri */
+#include "runtime_dir.h" /* runtime_path */
+
+#include <fcntl.h> /* O_CLOEXEC, O_CREAT, O_RDWR, open */
+#include <limits.h> /* PATH_MAX */
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint64_t */
+#include <stdlib.h> /* realpath */
+#include <string.h> /* strlen */
+#include <sys/mman.h> /* MAP_FAILED, MAP_SHARED, PROT_READ, PROT_WRITE,
+                         mmap */
+#include <sys/stat.h> /* fstat, struct stat */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+#include <unistd.h> /* F_OK, access, close, ftruncate */
+
+#define RING_NAME "recent"
+#define RING_SIZE 64
+
+/* seq numbers the requests from 1, 0 marks a slot that is empty or being
+   written.  Readers only trust hash and time if seq was the same before
+   and after reading them. */
+typedef struct request_slot {
+    uint64_t seq;
+    uint64_t hash;
+    uint64_t time_ms;
+} request_slot;
+
+typedef struct request_ring {
+    uint64_t head;
+    request_slot slots[RING_SIZE];
+} request_ring;
+
+static inline uint64_t monotonic_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a, the strings are short and collisions only cost a click. */
+static inline uint64_t hash_bytes(uint64_t hash, char const* const data,
+    size_t const length)
+{
+    size_t i;
+
+    for (i = 0; i < length; ++i)
+        hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+static inline uint64_t request_hash(char* const argv[])
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    char buffer[PATH_MAX];
+    size_t i;
+
+    for (i = 1; argv[i]; ++i)
+    {
+        char const* arg = argv[i];
+        size_t length;
+        osu_uri uri;
+
+        if (parse_osu_uri(arg, &uri))
+        {
+            length = normalize_osu_uri(&uri, buffer, sizeof(buffer));
+            if (length >= sizeof(buffer))
+                length = sizeof(buffer) - 1;
+            arg = buffer;
+        }
+        else
+        {
+            if (access(arg, F_OK) == 0 && realpath(arg, buffer))
+                arg = buffer;
+            length = strlen(arg);
+        }
+        /* The terminator keeps ("ab", "c") apart from ("a", "bc"). */
+        hash = hash_bytes(hash, arg, length + 1);
+    }
+    return hash;
+}
+
+/* A new file is extended with zeros, which is an empty ring.  The mapping
+   lives until the handler exits or execs. */
+static inline request_ring* open_ring(void)
+{
+    char path[PATH_MAX];
+    int fd;
+    struct stat st;
+    void* ring;
+
+    if (runtime_path(path, sizeof(path), RING_NAME) != 0)
+        return 0;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return 0;
+    if (fstat(fd, &st) == -1 || (st.st_size != sizeof(request_ring) &&
+            ftruncate(fd, sizeof(request_ring)) == -1))
+    {
+        close(fd);
+        return 0;
+    }
+
+    ring = mmap(0, sizeof(request_ring), PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    close(fd);
+    return ring == MAP_FAILED ? 0 : (request_ring*)ring;
+}
+
+/* Every request is recorded, also duplicates, so a burst is dropped as long
+   as its clicks are less than the window apart.  Only earlier requests
+   count, so of two identical ones racing each other, one always goes
+   through. */
+bool is_duplicate_request(unsigned long const window_ms, char* const argv[])
+{
+    request_ring* const ring = open_ring();
+    uint64_t const hash = request_hash(argv);
+    uint64_t const now = monotonic_ms();
+    request_slot* slot;
+    uint64_t seq;
+    size_t i;
+
+    if (!ring)
+        return false;
+
+    seq = __atomic_add_fetch(&ring->head, 1, __ATOMIC_RELAXED);
+    slot = &ring->slots[seq % RING_SIZE];
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot->hash, hash, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->time_ms, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+
+    for (i = 0; i < RING_SIZE; ++i)
+    {
+        request_slot* const other = &ring->slots[i];
+        uint64_t const other_seq =
+            __atomic_load_n(&other->seq, __ATOMIC_ACQUIRE);
+        uint64_t other_hash;
+        uint64_t other_time;
+
+        if (!other_seq || other_seq >= seq)
+            continue;
+        other_hash = __atomic_load_n(&other->hash, __ATOMIC_RELAXED);
+        other_time = __atomic_load_n(&other->time_ms, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&other->seq, __ATOMIC_RELAXED) != other_seq)
+            continue;
+
+        if (other_hash == hash && now - other_time < window_ms)
+            return true;
+    }
+    return false;
+}
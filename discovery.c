@@ -0,0 +1,578 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _POSIX_C_SOURCE 200809L /* fstatat, openat, readlinkat */
+#define _DEFAULT_SOURCE /* fstatat, openat, readlinkat */
+
+#include "discovery.h"
+#include "arena.h" /* arena_commit, arena_mark, arena_new, arena_peek,
+                       arena_release, run_arena */
+#include "attrs.h" /* attr_const */
+#include "config.h" /* config_bool, config_ulong */
+#include "inline.h" /* inline */
+#include "matcher.h" /* COMM_SIZE, have_cmdline_rules, match_cmdline,
+                       match_comm, match_exe */
+#include "pid_path.h" /* pid_path, pid_path_dir, pid_path_file, pid_path_init */
+#include "static_string.h" /* static_strlen, static_endswith */
+#include "trace.h" /* trace_begin, trace_check, trace_counter,
+                      trace_counter_end, trace_end, trace_enabled */
+#include "wineprefix.h" /* process_in_prefix, wine_prefix_id */
+#ifdef HAVE_IO_URING
+#include "uring_probe.h" /* close_uring_prober, open_uring_prober,
+                            uring_probe_batch, uring_prober_handle */
+#endif
+
+#include <errno.h> /* ENOENT, ENOMEM, ESRCH, errno */
+#include <fcntl.h> /* O_DIRECTORY, O_SEARCH, O_RDONLY, openat */
+#include <limits.h> /* PATH_MAX */
+#include <pthread.h> /* pthread_create, pthread_join, pthread_t */
+#include <string.h> /* strlen, strnlen */
+#include <sys/stat.h> /* fstatat, struct stat */
+#include <unistd.h> /* _SC_NPROCESSORS_ONLN, close, read, readlinkat,
+                       sysconf */
+
+/* PIDs a scan worker claims at once. */
+#define SCAN_CHUNK 64
+/* The automatic thread count gives each thread at least this many PIDs. */
+#define SCAN_PIDS_PER_THREAD 2048
+#define MAX_SCAN_THREADS 64
+
+uid_t our_uid;
+wine_prefix_id const* target_prefix;
+
+/* Totals of the individual checks for the trace. */
+static trace_counter uid_counter;
+static trace_counter comm_counter;
+static trace_counter exe_counter;
+
+bool test_uid(int const proc_dirfd, pid_path* const path)
+{
+    struct stat buf;
+
+    return fstatat(proc_dirfd, pid_path_dir(path), &buf, 0) != -1 &&
+        buf.st_uid == our_uid;
+}
+
+static inline bool test_comm(int const proc_dirfd, pid_path* const path)
+{
+    int fd;
+    char buf[COMM_SIZE];
+    ssize_t n;
+
+    fd = openat(proc_dirfd, pid_path_file(path, "comm"), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    n = read(fd, buf, sizeof(buf));
+
+    close(fd);
+
+    return n > 0 && buf[n - 1] == '\n' && match_comm(buf, (size_t)n - 1);
+}
+
+/* Only the first argument is looked at, so a page is plenty. */
+static inline bool test_cmdline(int const proc_dirfd, pid_path* const path)
+{
+    int fd;
+    char buf[4096];
+    ssize_t n;
+
+    if (!have_cmdline_rules())
+        return true;
+
+    fd = openat(proc_dirfd, pid_path_file(path, "cmdline"), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    n = read(fd, buf, sizeof(buf));
+
+    close(fd);
+
+    return n > 0 && match_cmdline(buf, strnlen(buf, (size_t)n));
+}
+
+/* The link is read straight into the arena, so an over-long path simply
+   fails like an unreadable one. */
+static inline char* get_exe_path(int const proc_dirfd, pid_path* const path,
+    size_t* const path_len)
+{
+    size_t space;
+    char* const buffer = (char*)arena_peek(&run_arena, 1, &space);
+    ssize_t link_len;
+
+    if (space > PATH_MAX)
+        space = PATH_MAX;
+
+    link_len = readlinkat(proc_dirfd, pid_path_file(path, "exe"), buffer,
+        space);
+    if (link_len == -1 || (size_t)link_len >= space)
+        return 0;
+
+    buffer[(size_t)link_len] = '\0';
+    arena_commit(&run_arena, buffer, (size_t)link_len + 1);
+    *path_len = (size_t)link_len;
+    return buffer;
+}
+
+static inline bool test_exe(int const proc_dirfd, pid_path* const path,
+    char** const out_exe_path)
+{
+    char* exe_path;
+    size_t path_len;
+
+    exe_path = get_exe_path(proc_dirfd, path, &path_len);
+    if (!exe_path)
+        return false;
+
+    if (!match_exe(exe_path, path_len))
+        return false;
+
+    *out_exe_path = exe_path;
+    return true;
+}
+
+static inline bool test_prefix(int const proc_dirfd, pid_t const pid)
+{
+    return !target_prefix ||
+        process_in_prefix(proc_dirfd, pid, target_prefix);
+}
+
+bool test_process(int const proc_dirfd, pid_t const pid,
+    char** const out_exe_path)
+{
+    pid_path path;
+
+    pid_path_init(&path, pid);
+
+    if (!trace_check(&uid_counter, test_uid(proc_dirfd, &path)))
+        return false;
+
+    if (!trace_check(&comm_counter, test_comm(proc_dirfd, &path)))
+        return false;
+
+    /* The uid is checked again right before the exe is read, the PID may
+       have been reused since the first check. */
+    return test_process_comm_matched(proc_dirfd, pid, out_exe_path);
+}
+
+/* Anything allocated for a process that turns out not to match is rolled
+   back. */
+bool test_process_comm_matched(int const proc_dirfd, pid_t const pid,
+    char** const out_exe_path)
+{
+    size_t const mark = arena_mark(&run_arena);
+    pid_path path;
+
+    pid_path_init(&path, pid);
+
+    if (trace_check(&uid_counter, test_uid(proc_dirfd, &path)) &&
+        trace_check(&exe_counter,
+            test_exe(proc_dirfd, &path, out_exe_path)) &&
+        test_cmdline(proc_dirfd, &path) && test_prefix(proc_dirfd, pid))
+        return true;
+
+    arena_release(&run_arena, mark);
+    return false;
+}
+
+static inline void probe_batch(int const proc_dirfd, pid_t const* const pids,
+    size_t const count, size_t* const out_index, char** const out_exe_path)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+        if (test_process(proc_dirfd, pids[i], out_exe_path))
+            break;
+    *out_index = i;
+}
+
+int open_process_dir(int const proc_dirfd, pid_t const pid,
+    int* const out_dirfd)
+{
+    pid_path path;
+    int dirfd;
+
+    pid_path_init(&path, pid);
+#ifdef O_SEARCH
+    dirfd = openat(proc_dirfd, pid_path_dir(&path), O_SEARCH | O_DIRECTORY);
+#else
+    dirfd = openat(proc_dirfd, pid_path_dir(&path), O_RDONLY | O_DIRECTORY);
+#endif
+    if (dirfd == -1)
+        return errno;
+
+    *out_dirfd = dirfd;
+    return 0;
+}
+
+/* Called for every match with its opened directory, returns whether the
+   scan should go on. */
+typedef bool match_func(void* context, int dirfd, char* exe_path, pid_t pid);
+
+static int scan_processes(procdir_handle const pdhandle, int const proc_dirfd,
+    match_func* const on_match, void* const context)
+{
+    int error;
+    pid_t pids[PROBE_BATCH_SIZE];
+    size_t count;
+    size_t i;
+    size_t index;
+    size_t mark;
+    int dirfd = -1;
+    char* exe_path;
+    bool done = false;
+    unsigned long long start;
+    char const* backend = "sync";
+#ifdef HAVE_IO_URING
+    uring_prober_handle uring = 0;
+
+    if (config_bool("OSU_HANDLER_IO_URING", false) &&
+        open_uring_prober(&uring) != 0)
+        uring = 0;
+    if (uring)
+        backend = "io_uring";
+#endif
+
+    if (trace_enabled())
+    {
+        uid_counter.count = comm_counter.count = exe_counter.count = 0;
+        uid_counter.ns = comm_counter.ns = exe_counter.ns = 0;
+    }
+
+    while (!done)
+    {
+        start = trace_begin();
+        error = procdir_next_processes(pdhandle, pids,
+            sizeof(pids) / sizeof(pids[0]), &count);
+        trace_end(start, "procdir_next_processes", "\"count\":%zu",
+            error == 0 ? count : 0);
+        if (error != 0 || count == 0)
+            break;
+
+        for (i = 0; i < count; ++i)
+        {
+            mark = arena_mark(&run_arena);
+            start = trace_begin();
+#ifdef HAVE_IO_URING
+            /* If the ring fails midway, the batch is probed again without
+               it. */
+            if (uring && uring_probe_batch(uring, proc_dirfd, &pids[i],
+                    count - i, &index, &exe_path) != 0)
+            {
+                close_uring_prober(uring);
+                uring = 0;
+                backend = "sync";
+            }
+            if (!uring)
+#endif
+                probe_batch(proc_dirfd, &pids[i], count - i, &index,
+                    &exe_path);
+            /* The io_uring backend reads comm itself, its time only shows
+               up here and not in the test_comm totals. */
+            trace_end(start, "probe_batch",
+                "\"pids\":%zu,\"backend\":\"%s\"", index, backend);
+
+            i += index;
+            if (i == count)
+                break;
+
+            error = open_process_dir(proc_dirfd, pids[i], &dirfd);
+            if (error == 0)
+            {
+                if ((done = !on_match(context, dirfd, exe_path, pids[i])))
+                    break;
+                continue;
+            }
+
+            arena_release(&run_arena, mark);
+            /* Exited in the meantime. */
+            if (error != ESRCH && error != ENOENT)
+                break;
+            error = 0;
+        }
+        if (error != 0)
+            break;
+    }
+
+#ifdef HAVE_IO_URING
+    if (uring)
+        close_uring_prober(uring);
+#endif
+
+    trace_counter_end(&uid_counter, "test_uid");
+    trace_counter_end(&comm_counter, "test_comm");
+    trace_counter_end(&exe_counter, "test_exe");
+    return error;
+}
+
+/* Worker threads must not touch the arena, so they only run the checks that
+   do not need it and leave the prefix to the calling thread. */
+static inline bool probe_unshared(int const proc_dirfd, pid_t const pid)
+{
+    pid_path path;
+    char exe_path[PATH_MAX];
+    ssize_t link_len;
+
+    pid_path_init(&path, pid);
+    if (!test_uid(proc_dirfd, &path) || !test_comm(proc_dirfd, &path))
+        return false;
+
+    link_len = readlinkat(proc_dirfd, pid_path_file(&path, "exe"), exe_path,
+        sizeof(exe_path));
+    return link_len != -1 && (size_t)link_len < sizeof(exe_path) &&
+        match_exe(exe_path, (size_t)link_len) &&
+        test_cmdline(proc_dirfd, &path);
+}
+
+typedef struct scan_job {
+    int proc_dirfd;
+    pid_t const* pids;
+    size_t count;
+    size_t next; /* first index no worker has claimed yet */
+    size_t found; /* lowest index of a match, count while there is none */
+} scan_job;
+
+/* Workers claim SCAN_CHUNK PIDs at a time, so a worker that got cheap PIDs
+   simply takes more of them.  Like in a sequential scan the match with the
+   lowest index wins, so a match only stops the workers that have moved past
+   it. */
+static void* scan_worker(void* const context)
+{
+    scan_job* const job = (scan_job*)context;
+    size_t found;
+    size_t begin;
+    size_t end;
+
+    while ((begin = __atomic_fetch_add(&job->next, SCAN_CHUNK,
+            __ATOMIC_RELAXED)) < job->count)
+    {
+        end = begin + SCAN_CHUNK < job->count ? begin + SCAN_CHUNK :
+            job->count;
+        for (; begin < end; ++begin)
+        {
+            /* Chunks are claimed in order, the later ones are past it too. */
+            if (begin >= __atomic_load_n(&job->found, __ATOMIC_RELAXED))
+                return 0;
+            if (probe_unshared(job->proc_dirfd, job->pids[begin]))
+            {
+                found = __atomic_load_n(&job->found, __ATOMIC_RELAXED);
+                while (begin < found &&
+                    !__atomic_compare_exchange_n(&job->found, &found, begin,
+                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+                return 0;
+            }
+        }
+    }
+    return 0;
+}
+
+/* All PIDs are listed before the workers start, into the arena. */
+static inline int collect_pids(procdir_handle const pdhandle,
+    pid_t** const out_pids, size_t* const out_count)
+{
+    size_t space;
+    pid_t* const pids = (pid_t*)arena_peek(&run_arena, sizeof(pid_t), &space);
+    size_t count = 0;
+    size_t got;
+    int error;
+
+    space /= sizeof(pid_t);
+    do
+    {
+        if (count == space)
+            return ENOMEM;
+        if ((error = procdir_next_processes(pdhandle, &pids[count],
+                space - count, &got)) != 0)
+            return error;
+        count += got;
+    }
+    while (got != 0);
+
+    arena_commit(&run_arena, pids, count * sizeof(pid_t));
+    *out_pids = pids;
+    *out_count = count;
+    return 0;
+}
+
+/* Below SCAN_PIDS_PER_THREAD PIDs for each, starting a thread costs more
+   than it saves. */
+static inline size_t scan_thread_count(unsigned long const requested,
+    size_t const count)
+{
+    long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = requested;
+
+    if (!threads)
+    {
+        threads = count / SCAN_PIDS_PER_THREAD;
+        if (cpus > 0 && threads > (size_t)cpus)
+            threads = (size_t)cpus;
+    }
+    if (threads > MAX_SCAN_THREADS)
+        threads = MAX_SCAN_THREADS;
+    return threads ? threads : 1;
+}
+
+static int scan_threaded(procdir_handle const pdhandle, int const proc_dirfd,
+    unsigned long const requested, match_func* const on_match,
+    void* const context)
+{
+    pthread_t threads[MAX_SCAN_THREADS];
+    size_t thread_count;
+    size_t started = 0;
+    scan_job job;
+    pid_t* pids;
+    char* exe_path;
+    int dirfd;
+    int error;
+    size_t i;
+    unsigned long long start;
+
+    start = trace_begin();
+    error = collect_pids(pdhandle, &pids, &job.count);
+    trace_end(start, "collect_pids", "\"count\":%zu",
+        error == 0 ? job.count : 0);
+    if (error != 0)
+        return error;
+
+    job.proc_dirfd = proc_dirfd;
+    job.pids = pids;
+    job.next = 0;
+    job.found = job.count;
+    thread_count = scan_thread_count(requested, job.count);
+
+    /* The calling thread is a worker too, failing to start the others only
+       makes it slower. */
+    start = trace_begin();
+    while (started + 1 < thread_count &&
+            pthread_create(&threads[started], 0, scan_worker, &job) == 0)
+        ++started;
+    scan_worker(&job);
+    for (i = 0; i < started; ++i)
+        pthread_join(threads[i], 0);
+    trace_end(start, "scan_threads", "\"threads\":%zu,\"pids\":%zu",
+        started + 1, job.count);
+
+    /* A match in another prefix sends us through the whole list again, one
+       at a time, as the workers may have skipped the real one. */
+    if (job.found != job.count)
+    {
+        if (!test_process_comm_matched(proc_dirfd, pids[job.found],
+                &exe_path))
+            probe_batch(proc_dirfd, pids, job.count, &job.found, &exe_path);
+    }
+    if (job.found == job.count)
+        return 0;
+
+    error = open_process_dir(proc_dirfd, pids[job.found], &dirfd);
+    if (error == 0)
+        on_match(context, dirfd, exe_path, pids[job.found]);
+    else if (error == ESRCH || error == ENOENT)
+        error = 0;
+    return error;
+}
+
+typedef struct first_match {
+    int* dirfd;
+    char** exe_path;
+    pid_t* pid;
+} first_match;
+
+static bool take_first(void* const context, int const dirfd,
+    char* const exe_path, pid_t const pid)
+{
+    first_match const* const match = (first_match const*)context;
+
+    *match->dirfd = dirfd;
+    *match->exe_path = exe_path;
+    *match->pid = pid;
+    return false;
+}
+
+int find_osu_process(procdir_handle const pdhandle, int const proc_dirfd,
+    int* const out_dirfd, char** const out_exe_path, pid_t* const out_pid)
+{
+    unsigned long const threads = config_ulong("OSU_HANDLER_SCAN_THREADS", 1);
+    first_match match;
+
+    match.dirfd = out_dirfd;
+    match.exe_path = out_exe_path;
+    match.pid = out_pid;
+    *out_dirfd = -1;
+    if (threads != 1)
+        return scan_threaded(pdhandle, proc_dirfd, threads, take_first,
+            &match);
+    return scan_processes(pdhandle, proc_dirfd, take_first, &match);
+}
+
+/* The list is appended to through the address of the last next pointer. */
+static bool append_match(void* const context, int const dirfd,
+    char* const exe_path, pid_t const pid)
+{
+    osu_instance*** const tail = (osu_instance***)context;
+    osu_instance* const instance = arena_new(&run_arena, osu_instance, 1);
+
+    if (!instance)
+    {
+        close(dirfd);
+        return false;
+    }
+
+    instance->next = 0;
+    instance->dirfd = dirfd;
+    instance->exe_path = exe_path;
+    instance->pid = pid;
+    **tail = instance;
+    *tail = &instance->next;
+    return true;
+}
+
+int find_osu_processes(procdir_handle const pdhandle, int const proc_dirfd,
+    osu_instance** const out_list)
+{
+    osu_instance** tail = out_list;
+
+    *out_list = 0;
+    return scan_processes(pdhandle, proc_dirfd, append_match, &tail);
+}
+
+/* Because POSIX says basename(3) may write to the input string... */
+static inline attr_const char const* basename_n(char const* const path,
+    size_t const length)
+{
+    char const* ptr = path + length;
+    while (ptr > path && *--ptr != '/');
+    return ptr;
+}
+
+char const* preloader_to_loader(char* const exe_path)
+{
+    size_t exe_path_length;
+
+    exe_path_length = strlen(exe_path);
+    /* An exe rule may match a wine without the preloader, which then is its
+       own loader. */
+    if (static_endswith(exe_path_length, exe_path, "-preloader"))
+        exe_path[exe_path_length -= static_strlen("-preloader")] = '\0';
+    return basename_n(exe_path, exe_path_length);
+}
@@ -0,0 +1,76 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __DISCOVERY_H__
+#define __DISCOVERY_H__
+
+#include "bool.h" /* bool */
+#include "pid_path.h" /* pid_path */
+#include "procdir.h" /* procdir_handle */
+#include "wineprefix.h" /* wine_prefix_id */
+
+#include <sys/types.h> /* pid_t, uid_t */
+
+extern uid_t our_uid;
+/* If set, only processes running in this prefix match. */
+extern wine_prefix_id const* target_prefix;
+
+/* Number of PIDs fetched from the procfs directory at once. */
+#define PROBE_BATCH_SIZE 256
+
+bool test_uid(int proc_dirfd, pid_path* path);
+/* Checks whether pid is an osu! instance of ours, without opening its
+   directory. */
+bool test_process(int proc_dirfd, pid_t pid, char** out_exe_path);
+/* The remaining checks for a process whose comm is already known to match. */
+bool test_process_comm_matched(int proc_dirfd, pid_t pid,
+    char** out_exe_path);
+int open_process_dir(int proc_dirfd, pid_t pid, int* out_dirfd);
+
+/* Scans the remaining processes of pdhandle for a running osu! instance.
+   On success *out_dirfd is the opened /proc directory of the process, or -1
+   if none was found.  With OSU_HANDLER_SCAN_THREADS other than 1, the PIDs
+   are listed first and probed by that many threads, 0 picks a count from
+   the number of PIDs and CPUs. */
+int find_osu_process(procdir_handle pdhandle, int proc_dirfd, int* out_dirfd,
+    char** out_exe_path, pid_t* out_pid);
+
+/* One match of find_osu_processes, allocated in the run arena. */
+typedef struct osu_instance {
+    struct osu_instance* next;
+    int dirfd;
+    char* exe_path;
+    pid_t pid;
+} osu_instance;
+
+/* Like find_osu_process, but goes on to collect every instance in the order
+   they were found.  *out_list is null if there is none. */
+int find_osu_processes(procdir_handle pdhandle, int proc_dirfd,
+    osu_instance** out_list);
+
+/* Strips "-preloader", if there, from the path in place and returns the
+   basename of the resulting wine loader path. */
+char const* preloader_to_loader(char* exe_path);
+
+#endif
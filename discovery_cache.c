@@ -0,0 +1,272 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _GNU_SOURCE /* memrchr */
+
+#include "discovery_cache.h"
+#include "bool.h" /* bool */
+#include "inline.h" /* inline */
+#include "runtime_dir.h" /* runtime_path */
+#include "static_string.h" /* static_strlen, static_startswith */
+#include "wineprefix.h" /* PREFIXED_NAME_SIZE, prefixed_name */
+
+#include <errno.h> /* EINTR, EINVAL, EIO, ENAMETOOLONG, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_CREAT, O_RDONLY, O_RDWR, O_TRUNC, O_WRONLY,
+                      open, openat */
+#include <stddef.h> /* size_t */
+#include <stdio.h> /* rename, snprintf */
+#include <stdlib.h> /* strtoul, strtoull */
+#include <string.h> /* memchr, memcpy, memrchr, strchr, strlen, strncmp */
+#include <sys/file.h> /* LOCK_EX, flock */
+#include <sys/types.h> /* pid_t, ssize_t */
+#include <unistd.h> /* close, getpid, read, unlink */
+
+#define CACHE_NAME "discovery"
+#define LOCK_NAME "discovery.lock"
+
+int read_process_starttime(int const dirfd,
+    unsigned long long* const out_starttime)
+{
+    /* comm is at most 16 bytes, the fields before starttime fit easily. */
+    char buf[512];
+    int fd;
+    ssize_t n;
+    char const* ptr;
+    char const* end;
+    int field;
+
+    fd = openat(dirfd, "stat", O_RDONLY);
+    if (fd == -1)
+        return errno;
+
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return n == 0 ? EINVAL : errno;
+    buf[n] = '\0';
+    end = &buf[n];
+
+    /* Skip "pid (comm)", comm may contain spaces and parentheses. */
+    ptr = (char const*)memrchr(buf, ')', (size_t)n);
+    if (!ptr)
+        return EINVAL;
+
+    /* The state is field 3, starttime is field 22. */
+    for (field = 2; field < 22; ++field)
+    {
+        ptr = (char const*)memchr(ptr, ' ', (size_t)(end - ptr));
+        if (!ptr)
+            return EINVAL;
+        ++ptr;
+    }
+
+    *out_starttime = strtoull(ptr, 0, 10);
+    return 0;
+}
+
+static inline bool cache_value(char const* const line, char const* const key,
+    size_t const key_length, char const** const out_value)
+{
+    if (strncmp(line, key, key_length) != 0)
+        return false;
+    *out_value = line + key_length;
+    return true;
+}
+
+#define cache_key(line, key, out_value) \
+    cache_value((line), (key), static_strlen((key)), (out_value))
+
+/* Large enough for all keys plus a PATH_MAX exe path. */
+#define CACHE_FILE_MAX (PATH_MAX + 256)
+
+/* Plain read/write instead of stdio, which would allocate its buffers on
+   the heap. */
+int load_discovery_cache(discovery_cache* const cache)
+{
+    char name[PREFIXED_NAME_SIZE];
+    char path[PATH_MAX];
+    int error;
+    int fd;
+    char content[CACHE_FILE_MAX + 1];
+    ssize_t n;
+    char* line;
+    char* end;
+
+    if ((error = prefixed_name(name, CACHE_NAME)) != 0 ||
+        (error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+    n = read(fd, content, CACHE_FILE_MAX);
+    error = n == -1 ? errno : 0;
+    close(fd);
+    if (error != 0)
+        return error;
+    content[n] = '\0';
+
+    cache->pid = 0;
+    cache->starttime = 0;
+    cache->hits = 0;
+    cache->scans = 0;
+    cache->exe_path[0] = '\0';
+
+    for (line = content; *line; line = end)
+    {
+        char const* value;
+
+        end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        else
+            end = line + strlen(line);
+
+        if (cache_key(line, "pid=", &value))
+            cache->pid = (pid_t)strtoul(value, 0, 10);
+        else if (cache_key(line, "starttime=", &value))
+            cache->starttime = strtoull(value, 0, 10);
+        else if (cache_key(line, "hits=", &value))
+            cache->hits = strtoul(value, 0, 10);
+        else if (cache_key(line, "scans=", &value))
+            cache->scans = strtoul(value, 0, 10);
+        else if (cache_key(line, "exe=", &value) &&
+                strlen(value) < sizeof(cache->exe_path))
+            memcpy(cache->exe_path, value, strlen(value) + 1);
+    }
+
+    if (cache->pid && !cache->exe_path[0])
+        cache->pid = 0;
+    return 0;
+}
+
+int store_discovery_cache(discovery_cache const* const cache)
+{
+    char name[PREFIXED_NAME_SIZE];
+    char path[PATH_MAX];
+    char temp_path[PATH_MAX];
+    char content[CACHE_FILE_MAX];
+    int error;
+    int fd;
+    int len;
+
+    if ((error = prefixed_name(name, CACHE_NAME)) != 0 ||
+        (error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+
+    /* Write to a temporary file first so that concurrent handlers never see
+       a partially written cache. */
+    len = snprintf(temp_path, sizeof(temp_path), "%s.%ld", path,
+        (long)getpid());
+    if (len < 0 || (size_t)len >= sizeof(temp_path))
+        return ENAMETOOLONG;
+
+    len = snprintf(content, sizeof(content),
+        "pid=%ld\nstarttime=%llu\nexe=%s\nhits=%lu\nscans=%lu\n",
+        (long)cache->pid, cache->starttime, cache->exe_path, cache->hits,
+        cache->scans);
+    if (len < 0 || (size_t)len >= sizeof(content))
+        return ENAMETOOLONG;
+
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return errno;
+
+    error = write(fd, content, (size_t)len) == len ? 0 : EIO;
+    if (close(fd) == -1 && error == 0)
+        error = errno;
+    if (error == 0 && rename(temp_path, path) == -1)
+        error = errno;
+    if (error != 0)
+        unlink(temp_path);
+    return error;
+}
+
+/* Only taken around the read-modify-write of the counters, readers of the
+   cache do not need it. */
+static inline int lock_cache(int* const out_fd)
+{
+    char name[PREFIXED_NAME_SIZE];
+    char path[PATH_MAX];
+    int error;
+    int fd;
+
+    *out_fd = -1;
+    if ((error = prefixed_name(name, LOCK_NAME)) != 0 ||
+        (error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return errno;
+    while (flock(fd, LOCK_EX) == -1)
+    {
+        if (errno == EINTR)
+            continue;
+        error = errno;
+        close(fd);
+        return error;
+    }
+
+    *out_fd = fd;
+    return 0;
+}
+
+int count_discovery_hit(discovery_cache const* const cache)
+{
+    discovery_cache current;
+    int error;
+    int fd;
+
+    if ((error = lock_cache(&fd)) != 0)
+        return error;
+    error = load_discovery_cache(&current);
+    if (error == 0 && current.pid == cache->pid &&
+        current.starttime == cache->starttime)
+    {
+        ++current.hits;
+        error = store_discovery_cache(&current);
+    }
+    close(fd);
+    return error;
+}
+
+int store_discovery_scan(discovery_cache* const cache)
+{
+    discovery_cache current;
+    int error;
+    int fd;
+
+    if ((error = lock_cache(&fd)) != 0)
+        return error;
+    if (load_discovery_cache(&current) != 0)
+    {
+        current.hits = 0;
+        current.scans = 0;
+    }
+    cache->hits = current.hits;
+    cache->scans = current.scans + 1;
+    error = store_discovery_cache(cache);
+    close(fd);
+    return error;
+}
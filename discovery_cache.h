@@ -0,0 +1,57 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __DISCOVERY_CACHE_H__
+#define __DISCOVERY_CACHE_H__
+
+#include <limits.h> /* PATH_MAX */
+#include <sys/types.h> /* pid_t */
+
+typedef struct discovery_cache {
+    pid_t pid; /* 0 if the last scan found nothing */
+    unsigned long long starttime;
+    unsigned long hits;
+    unsigned long scans;
+    char exe_path[PATH_MAX];
+} discovery_cache;
+
+/* Reads the start time (field 22 of "stat") of the process whose /proc
+   directory is dirfd. */
+int read_process_starttime(int dirfd, unsigned long long* out_starttime);
+
+int load_discovery_cache(discovery_cache* cache);
+int store_discovery_cache(discovery_cache const* cache);
+
+/* The counters are read, changed and written back under a lock, so that
+   concurrent handlers do not lose each other's updates.  A follower of a
+   scan relies on scans changing. */
+
+/* Counts a hit on the process in cache, unless the file names another one
+   by now. */
+int count_discovery_hit(discovery_cache const* cache);
+/* Stores the result of a scan in cache, pid 0 if it found nothing, and
+   counts the scan.  hits and scans are set to the stored values. */
+int store_discovery_scan(discovery_cache* cache);
+
+#endif
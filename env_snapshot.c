@@ -0,0 +1,211 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _POSIX_C_SOURCE 200809L /* O_CLOEXEC */
+
+#include "env_snapshot.h"
+#include "arena.h" /* ARENA_ALIGN, arena_alloc, arena_mark, arena_release,
+                       run_arena */
+#include "environ.h" /* env_rules_id */
+#include "runtime_dir.h" /* runtime_path */
+#include "wineprefix.h" /* PREFIXED_NAME_SIZE, prefixed_name */
+
+#include <errno.h> /* EINVAL, EIO, ENAMETOOLONG, ENOMEM, ESTALE, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_CREAT, O_RDONLY, O_TRUNC, O_WRONLY, open */
+#include <limits.h> /* PATH_MAX */
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint32_t, uint64_t */
+#include <stdio.h> /* rename, snprintf */
+#include <string.h> /* memcpy, strlen */
+#include <sys/mman.h> /* MAP_FAILED, MAP_PRIVATE, PROT_READ, PROT_WRITE, mmap,
+                         munmap */
+#include <sys/stat.h> /* fstat, struct stat */
+#include <sys/types.h> /* ssize_t */
+#include <unistd.h> /* close, getpid, unlink, write */
+
+#define SNAPSHOT_NAME "environ"
+#define SNAPSHOT_MAGIC 0x324e454fu /* "OEN2" */
+
+/* Followed by count + 1 64-bit offsets into the string data, the last one
+   being the terminator slot, then the NUL-terminated strings. */
+typedef struct snapshot_header {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t pid;
+    uint64_t starttime;
+    /* env_rules_id of the rules the environment was filtered with. */
+    uint64_t rules;
+    uint64_t data_size;
+} snapshot_header;
+
+int store_env_snapshot(pid_t const pid, unsigned long long const starttime,
+    char* const envp[])
+{
+    char name[PREFIXED_NAME_SIZE];
+    char path[PATH_MAX];
+    char temp_path[PATH_MAX];
+    snapshot_header header;
+    size_t count;
+    size_t table_size;
+    size_t file_size;
+    size_t mark;
+    char* file;
+    uint64_t* offsets;
+    char* data;
+    size_t i;
+    int fd;
+    int len;
+    int error;
+
+    if ((error = prefixed_name(name, SNAPSHOT_NAME)) != 0 ||
+        (error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+    len = snprintf(temp_path, sizeof(temp_path), "%s.%ld", path,
+        (long)getpid());
+    if (len < 0 || (size_t)len >= sizeof(temp_path))
+        return ENAMETOOLONG;
+
+    header.magic = SNAPSHOT_MAGIC;
+    header.pid = (uint64_t)pid;
+    header.starttime = starttime;
+    header.rules = env_rules_id();
+    header.data_size = 0;
+    for (count = 0; envp[count]; ++count)
+        header.data_size += strlen(envp[count]) + 1;
+    header.count = (uint32_t)count;
+
+    table_size = sizeof(uint64_t) * (count + 1);
+    file_size = sizeof(header) + table_size + header.data_size;
+    mark = arena_mark(&run_arena);
+    file = (char*)arena_alloc(&run_arena, file_size, ARENA_ALIGN);
+    if (!file)
+        return ENOMEM;
+
+    memcpy(file, &header, sizeof(header));
+    offsets = (uint64_t*)&file[sizeof(header)];
+    data = &file[sizeof(header) + table_size];
+    for (i = 0; i < count; ++i)
+    {
+        size_t const size = strlen(envp[i]) + 1;
+
+        offsets[i] = (uint64_t)(data - file);
+        memcpy(data, envp[i], size);
+        data += size;
+    }
+    offsets[count] = 0;
+
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        error = errno;
+        arena_release(&run_arena, mark);
+        return error;
+    }
+
+    error = write(fd, file, file_size) == (ssize_t)file_size ? 0 : EIO;
+    arena_release(&run_arena, mark);
+    if (close(fd) == -1 && error == 0)
+        error = errno;
+    if (error == 0 && rename(temp_path, path) == -1)
+        error = errno;
+    if (error != 0)
+        unlink(temp_path);
+    return error;
+}
+
+int load_env_snapshot(pid_t const pid, unsigned long long const starttime,
+    char*** const out_envp)
+{
+    char name[PREFIXED_NAME_SIZE];
+    char path[PATH_MAX];
+    int fd;
+    struct stat st;
+    char* file;
+    snapshot_header header;
+    uint64_t* offsets;
+    char** envp;
+    size_t i;
+    int error;
+
+    /* The offset table is rewritten into pointers in place. */
+    if (sizeof(char*) > sizeof(uint64_t))
+        return EINVAL;
+
+    if ((error = prefixed_name(name, SNAPSHOT_NAME)) != 0 ||
+        (error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+    if (fstat(fd, &st) == -1)
+    {
+        error = errno;
+        close(fd);
+        return error;
+    }
+    if ((size_t)st.st_size < sizeof(header))
+    {
+        close(fd);
+        return EINVAL;
+    }
+
+    file = (char*)mmap(0, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return errno;
+
+    memcpy(&header, file, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC ||
+        sizeof(header) + sizeof(uint64_t) * ((uint64_t)header.count + 1) +
+            header.data_size != (uint64_t)st.st_size)
+    {
+        munmap(file, (size_t)st.st_size);
+        return EINVAL;
+    }
+    if (header.pid != (uint64_t)pid || header.starttime != starttime ||
+        header.rules != env_rules_id())
+    {
+        munmap(file, (size_t)st.st_size);
+        return ESTALE;
+    }
+
+    offsets = (uint64_t*)&file[sizeof(header)];
+    envp = (char**)offsets;
+    for (i = 0; i < header.count; ++i)
+    {
+        uint64_t const offset = offsets[i];
+
+        if (offset >= (uint64_t)st.st_size || file[st.st_size - 1] != '\0')
+        {
+            munmap(file, (size_t)st.st_size);
+            return EINVAL;
+        }
+        envp[i] = &file[offset];
+    }
+    envp[header.count] = 0;
+
+    *out_envp = envp;
+    return 0;
+}
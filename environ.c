@@ -0,0 +1,336 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _POSIX_C_SOURCE 200809L /* O_CLOEXEC, openat */
+
+#include "environ.h"
+#include "arena.h" /* ARENA_ALIGN, arena_commit, arena_peek, run_arena */
+#include "inline.h" /* inline */
+#include "runtime_dir.h" /* config_path */
+#include "static_string.h" /* static_startswith, static_strlen */
+
+#include <errno.h> /* ENOENT, ENOMEM, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_RDONLY, open, openat */
+#include <limits.h> /* PATH_MAX */
+#include <string.h> /* memchr, memcmp, memset, strchr, strlen, strncmp */
+#include <sys/types.h> /* ssize_t */
+#include <unistd.h> /* close, read */
+
+/* Reads the whole file into the arena and terminates it with an extra NUL,
+   which is not included in the size. */
+static inline bool read_into_arena(int const fd, char** const out_content,
+    size_t* const out_size)
+{
+    size_t space;
+    char* const buffer = (char*)arena_peek(&run_arena, 1, &space);
+    size_t pos;
+    ssize_t n;
+
+    pos = 0;
+    while (pos < space && (n = read(fd, &buffer[pos], space - pos)) > 0)
+        pos += (size_t)n;
+    if (pos == space || n < 0)
+        return false;
+    buffer[pos] = '\0';
+
+    arena_commit(&run_arena, buffer, pos + 1);
+    *out_content = buffer;
+    *out_size = pos;
+    return true;
+}
+
+bool read_environ(int const dirfd, char** const out_environ,
+    size_t* const out_environ_size)
+{
+    int fd;
+    bool ret;
+
+    fd = openat(dirfd, "environ", O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    ret = read_into_arena(fd, out_environ, out_environ_size);
+
+    close(fd);
+    return ret;
+}
+
+typedef enum env_rule_action {
+    ENV_RULE_STRIP,
+    ENV_RULE_OVERRIDE,
+    ENV_RULE_INJECT
+} env_rule_action;
+
+/* name is the variable name without the '=', value is the complete
+   "NAME=VALUE" entry of override and inject rules. */
+typedef struct env_rule {
+    env_rule_action action;
+    char const* name;
+    size_t length;
+    char const* value;
+} env_rule;
+
+/* Generated from environ.rules, defines env_rules and match_env_rule. */
+#include "envrules.h" /* ENV_RULES_HASH, ENV_RULE_COUNT, env_rules,
+                         match_env_rule */
+
+#define SITE_RULES_NAME "environ.rules"
+
+typedef struct site_rule {
+    env_rule rule;
+    bool seen;
+} site_rule;
+
+static site_rule* site_rules;
+static size_t site_rule_count;
+static unsigned long long rules_id = ENV_RULES_HASH;
+/* Compiled rules for variables that also have a site rule. */
+static bool superseded[ENV_RULE_COUNT + 1];
+
+static inline unsigned long long hash_rules(unsigned long long hash,
+    char const* const data, size_t const size)
+{
+    size_t i = 0;
+    for (; i < size; ++i)
+        hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+/* Parses one line of the rules file in place, see environ.rules for the
+   syntax. */
+static inline bool parse_site_rule(char* const line, env_rule* const rule)
+{
+    size_t const length = strlen(line);
+    char* arg;
+    char* end;
+    char const* eq;
+
+    if (static_startswith(length, line, "strip "))
+    {
+        rule->action = ENV_RULE_STRIP;
+        arg = &line[static_strlen("strip ")];
+    }
+    else if (static_startswith(length, line, "override "))
+    {
+        rule->action = ENV_RULE_OVERRIDE;
+        arg = &line[static_strlen("override ")];
+    }
+    else if (static_startswith(length, line, "inject "))
+    {
+        rule->action = ENV_RULE_INJECT;
+        arg = &line[static_strlen("inject ")];
+    }
+    else
+        return false;
+
+    while (*arg == ' ')
+        ++arg;
+    eq = strchr(arg, '=');
+    if (rule->action == ENV_RULE_STRIP)
+    {
+        if (eq)
+            return false;
+        end = &arg[strlen(arg)];
+        while (end != arg && (end[-1] == ' ' || end[-1] == '\r'))
+            --end;
+        *end = '\0';
+        eq = end;
+        rule->value = 0;
+    }
+    else
+    {
+        if (!eq)
+            return false;
+        rule->value = arg;
+    }
+
+    rule->name = arg;
+    rule->length = (size_t)(eq - arg);
+    return rule->length != 0;
+}
+
+static inline int parse_site_rules(char* const content)
+{
+    size_t space;
+    site_rule* const rules =
+        (site_rule*)arena_peek(&run_arena, ARENA_ALIGN, &space);
+    size_t const capacity = space / sizeof(site_rule);
+    size_t count = 0;
+    char* line;
+    char* end;
+    size_t i;
+    size_t j;
+
+    for (line = content; *line; line = end)
+    {
+        end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        else
+            end = &line[strlen(line)];
+
+        while (*line == ' ')
+            ++line;
+        if (*line == '#' || *line == '\0' || *line == '\r')
+            continue;
+        if (count == capacity)
+            return ENOMEM;
+        /* Malformed lines are ignored, like unknown variables would be. */
+        if (parse_site_rule(line, &rules[count].rule))
+            rules[count++].seen = false;
+    }
+
+    arena_commit(&run_arena, rules, sizeof(site_rule) * count);
+    site_rules = rules;
+    site_rule_count = count;
+
+    for (i = 0; i < count; ++i)
+        for (j = 0; j < ENV_RULE_COUNT; ++j)
+            if (rules[i].rule.length == env_rules[j].length &&
+                memcmp(rules[i].rule.name, env_rules[j].name,
+                    env_rules[j].length) == 0)
+                superseded[j] = true;
+    return 0;
+}
+
+int load_env_rules(void)
+{
+    char path[PATH_MAX];
+    int fd;
+    char* content;
+    size_t size;
+    bool b;
+    int error;
+
+    site_rules = 0;
+    site_rule_count = 0;
+    rules_id = ENV_RULES_HASH;
+    memset(superseded, 0, sizeof(superseded));
+
+    if ((error = config_path(path, sizeof(path), SITE_RULES_NAME)) != 0)
+        return error == ENOENT ? 0 : error;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno == ENOENT ? 0 : errno;
+    b = read_into_arena(fd, &content, &size);
+    close(fd);
+    if (!b)
+        return ENOMEM;
+
+    rules_id = hash_rules(rules_id, content, size);
+    return parse_site_rules(content);
+}
+
+unsigned long long env_rules_id(void)
+{
+    return rules_id;
+}
+
+/* Site rules take precedence, the compiled ones are matched by the
+   generated trie.  The rule is marked as seen so that it is not injected
+   again at the end. */
+static inline env_rule const* find_env_rule(char const* const envar,
+    bool* const compiled_seen)
+{
+    size_t i = 0;
+    int index;
+
+    for (; i < site_rule_count; ++i)
+    {
+        env_rule const* const rule = &site_rules[i].rule;
+
+        if (strncmp(envar, rule->name, rule->length) == 0 &&
+            envar[rule->length] == '=')
+        {
+            site_rules[i].seen = true;
+            return rule;
+        }
+    }
+
+    index = match_env_rule(envar);
+    if (index == -1)
+        return 0;
+    compiled_seen[index] = true;
+    return &env_rules[index];
+}
+
+/* A single pass over environ that keeps the variables in place and builds
+   envp right behind them in the arena. */
+bool construct_envp_from_environ(char* environ, size_t const environ_size,
+    char*** const out_envp)
+{
+    char* const environ_end = &environ[environ_size];
+    size_t space;
+    char** const envp = (char**)arena_peek(&run_arena, sizeof(char*), &space);
+    size_t const capacity = space / sizeof(char*);
+    size_t count = 0;
+    char* envar_end = environ;
+    bool compiled_seen[ENV_RULE_COUNT + 1] = { false };
+    size_t i;
+
+    for (i = 0; i < site_rule_count; ++i)
+        site_rules[i].seen = false;
+
+    while ((envar_end = (char*)memchr(envar_end, '\0', environ_end - envar_end)))
+    {
+        char* const envar_start = environ;
+        env_rule const* const rule = find_env_rule(envar_start, compiled_seen);
+
+        environ = ++envar_end;
+        if (rule && rule->action == ENV_RULE_STRIP)
+            continue;
+        if (count == capacity)
+            return false;
+        if (rule && rule->action == ENV_RULE_OVERRIDE)
+            envp[count++] = (char*)rule->value;
+        else
+            envp[count++] = envar_start;
+    }
+
+    /* Override and inject rules add their variable if osu! did not have
+       it. */
+    for (i = 0; i < site_rule_count + ENV_RULE_COUNT; ++i)
+    {
+        bool const site = i < site_rule_count;
+        size_t const index = site ? i : i - site_rule_count;
+        env_rule const* const rule =
+            site ? &site_rules[index].rule : &env_rules[index];
+
+        if (rule->action == ENV_RULE_STRIP ||
+            (site ? site_rules[index].seen :
+                compiled_seen[index] || superseded[index]))
+            continue;
+        if (count == capacity)
+            return false;
+        envp[count++] = (char*)rule->value;
+    }
+
+    if (count == capacity)
+        return false;
+    envp[count++] = 0;
+
+    arena_commit(&run_arena, envp, sizeof(char*) * count);
+    *out_envp = envp;
+    return true;
+}
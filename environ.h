@@ -0,0 +1,43 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __ENVIRON_H__
+#define __ENVIRON_H__
+
+#include "bool.h" /* bool */
+
+#include <stddef.h> /* size_t */
+
+/* Loads the site-specific rules from the config directory into the arena,
+   a missing file is not an error.  Has to be called again after releasing
+   the arena below them. */
+int load_env_rules(void);
+/* Identifies the compiled and site rules currently in effect. */
+unsigned long long env_rules_id(void);
+
+bool read_environ(int dirfd, char** out_environ, size_t* out_environ_size);
+bool construct_envp_from_environ(char* environ, size_t environ_size,
+    char*** out_envp);
+
+#endif
@@ -0,0 +1,235 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#define _POSIX_C_SOURCE 200809L /* clock_gettime */
+
+#include "fanout.h"
+#include "arena.h" /* arena_new, run_arena */
+#include "config.h" /* config_bool */
+#include "discovery.h" /* find_osu_processes, osu_instance,
+                          preloader_to_loader */
+#include "environ.h" /* construct_envp_from_environ, load_env_rules,
+                       read_environ */
+#include "import.h" /* IMPORT_COPY, IMPORT_MOVE, IMPORT_NONE,
+                       import_archives, import_mode, parse_import_mode,
+                       read_osu_exe */
+#include "pathmap.h" /* translate_paths */
+#include "procdir.h" /* PROCDIR_BUFFER_SIZE, close_procdir, open_procdir,
+                        parse_procdir_strategy, procdir_dirfd,
+                        procdir_handle */
+#include "trace.h" /* trace_point */
+#include "wineprefix.h" /* start_at_prefix_wineserver */
+
+#include <errno.h> /* EINTR, ENOENT, ENOMEM, ENOTSUP, errno */
+#include <spawn.h> /* posix_spawn */
+#include <stdio.h> /* fprintf, stderr */
+#include <stdlib.h> /* getenv */
+#include <string.h> /* strerror */
+#include <sys/types.h> /* pid_t */
+#include <sys/wait.h> /* WEXITSTATUS, WIFEXITED, waitpid */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+#include <unistd.h> /* close */
+
+/* The state of one wine client.  status is its wait status once it has
+   exited, error is set instead if it never ran. */
+typedef struct fanout_client {
+    osu_instance const* instance;
+    pid_t pid;
+    int error;
+    int status;
+    unsigned long long start;
+    unsigned long long end;
+} fanout_client;
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull +
+        (unsigned long long)ts.tv_nsec;
+}
+
+/* argv[0] is only read during posix_spawn, so it can be replaced for every
+   client in turn.  Archives are imported into the folder of every instance,
+   see fan_out for the mode. */
+static inline void spawn_client(fanout_client* const client,
+    import_mode import, char* argv[])
+{
+    osu_instance const* const instance = client->instance;
+    char* environ;
+    size_t environ_size;
+    char** envp;
+    char* osu_exe;
+    char** client_argv = argv;
+    bool b;
+
+    client->start = now_ns();
+    /* The command line is only readable while dirfd is open. */
+    if (import != IMPORT_NONE && read_osu_exe(instance->dirfd, &osu_exe) != 0)
+        import = IMPORT_NONE;
+    b = read_environ(instance->dirfd, &environ, &environ_size);
+    close(instance->dirfd);
+    if (!b || !construct_envp_from_environ(environ, environ_size, &envp))
+    {
+        client->error = ENOENT;
+        return;
+    }
+
+    argv[0] = (char*)preloader_to_loader(instance->exe_path);
+    /* Either leaves the arguments as they are if it fails. */
+    if (import != IMPORT_NONE)
+        import_archives(import, envp, osu_exe, argv, &client_argv);
+    /* Every instance may live in a prefix with other drives. */
+    if (config_bool("OSU_HANDLER_TRANSLATE_PATHS", false))
+        translate_paths(envp, client_argv, &client_argv);
+    client->error = posix_spawn(&client->pid, instance->exe_path, 0, 0,
+        client_argv, envp);
+}
+
+static inline void wait_clients(fanout_client* const clients,
+    size_t const count, size_t running)
+{
+    int status;
+    pid_t pid;
+    size_t i;
+
+    while (running)
+    {
+        pid = waitpid(-1, &status, 0);
+        if (pid == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (i = 0; i < count; ++i)
+            if (!clients[i].error && clients[i].pid == pid)
+                break;
+        if (i == count)
+            continue;
+        clients[i].end = now_ns();
+        clients[i].status = status;
+        --running;
+    }
+}
+
+/* Latencies run from reading the environment to the exit of the client,
+   which is when osu! has been handed the arguments. */
+static inline bool report_client(fanout_client const* const client)
+{
+    long const target = (long)client->instance->pid;
+    unsigned long long const latency = client->end - client->start;
+    bool const ok = !client->error && WIFEXITED(client->status) &&
+        WEXITSTATUS(client->status) == 0;
+
+    if (client->error)
+        fprintf(stderr, "osu-handler-wine: instance %ld: %s\n", target,
+            strerror(client->error));
+    else if (!ok)
+        fprintf(stderr, "osu-handler-wine: instance %ld: client failed "
+            "after %llu ms (status %d)\n", target, latency / 1000000,
+            client->status);
+    else
+        fprintf(stderr, "osu-handler-wine: instance %ld: delivered in "
+            "%llu ms\n", target, latency / 1000000);
+
+    trace_point("fanout_client",
+        "\"target_pid\":%ld,\"error\":%d,\"status\":%d,\"latency_ns\":%llu",
+        target, client->error, client->error ? 0 : client->status,
+        client->error ? 0 : latency);
+    return ok;
+}
+
+int fan_out(char* argv[], bool* const out_found, size_t* const out_failed)
+{
+    int error;
+    char procdir_buffer[PROCDIR_BUFFER_SIZE];
+    procdir_handle pdhandle;
+    int proc_dirfd;
+    osu_instance* instances;
+    osu_instance const* instance;
+    fanout_client* clients;
+    import_mode import;
+    size_t count = 0;
+    size_t running = 0;
+    size_t i;
+
+    *out_failed = 0;
+
+    error = open_procdir(&pdhandle,
+        parse_procdir_strategy(getenv("OSU_HANDLER_ENUM")), procdir_buffer,
+        sizeof(procdir_buffer));
+    if (error != 0)
+        return error;
+
+    if ((proc_dirfd = procdir_dirfd(pdhandle)) == -1)
+    {
+        close_procdir(pdhandle);
+        return ENOTSUP;
+    }
+    start_at_prefix_wineserver(pdhandle);
+
+    error = find_osu_processes(pdhandle, proc_dirfd, &instances);
+    close_procdir(pdhandle);
+
+    for (instance = instances; instance; instance = instance->next)
+        ++count;
+    *out_found = count != 0;
+    if (!count)
+        return error;
+
+    if (!(clients = arena_new(&run_arena, fanout_client, count)))
+    {
+        for (instance = instances; instance; instance = instance->next)
+            close(instance->dirfd);
+        return ENOMEM;
+    }
+
+    /* Without the site rules the compiled ones still apply. */
+    load_env_rules();
+    /* A moved archive is gone for the instances after it, so every instance
+       but the last gets a copy. */
+    import = parse_import_mode(getenv("OSU_HANDLER_IMPORT"));
+    for (i = 0, instance = instances; instance; ++i, instance = instance->next)
+    {
+        clients[i].instance = instance;
+        clients[i].error = 0;
+        clients[i].status = 0;
+        clients[i].end = 0;
+        spawn_client(&clients[i],
+            import == IMPORT_MOVE && instance->next ? IMPORT_COPY : import,
+            argv);
+        if (!clients[i].error)
+            ++running;
+    }
+
+    wait_clients(clients, count, running);
+
+    for (i = 0; i < count; ++i)
+        if (!report_client(&clients[i]))
+            ++*out_failed;
+    return 0;
+}
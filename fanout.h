@@ -0,0 +1,41 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#pragma once
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#include "bool.h" /* bool */
+
+#include <stddef.h> /* size_t */
+
+/* Starts a wine client with argv for every osu! instance the scan finds,
+   each through its own loader and filtered environment, and waits for all
+   of them.  OSU_HANDLER_IMPORT and OSU_HANDLER_TRANSLATE_PATHS apply to
+   every instance, like they do to a single one.  The outcome and latency of every client are written to stderr
+   and the trace.  *out_found is unset if there was no instance,
+   *out_failed counts the clients that could not be started or failed. */
+int fan_out(char* argv[], bool* out_found, size_t* out_failed);
+
+#endif
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""Turns environ.rules into envrules.h, a rule table plus a matcher that
+walks a trie of the variable names as nested switches."""
+
+import sys
+
+ACTIONS = {
+    'strip': 'ENV_RULE_STRIP',
+    'override': 'ENV_RULE_OVERRIDE',
+    'inject': 'ENV_RULE_INJECT',
+}
+
+
+def parse(path):
+    rules = []
+    names = set()
+    with open(path, encoding='utf-8') as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.rstrip('\n')
+            if not line.strip() or line.lstrip().startswith('#'):
+                continue
+            action, _, arg = line.partition(' ')
+            arg = arg.strip() if action == 'strip' else arg.lstrip(' ')
+            name, eq, _ = arg.partition('=')
+            if (action not in ACTIONS or not name or
+                    bool(eq) == (action == 'strip')):
+                sys.exit('{}:{}: invalid rule'.format(path, lineno))
+            if name in names:
+                sys.exit('{}:{}: duplicate rule for {}'.format(
+                    path, lineno, name))
+            names.add(name)
+            rules.append((action, name, arg if eq else None))
+    return rules
+
+
+def fnv1a(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def emit_node(out, keys, depth, indent):
+    """keys are (name + '=', index) pairs sharing their first depth bytes.
+    No key is a prefix of another because they all end with '='."""
+    pad = '    ' * indent
+    if len(keys) == 1:
+        key, index = keys[0]
+        rest = key[depth:]
+        out.append('{}return strncmp(&envar[{}], {}, {}) == 0 ? {} : -1;'
+            .format(pad, depth, c_string(rest), len(rest), index))
+        return
+
+    common = 0
+    while all(len(k) > depth + common and
+            k[depth + common] == keys[0][0][depth + common] for k, _ in keys):
+        common += 1
+    if common > 1:
+        prefix = keys[0][0][depth:depth + common]
+        out.append('{}if (strncmp(&envar[{}], {}, {}) != 0)'.format(
+            pad, depth, c_string(prefix), common))
+        out.append('{}    return -1;'.format(pad))
+        depth += common
+
+    out.append('{}switch (envar[{}])'.format(pad, depth))
+    out.append('{}{{'.format(pad))
+    for c in sorted(set(k[depth] for k, _ in keys)):
+        out.append("{}case '{}':".format(pad, c.replace("'", "\\'")))
+        emit_node(out, [(k, i) for k, i in keys if k[depth] == c], depth + 1,
+            indent + 1)
+    out.append('{}default:'.format(pad))
+    out.append('{}    return -1;'.format(pad))
+    out.append('{}}}'.format(pad))
+
+
+def generate(rules):
+    canonical = ''.join('{} {}\n'.format(a, v if v else n)
+        for a, n, v in rules)
+    out = [
+        '/* Generated by gen_envrules.py from environ.rules, do not edit. */',
+        '',
+        '#define ENV_RULES_HASH 0x{:016x}ull'.format(
+            fnv1a(canonical.encode('utf-8'))),
+        '#define ENV_RULE_COUNT {}'.format(len(rules)),
+        '',
+        'static env_rule const env_rules[ENV_RULE_COUNT + 1] = {',
+    ]
+    for action, name, value in rules:
+        out.append('    {{ {}, {}, {}, {} }},'.format(ACTIONS[action],
+            c_string(name), len(name), c_string(value) if value else '0'))
+    out += [
+        '    { ENV_RULE_STRIP, 0, 0, 0 }',
+        '};',
+        '',
+        '/* Returns the index of the rule for the variable envar, or -1. */',
+        'static inline int match_env_rule(char const* const envar)',
+        '{',
+    ]
+    if rules:
+        emit_node(out, sorted((n + '=', i) for i, (_, n, _) in
+            enumerate(rules)), 0, 1)
+    else:
+        out.append('    return (void)envar, -1;')
+    out += ['}', '']
+    return '\n'.join(out)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: gen_envrules.py <environ.rules> <envrules.h>')
+    with open(sys.argv[2], 'w', encoding='utf-8') as f:
+        f.write(generate(parse(sys.argv[1])))
+
+
+if __name__ == '__main__':
+    main()
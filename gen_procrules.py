@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+# Copyright (C) 2021 Torge Matthies
+#
+# This file is part of osu-handler-wine.
+#
+# osu-handler-wine is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# osu-handler-wine is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+"""Turns process.rules into procrules.h: a perfect hash table of the comm
+names, a matcher that walks a trie of the reversed exe suffixes as nested
+switches, and the cmdline suffixes."""
+
+import sys
+
+# The kernel keeps 15 bytes of a comm, /proc/<pid>/comm adds a newline.
+COMM_MAX = 15
+KINDS = ('comm', 'exe', 'cmdline')
+
+
+def parse(path):
+    rules = {kind: [] for kind in KINDS}
+    with open(path, encoding='utf-8') as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.rstrip('\r\n')
+            if not line.strip() or line.lstrip().startswith('#'):
+                continue
+            kind, _, arg = line.strip().partition(' ')
+            arg = arg.strip()
+            if kind not in rules or not arg:
+                sys.exit('{}:{}: invalid rule'.format(path, lineno))
+            if kind == 'comm':
+                arg = arg.encode('utf-8')[:COMM_MAX].decode('utf-8',
+                    'ignore')
+            if arg not in rules[kind]:
+                rules[kind].append(arg)
+    if not rules['comm'] or not rules['exe']:
+        sys.exit('{}: at least one comm and one exe rule are needed'.format(
+            path))
+    # A suffix that ends with a shorter one never decides anything.
+    rules['exe'] = [s for s in rules['exe'] if not any(
+        o != s and s.endswith(o) for o in rules['exe'])]
+    return rules
+
+
+def comm_hash(seed, data):
+    h = seed
+    for b in data:
+        h = ((h ^ b) * 0x01000193) & 0xffffffff
+    return h
+
+
+def perfect_table(names):
+    size = 1
+    while size < 2 * len(names):
+        size *= 2
+    seed = 0x811c9dc5
+    while True:
+        slots = {}
+        for name in names:
+            slot = comm_hash(seed, name.encode('utf-8')) & (size - 1)
+            if slot in slots:
+                break
+            slots[slot] = name
+        else:
+            return seed, size, slots
+        seed = (seed + 1) & 0xffffffff
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def c_char(c):
+    return "'" + {'\\': '\\\\', "'": "\\'"}.get(c, c) + "'"
+
+
+def emit_node(out, keys, depth, indent):
+    """keys are reversed suffixes sharing their first depth characters, no
+    key is a prefix of another.  depth characters at the end of path are
+    known to match."""
+    pad = '    ' * indent
+    if len(keys) == 1:
+        key = keys[0]
+        rest = key[depth:][::-1]
+        out.append('{}return length >= {} &&'.format(pad, len(key)))
+        out.append('{}    memcmp(&path[length - {}], {}, {}) == 0;'.format(
+            pad, len(key), c_string(rest), len(rest)))
+        return
+
+    common = 0
+    while all(len(k) > depth + common and
+            k[depth + common] == keys[0][depth + common] for k in keys):
+        common += 1
+    # The keys go on after the common part, so the switch below needs one
+    # more character.
+    if common > 1:
+        part = keys[0][depth:depth + common][::-1]
+        out.append('{}if (length <= {} ||'.format(pad, depth + common))
+        out.append('{}    memcmp(&path[length - {}], {}, {}) != 0)'.format(
+            pad, depth + common, c_string(part), common))
+        depth += common
+    elif depth:
+        out.append('{}if (length <= {})'.format(pad, depth))
+    else:
+        out.append('{}if (length == 0)'.format(pad))
+    out.append('{}    return false;'.format(pad))
+    out.append('{}switch (path[length - {}])'.format(pad, depth + 1))
+    out.append('{}{{'.format(pad))
+    for c in sorted(set(k[depth] for k in keys)):
+        out.append('{}case {}:'.format(pad, c_char(c)))
+        emit_node(out, [k for k in keys if k[depth] == c], depth + 1,
+            indent + 1)
+    out.append('{}default:'.format(pad))
+    out.append('{}    return false;'.format(pad))
+    out.append('{}}}'.format(pad))
+
+
+def generate(rules):
+    seed, size, slots = perfect_table(rules['comm'])
+    out = [
+        '/* Generated by gen_procrules.py from process.rules, do not edit. */',
+        '',
+        '#define COMM_HASH_SEED 0x{:08x}u'.format(seed),
+        '#define COMM_TABLE_SIZE {}'.format(size),
+        '#define CMDLINE_RULE_COUNT {}'.format(len(rules['cmdline'])),
+        '',
+        'static process_rule const comm_table[COMM_TABLE_SIZE] = {',
+    ]
+    for slot in range(size):
+        name = slots.get(slot)
+        out.append('    {{ {}, {} }},'.format(c_string(name),
+            len(name.encode('utf-8'))) if name else '    { 0, 0 },')
+    out += [
+        '};',
+        '',
+        'static process_rule const cmdline_rules[CMDLINE_RULE_COUNT + 1] = {',
+    ]
+    for suffix in rules['cmdline']:
+        out.append('    {{ {}, {} }},'.format(c_string(suffix),
+            len(suffix.encode('utf-8'))))
+    out += [
+        '    { 0, 0 }',
+        '};',
+        '',
+        '/* Returns whether path, of length bytes, ends with an exe suffix. */',
+        'static inline bool match_exe_suffix(char const* const path,',
+        '    size_t const length)',
+        '{',
+    ]
+    emit_node(out, sorted(s[::-1] for s in rules['exe']), 0, 1)
+    out += ['}', '']
+    return '\n'.join(out)
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: gen_procrules.py <process.rules> <procrules.h>')
+    with open(sys.argv[2], 'w', encoding='utf-8') as f:
+        f.write(generate(parse(sys.argv[1])))
+
+
+if __name__ == '__main__':
+    main()
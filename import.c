@@ -0,0 +1,336 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#define _GNU_SOURCE /* copy_file_range, renameat2 */
+
+#include "import.h"
+#include "arena.h" /* arena_alloc, arena_commit, arena_new, arena_peek,
+                       run_arena */
+#include "bool.h" /* bool */
+#include "inline.h" /* inline */
+#include "pathmap.h" /* windows_to_unix_path */
+#include "trace.h" /* trace_begin, trace_end */
+
+#include <errno.h> /* EEXIST, EINTR, EINVAL, EIO, ENAMETOOLONG, ENOMEM,
+                      ENOSYS, EOPNOTSUPP, EXDEV, errno */
+#include <fcntl.h> /* AT_FDCWD, O_CLOEXEC, O_CREAT, O_EXCL, O_RDONLY,
+                      O_WRONLY, open, openat */
+#include <limits.h> /* PATH_MAX */
+#include <linux/fs.h> /* FICLONE */
+#include <stdio.h> /* RENAME_NOREPLACE, renameat2, snprintf */
+#include <stdlib.h> /* getenv */
+#include <string.h> /* memchr, memcpy, strcmp, strlen, strrchr */
+#include <strings.h> /* strcasecmp */
+#include <sys/ioctl.h> /* ioctl */
+#include <sys/sendfile.h> /* sendfile */
+#include <sys/stat.h> /* S_ISREG, fstat, mkdir, struct stat */
+#include <sys/types.h> /* off_t, pid_t, ssize_t */
+#include <unistd.h> /* close, copy_file_range, getpid, link, read, unlink */
+
+/* Names tried when an archive of the same name is already there, up to
+   "<stem> (99).<ext>". */
+#define MAX_NAME_SUFFIX 99
+#define NAME_SUFFIX_SIZE sizeof(" (99)")
+
+import_mode parse_import_mode(char const* const name)
+{
+    if (!name)
+        return IMPORT_NONE;
+    if (strcmp(name, "copy") == 0)
+        return IMPORT_COPY;
+    if (strcmp(name, "move") == 0)
+        return IMPORT_MOVE;
+    return IMPORT_NONE;
+}
+
+int read_osu_exe(int const dirfd, char** const out_exe)
+{
+    size_t space;
+    char* const buffer = (char*)arena_peek(&run_arena, 1, &space);
+    int fd;
+    ssize_t n;
+    char const* end;
+
+    fd = openat(dirfd, "cmdline", O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+    n = read(fd, buffer, space);
+    close(fd);
+    if (n == -1)
+        return errno;
+
+    end = (char const*)memchr(buffer, '\0', (size_t)n);
+    if (!end || end == buffer)
+        return EINVAL;
+    arena_commit(&run_arena, buffer, (size_t)(end - buffer) + 1);
+    *out_exe = buffer;
+    return 0;
+}
+
+/* The folder osu!.exe lives in, as a Unix path in the run arena. */
+static inline int find_osu_dir(char* const envp[], char const* const osu_exe,
+    char** const out_dir)
+{
+    char const* const dir = getenv("OSU_HANDLER_OSU_DIR");
+    char* path;
+    char* slash;
+    int error;
+
+    if (dir && dir[0])
+    {
+        *out_dir = (char*)dir;
+        return 0;
+    }
+
+    if (osu_exe[0] == '/')
+    {
+        size_t const length = strlen(osu_exe) + 1;
+
+        if (!(path = (char*)arena_alloc(&run_arena, length, 1)))
+            return ENOMEM;
+        memcpy(path, osu_exe, length);
+    }
+    else if ((error = windows_to_unix_path(envp, osu_exe, &path)) != 0)
+        return error;
+
+    if (!(slash = strrchr(path, '/')) || slash == path)
+        return EINVAL;
+    *slash = '\0';
+    *out_dir = path;
+    return 0;
+}
+
+static inline char const* archive_subdir(char const* const path)
+{
+    size_t const length = strlen(path);
+
+    if (length < 4)
+        return 0;
+    if (strcasecmp(&path[length - 4], ".osz") == 0)
+        return "Songs";
+    if (strcasecmp(&path[length - 4], ".osk") == 0)
+        return "Skins";
+    return 0;
+}
+
+/* copy_file_range() stays inside the kernel and lets the filesystem share
+   extents, sendfile() at least avoids the round trip through user space
+   where copy_file_range() refuses, e.g. across filesystems on older
+   kernels. */
+static inline int copy_data(int const src_fd, int const dst_fd, off_t size,
+    char const** const out_method)
+{
+    ssize_t n;
+    bool use_sendfile = false;
+
+    *out_method = "copy_file_range";
+    while (size > 0)
+    {
+        if (use_sendfile)
+            n = sendfile(dst_fd, src_fd, 0, (size_t)size);
+        else
+            n = copy_file_range(src_fd, 0, dst_fd, 0, (size_t)size, 0);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (!use_sendfile && (errno == EXDEV || errno == EINVAL ||
+                    errno == ENOSYS || errno == EOPNOTSUPP))
+            {
+                use_sendfile = true;
+                *out_method = "sendfile";
+                continue;
+            }
+            return errno;
+        }
+        if (n == 0)
+            return EIO;
+        size -= n;
+    }
+    return 0;
+}
+
+/* Never replaces a file of the same name, osu! may not have imported it
+   yet. */
+static inline int rename_noreplace(char const* const src,
+    char const* const dst)
+{
+    if (renameat2(AT_FDCWD, src, AT_FDCWD, dst, RENAME_NOREPLACE) == 0)
+        return 0;
+    if (errno != EINVAL && errno != ENOSYS)
+        return errno;
+
+    /* Where the filesystem does not support the flag, link() does not
+       replace either. */
+    if (link(src, dst) == -1)
+        return errno;
+    unlink(src);
+    return 0;
+}
+
+/* Renames src to name in dir, or to "<stem> (<n>).<ext>" if that is taken,
+   and puts the path it got into dst. */
+static inline int rename_unique(char const* const src, char const* const dir,
+    char const* const name, char* const dst, size_t const dst_size)
+{
+    int const stem = (int)strlen(name) - 4;
+    unsigned int n;
+    int error = EEXIST;
+
+    for (n = 0; error == EEXIST && n <= MAX_NAME_SUFFIX; ++n)
+    {
+        if (n == 0)
+            snprintf(dst, dst_size, "%s/%s", dir, name);
+        else
+            snprintf(dst, dst_size, "%s/%.*s (%u)%s", dir, stem, name, n,
+                &name[stem]);
+        error = rename_noreplace(src, dst);
+    }
+    return error;
+}
+
+/* Copies into a hidden temporary file first, osu! only ever sees complete
+   archives. */
+static inline int copy_archive(char const* const src, char const* const dir,
+    char const* const name, char* const dst, size_t const dst_size,
+    char const** const out_method, long long* const out_bytes)
+{
+    char temp_path[PATH_MAX];
+    int src_fd;
+    int dst_fd;
+    struct stat st;
+    int error;
+    int len;
+
+    len = snprintf(temp_path, sizeof(temp_path), "%s/.%s.%ld", dir, name,
+        (long)getpid());
+    if (len < 0 || (size_t)len >= sizeof(temp_path))
+        return ENAMETOOLONG;
+
+    src_fd = open(src, O_RDONLY | O_CLOEXEC);
+    if (src_fd == -1)
+        return errno;
+    error = fstat(src_fd, &st) == -1 ? errno :
+        !S_ISREG(st.st_mode) ? EINVAL : 0;
+    if (error != 0)
+    {
+        close(src_fd);
+        return error;
+    }
+
+    dst_fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (dst_fd == -1)
+    {
+        error = errno;
+        close(src_fd);
+        return error;
+    }
+
+    *out_method = "clone";
+    error = ioctl(dst_fd, FICLONE, src_fd) == 0 ? 0 :
+        copy_data(src_fd, dst_fd, st.st_size, out_method);
+    *out_bytes = (long long)st.st_size;
+
+    close(src_fd);
+    if (close(dst_fd) == -1 && error == 0)
+        error = errno;
+    if (error == 0)
+        error = rename_unique(temp_path, dir, name, dst, dst_size);
+    if (error != 0)
+        unlink(temp_path);
+    return error;
+}
+
+/* Returns the path osu! should get for arg, arg itself if it is not an
+   archive or could not be placed, or null if the arena is full. */
+static inline char* place_archive(import_mode const mode,
+    char const* const osu_dir, char* const arg)
+{
+    char const* const subdir = archive_subdir(arg);
+    char const* const slash = strrchr(arg, '/');
+    char const* const name = slash ? slash + 1 : arg;
+    char const* method = "rename";
+    long long bytes = 0;
+    unsigned long long start;
+    size_t dir_size;
+    size_t dst_size;
+    char* dir;
+    char* dst;
+    int error;
+    int unlink_error = 0;
+
+    if (!subdir)
+        return arg;
+
+    dir_size = strlen(osu_dir) + 1 + strlen(subdir) + 1;
+    dst_size = dir_size + strlen(name) + NAME_SUFFIX_SIZE;
+    if (!(dir = (char*)arena_alloc(&run_arena, dir_size, 1)) ||
+        !(dst = (char*)arena_alloc(&run_arena, dst_size, 1)))
+        return 0;
+    snprintf(dir, dir_size, "%s/%s", osu_dir, subdir);
+    /* osu! creates both on its first start, but nothing depends on it. */
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+        return arg;
+
+    start = trace_begin();
+    error = mode != IMPORT_MOVE ? EXDEV :
+        rename_unique(arg, dir, name, dst, dst_size);
+    if (error == EXDEV)
+    {
+        error = copy_archive(arg, dir, name, dst, dst_size, &method, &bytes);
+        /* Across filesystems a move is a copy, then the download goes.  If
+           it cannot go, osu! still gets the copy. */
+        if (error == 0 && mode == IMPORT_MOVE && unlink(arg) == -1)
+            unlink_error = errno;
+    }
+    trace_end(start, "import_archive",
+        "\"method\":\"%s\",\"bytes\":%lld,\"error\":%d,"
+        "\"unlink_error\":%d", method, bytes, error, unlink_error);
+    return error == 0 ? dst : arg;
+}
+
+int import_archives(import_mode const mode, char* const envp[],
+    char const* const osu_exe, char* argv[], char*** const out_argv)
+{
+    char* osu_dir;
+    size_t argc;
+    size_t i;
+    char** result;
+    int error;
+
+    if ((error = find_osu_dir(envp, osu_exe, &osu_dir)) != 0)
+        return error;
+
+    for (argc = 0; argv[argc]; ++argc);
+    if (!(result = arena_new(&run_arena, char*, argc + 1)))
+        return ENOMEM;
+    result[0] = argv[0];
+    for (i = 1; i < argc; ++i)
+        if (!(result[i] = place_archive(mode, osu_dir, argv[i])))
+            return ENOMEM;
+    result[argc] = 0;
+
+    *out_argv = result;
+    return 0;
+}
@@ -0,0 +1,52 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#pragma once
+#ifndef __IMPORT_H__
+#define __IMPORT_H__
+
+/* OSU_HANDLER_IMPORT places .osz and .osk arguments in the Songs and Skins
+   directories of the instance before the handoff, so that osu! reads them
+   from its own folder instead of through the original path. */
+typedef enum import_mode {
+    IMPORT_NONE, /* hand the original paths to osu! */
+    IMPORT_COPY, /* reflink, or copy inside the kernel */
+    IMPORT_MOVE /* rename, or copy and unlink across filesystems */
+} import_mode;
+
+/* Maps "copy" and "move" to a mode, anything else to IMPORT_NONE. */
+import_mode parse_import_mode(char const* name);
+
+/* Reads the path of osu!.exe, which wine puts first in the command line of
+   the process whose /proc directory is dirfd, into the run arena. */
+int read_osu_exe(int dirfd, char** out_exe);
+
+/* Places every archive argument next to osu_exe, a Windows path inside the
+   prefix envp belongs to or a Unix path.  OSU_HANDLER_OSU_DIR overrides the
+   folder.  Archives that cannot be placed keep their original path.  On
+   success *out_argv is a new vector in the run arena. */
+int import_archives(import_mode mode, char* const envp[],
+    char const* osu_exe, char* argv[], char*** out_argv);
+
+#endif
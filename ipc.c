@@ -0,0 +1,315 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _GNU_SOURCE /* SOCK_CLOEXEC */
+
+#include "ipc.h"
+#include "runtime_dir.h" /* runtime_path */
+
+#include <errno.h> /* EADDRINUSE, EINTR, EMSGSIZE, ENAMETOOLONG, ENOENT, ENOMEM,
+                      EPROTO, EWOULDBLOCK, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_CREAT, O_RDWR, open */
+#include <limits.h> /* PATH_MAX */
+#include <stdio.h> /* snprintf */
+#include <stdint.h> /* int32_t, uint32_t */
+#include <stdlib.h> /* free, malloc */
+#include <string.h> /* memchr, memcpy, strlen */
+#include <sys/file.h> /* LOCK_EX, LOCK_NB, flock */
+#include <sys/socket.h> /* AF_UNIX, MSG_NOSIGNAL, SOCK_CLOEXEC, SOCK_STREAM,
+                           SOL_SOCKET, SO_RCVTIMEO, SO_SNDTIMEO, bind,
+                           connect, listen, send, setsockopt, socket */
+#include <sys/stat.h> /* stat, struct stat */
+#include <sys/time.h> /* struct timeval */
+#include <sys/types.h> /* ssize_t, suseconds_t, time_t */
+#include <sys/un.h> /* struct sockaddr_un */
+#include <unistd.h> /* close, read, unlink */
+
+#define IPC_MAX_REQUEST_SIZE (1024 * 1024)
+
+static int ipc_address(char const* const name, struct sockaddr_un* const addr)
+{
+    char path[PATH_MAX];
+    int error;
+    size_t length;
+
+    if ((error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+
+    length = strlen(path);
+    if (length >= sizeof(addr->sun_path))
+        return ENAMETOOLONG;
+
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, length + 1);
+    return 0;
+}
+
+int ipc_connect(char const* const name, int* const out_fd)
+{
+    struct sockaddr_un addr;
+    int error;
+    int fd;
+
+    if ((error = ipc_address(name, &addr)) != 0)
+        return error;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return errno;
+
+    if (connect(fd, (struct sockaddr const*)&addr, sizeof(addr)) == -1)
+    {
+        error = errno;
+        close(fd);
+        return error;
+    }
+
+    *out_fd = fd;
+    return 0;
+}
+
+static int lock_name(char const* const path, int* const out_fd)
+{
+    char lock_path[PATH_MAX];
+    int const n = snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    int fd;
+
+    if (n < 0 || (size_t)n >= sizeof(lock_path))
+        return ENAMETOOLONG;
+
+    fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return errno;
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+    {
+        int const error = errno;
+        close(fd);
+        return error == EWOULDBLOCK ? EADDRINUSE : error;
+    }
+
+    *out_fd = fd;
+    return 0;
+}
+
+int ipc_listen(char const* const name, ipc_listener* const out_listener)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int error;
+    int lock_fd;
+    int fd;
+
+    if ((error = ipc_address(name, &addr)) != 0 ||
+        (error = lock_name(addr.sun_path, &lock_fd)) != 0)
+        return error;
+
+    /* Whoever bound this file before has given up the lock, so nobody is
+       serving it anymore. */
+    if (unlink(addr.sun_path) == -1 && errno != ENOENT)
+    {
+        error = errno;
+        close(lock_fd);
+        return error;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        error = errno;
+        close(lock_fd);
+        return error;
+    }
+
+    if (bind(fd, (struct sockaddr const*)&addr, sizeof(addr)) == -1 ||
+        stat(addr.sun_path, &st) == -1 || listen(fd, SOMAXCONN) == -1)
+    {
+        error = errno;
+        close(fd);
+        close(lock_fd);
+        return error;
+    }
+
+    out_listener->fd = fd;
+    out_listener->lock_fd = lock_fd;
+    out_listener->dev = st.st_dev;
+    out_listener->ino = st.st_ino;
+    return 0;
+}
+
+/* The lock is given up last, so the next server can only bind after our
+   socket file is gone. */
+void ipc_unlisten(char const* const name, ipc_listener* const listener)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (ipc_address(name, &addr) == 0 && stat(addr.sun_path, &st) == 0 &&
+        st.st_dev == listener->dev && st.st_ino == listener->ino)
+        unlink(addr.sun_path);
+    close(listener->fd);
+    close(listener->lock_fd);
+    listener->fd = -1;
+    listener->lock_fd = -1;
+}
+
+int ipc_set_timeout(int const fd, unsigned long const timeout_ms)
+{
+    struct timeval tv;
+
+    tv.tv_sec = (time_t)(timeout_ms / 1000);
+    tv.tv_usec = (suseconds_t)(timeout_ms % 1000 * 1000);
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1)
+        return errno;
+    return 0;
+}
+
+static int write_all(int const fd, void const* const data, size_t size)
+{
+    char const* ptr = (char const*)data;
+    ssize_t n;
+
+    while (size)
+    {
+        /* A peer that has gone away must not kill us with SIGPIPE. */
+        n = send(fd, ptr, size, MSG_NOSIGNAL);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        ptr += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int const fd, void* const data, size_t size)
+{
+    char* ptr = (char*)data;
+    ssize_t n;
+
+    while (size)
+    {
+        n = read(fd, ptr, size);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (n == 0)
+            return EPROTO;
+        ptr += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+int ipc_send_strings(int const fd, size_t const count,
+    char const* const strings[])
+{
+    uint32_t size;
+    size_t i;
+    int error;
+
+    size = 0;
+    for (i = 0; i < count; ++i)
+    {
+        size_t const length = strlen(strings[i]) + 1;
+        if (length > IPC_MAX_REQUEST_SIZE - size)
+            return EMSGSIZE;
+        size += (uint32_t)length;
+    }
+
+    if ((error = write_all(fd, &size, sizeof(size))) != 0)
+        return error;
+    for (i = 0; i < count; ++i)
+        if ((error = write_all(fd, strings[i], strlen(strings[i]) + 1)) != 0)
+            return error;
+    return 0;
+}
+
+int ipc_recv_strings(int const fd, size_t const reserve_front,
+    char*** const out_vector, size_t* const out_count)
+{
+    uint32_t size;
+    int error;
+    size_t count;
+    char* data;
+    char* ptr;
+    char* end;
+    char** vector;
+    size_t i;
+
+    if ((error = read_all(fd, &size, sizeof(size))) != 0)
+        return error;
+    if (size > IPC_MAX_REQUEST_SIZE)
+        return EMSGSIZE;
+
+    /* At most one string per byte, plus the reserved slots and the
+       terminator.  Received strings go after the vector. */
+    vector = (char**)malloc(sizeof(char*) * (reserve_front + size + 1) + size);
+    if (!vector)
+        return ENOMEM;
+    data = (char*)&vector[reserve_front + size + 1];
+
+    if ((error = read_all(fd, data, size)) != 0 ||
+        (size && data[size - 1] != '\0'))
+    {
+        free(vector);
+        return error ? error : EPROTO;
+    }
+
+    for (i = 0; i < reserve_front; ++i)
+        vector[i] = 0;
+
+    count = 0;
+    end = &data[size];
+    for (ptr = data; ptr < end; ptr = (char*)memchr(ptr, '\0', end - ptr) + 1)
+        vector[reserve_front + count++] = ptr;
+    vector[reserve_front + count] = 0;
+
+    *out_vector = vector;
+    *out_count = count;
+    return 0;
+}
+
+int ipc_send_status(int const fd, int const status)
+{
+    int32_t const value = status;
+    return write_all(fd, &value, sizeof(value));
+}
+
+int ipc_recv_status(int const fd, int* const out_status)
+{
+    int32_t value;
+    int error;
+
+    if ((error = read_all(fd, &value, sizeof(value))) != 0)
+        return error;
+    *out_status = value;
+    return 0;
+}
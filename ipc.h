@@ -0,0 +1,65 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __IPC_H__
+#define __IPC_H__
+
+#include <stddef.h> /* size_t */
+#include <sys/types.h> /* dev_t, ino_t */
+
+/* A request is a list of NUL-terminated strings preceded by its total size,
+   the reply is a single errno value (0 on success).  Sockets live in the
+   runtime directory, see runtime_path(). */
+
+typedef struct ipc_listener {
+    int fd;
+    int lock_fd; /* flock()ed while we serve the socket */
+    dev_t dev; /* the socket file we bound */
+    ino_t ino;
+} ipc_listener;
+
+/* Only one process serves a name at a time, the others get EADDRINUSE.
+   The server is elected by a lock on "<name>.lock", so a socket file left
+   behind by a dead server is replaced instead of blocking the name. */
+int ipc_listen(char const* name, ipc_listener* out_listener);
+/* Removes the socket so new clients cannot connect, unless it has already
+   been replaced by someone else, then closes it. */
+void ipc_unlisten(char const* name, ipc_listener* listener);
+int ipc_connect(char const* name, int* out_fd);
+/* Makes reads and writes on a connection fail with EAGAIN once they block
+   for longer than timeout_ms, so a stalled peer cannot hold up a server. */
+int ipc_set_timeout(int fd, unsigned long timeout_ms);
+
+int ipc_send_strings(int fd, size_t count, char const* const strings[]);
+/* Receives a request into a single allocation.  The returned vector has
+   reserve_front unused slots before the received strings and is terminated
+   by a null pointer, so it can be passed to execve() directly.  Free it with
+   free(*out_vector). */
+int ipc_recv_strings(int fd, size_t reserve_front, char*** out_vector,
+    size_t* out_count);
+
+int ipc_send_status(int fd, int status);
+int ipc_recv_status(int fd, int* out_status);
+
+#endif
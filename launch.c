@@ -0,0 +1,443 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _GNU_SOURCE /* pipe2 */
+
+#include "launch.h"
+#include "arena.h" /* arena_mark, arena_release, run_arena */
+#include "bool.h" /* bool */
+#include "discovery.h" /* open_process_dir, test_process */
+#include "inline.h" /* inline */
+#include "matcher.h" /* match_comm */
+#include "procdir.h" /* PROCDIR_BUFFER_SIZE, PROCDIR_DESCENDANTS,
+                        close_procdir, open_procdir, procdir_dirfd,
+                        procdir_handle, procdir_next_processes */
+
+#include <errno.h> /* EAGAIN, EINTR, ENOTSUP, errno */
+#include <fcntl.h> /* O_CLOEXEC */
+#include <linux/cn_proc.h> /* PROC_CN_MCAST_LISTEN, PROC_EVENT_COMM,
+                              PROC_EVENT_EXEC, PROC_EVENT_NONE,
+                              struct proc_event */
+#include <linux/connector.h> /* CN_IDX_PROC, CN_VAL_PROC, struct cn_msg */
+#include <linux/netlink.h> /* NETLINK_CONNECTOR, NLMSG_ALIGNTO, NLMSG_DATA,
+                              NLMSG_DONE, NLMSG_LENGTH, NLMSG_NEXT, NLMSG_OK,
+                              struct nlmsghdr, struct sockaddr_nl */
+#include <poll.h> /* POLLIN, nfds_t, poll, struct pollfd */
+#include <string.h> /* memset, strnlen */
+#include <sys/prctl.h> /* PR_SET_CHILD_SUBREAPER, prctl */
+#include <sys/socket.h> /* AF_NETLINK, MSG_DONTWAIT, MSG_PEEK, SOCK_CLOEXEC,
+                           SOCK_DGRAM, bind, recv, send, socket */
+#include <sys/syscall.h> /* SYS_pidfd_open */
+#include <sys/wait.h> /* WNOHANG, waitpid */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+#include <unistd.h> /* _exit, close, execvp, fork, getpid, pipe2, read,
+                       syscall, write */
+
+/* Without the proc connector an exec raises no event, the descendants are
+   walked again at least this often. */
+#define WALK_INTERVAL_MS 250
+
+/* How many descendants are watched for their exit at most. */
+#define WATCH_MAX 32
+
+/* Pidfds of the descendants the walk has seen.  Every exit in the tree, of
+   the launcher or of a wine client that started the game, wakes the wait
+   for another walk. */
+typedef struct descendant_watch {
+    pid_t pids[WATCH_MAX];
+    struct pollfd fds[WATCH_MAX];
+    nfds_t count;
+} descendant_watch;
+
+static inline int pidfd_open(pid_t const pid)
+{
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+static inline unsigned long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 +
+        (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+/* Without CAP_NET_ADMIN the subscription still "succeeds", the refusal only
+   comes back as an error in the acknowledgement, which the kernel queues
+   while handling the request. */
+static inline bool proc_connector_acked(int const fd)
+{
+    char buf[256] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr const* const header = (struct nlmsghdr const*)buf;
+    struct cn_msg const* message;
+    struct proc_event const* event;
+    ssize_t const n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT | MSG_PEEK);
+
+    if (n == -1)
+        return errno == EAGAIN;
+    if (!NLMSG_OK(header, (size_t)n) ||
+        header->nlmsg_len < NLMSG_LENGTH(sizeof(*message) + sizeof(*event)))
+        return true;
+
+    message = (struct cn_msg const*)NLMSG_DATA(header);
+    event = (struct proc_event const*)message->data;
+    return event->what != PROC_EVENT_NONE || event->event_data.ack.err == 0;
+}
+
+/* Subscribes to the kernel's process events.  Needs CAP_NET_ADMIN on most
+   kernels, -1 means the caller has to fall back to walking the tree. */
+static inline int open_proc_connector(void)
+{
+    int fd;
+    struct sockaddr_nl addr;
+    struct {
+        struct nlmsghdr header;
+        struct cn_msg message;
+        enum proc_cn_mcast_op op;
+    } __attribute__((packed)) request;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (fd == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = sizeof(request);
+    request.header.nlmsg_type = NLMSG_DONE;
+    request.message.id.idx = CN_IDX_PROC;
+    request.message.id.val = CN_VAL_PROC;
+    request.message.len = sizeof(request.op);
+    request.op = PROC_CN_MCAST_LISTEN;
+    if (send(fd, &request, sizeof(request), 0) != (ssize_t)sizeof(request) ||
+        !proc_connector_acked(fd))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Reads the pending connector messages and tests every process that exec'd
+   or changed its name.  Comm changes already carry the new name, so only
+   those to osu!.exe are looked at. */
+static inline int handle_proc_events(int const nl_fd, int const proc_dirfd,
+    int* const out_dirfd, char** const out_exe_path, pid_t* const out_pid)
+{
+    char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+    ssize_t n;
+
+    while ((n = recv(nl_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    {
+        struct nlmsghdr const* header = (struct nlmsghdr const*)buf;
+        size_t length = (size_t)n;
+
+        for (; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length))
+        {
+            struct cn_msg const* const message =
+                (struct cn_msg const*)NLMSG_DATA(header);
+            struct proc_event const* const event =
+                (struct proc_event const*)message->data;
+            pid_t pid;
+            size_t mark;
+
+            if (event->what == PROC_EVENT_EXEC)
+                pid = event->event_data.exec.process_tgid;
+            else if (event->what == PROC_EVENT_COMM &&
+                event->event_data.comm.process_pid ==
+                    event->event_data.comm.process_tgid &&
+                match_comm(event->event_data.comm.comm,
+                    strnlen(event->event_data.comm.comm,
+                        sizeof(event->event_data.comm.comm))))
+                pid = event->event_data.comm.process_tgid;
+            else
+                continue;
+
+            mark = arena_mark(&run_arena);
+            if (!test_process(proc_dirfd, pid, out_exe_path))
+                continue;
+            if (open_process_dir(proc_dirfd, pid, out_dirfd) == 0)
+            {
+                *out_pid = pid;
+                return 0;
+            }
+            arena_release(&run_arena, mark);
+        }
+    }
+    return n == -1 && errno != EAGAIN && errno != EINTR ? errno : 0;
+}
+
+static inline void watch_descendant(descendant_watch* const watch,
+    pid_t const pid)
+{
+    nfds_t i;
+    int fd;
+
+    for (i = 0; i < watch->count; ++i)
+        if (watch->pids[i] == pid)
+            return;
+    if (watch->count == WATCH_MAX || (fd = pidfd_open(pid)) == -1)
+        return;
+
+    watch->pids[watch->count] = pid;
+    watch->fds[watch->count].fd = fd;
+    watch->fds[watch->count].events = POLLIN;
+    watch->fds[watch->count].revents = 0;
+    ++watch->count;
+}
+
+/* Drops the descendants whose pidfd poll reported as exited. */
+static inline void unwatch_exited(descendant_watch* const watch)
+{
+    nfds_t i;
+    nfds_t kept = 0;
+
+    for (i = 0; i < watch->count; ++i)
+    {
+        if (watch->fds[i].revents)
+        {
+            close(watch->fds[i].fd);
+            continue;
+        }
+        watch->pids[kept] = watch->pids[i];
+        watch->fds[kept++] = watch->fds[i];
+    }
+    watch->count = kept;
+}
+
+/* Tests every descendant and watches those that are not osu!. */
+static inline int walk_descendants(descendant_watch* const watch,
+    int* const out_dirfd, char** const out_exe_path, pid_t* const out_pid)
+{
+    char procdir_buffer[PROCDIR_BUFFER_SIZE];
+    procdir_handle pdhandle;
+    int proc_dirfd;
+    pid_t pids[64];
+    pid_t const self = getpid();
+    size_t count;
+    size_t i;
+    int error;
+
+    if ((error = open_procdir(&pdhandle, PROCDIR_DESCENDANTS, procdir_buffer,
+            sizeof(procdir_buffer))) != 0)
+        return error;
+    if ((proc_dirfd = procdir_dirfd(pdhandle)) == -1)
+    {
+        close_procdir(pdhandle);
+        return ENOTSUP;
+    }
+
+    while ((error = procdir_next_processes(pdhandle, pids,
+            sizeof(pids) / sizeof(*pids), &count)) == 0 && count)
+        for (i = 0; i < count; ++i)
+        {
+            size_t const mark = arena_mark(&run_arena);
+
+            if (pids[i] == self)
+                continue;
+            if (test_process(proc_dirfd, pids[i], out_exe_path) &&
+                open_process_dir(proc_dirfd, pids[i], out_dirfd) == 0)
+            {
+                *out_pid = pids[i];
+                close_procdir(pdhandle);
+                return 0;
+            }
+            arena_release(&run_arena, mark);
+            watch_descendant(watch, pids[i]);
+        }
+    close_procdir(pdhandle);
+    return error;
+}
+
+/* Forks and execs "osu" without the handler's arguments, those are
+   delivered once the game is up.  An exec failure is reported back through
+   a close-on-exec pipe. */
+static inline int spawn_launcher(pid_t* const out_pid)
+{
+    char* argv[] = { (char*)"osu", 0 };
+    int fds[2];
+    pid_t pid;
+    int error;
+    ssize_t n;
+
+    if (pipe2(fds, O_CLOEXEC) == -1)
+        return errno;
+
+    pid = fork();
+    if (pid == -1)
+    {
+        error = errno;
+        close(fds[0]);
+        close(fds[1]);
+        return error;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        execvp("osu", argv);
+        error = errno;
+        while (write(fds[1], &error, sizeof(error)) == -1 && errno == EINTR);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    while ((n = read(fds[0], &error, sizeof(error))) == -1 && errno == EINTR);
+    close(fds[0]);
+    if (n == (ssize_t)sizeof(error))
+    {
+        waitpid(pid, 0, 0);
+        return error;
+    }
+
+    *out_pid = pid;
+    return 0;
+}
+
+/* Polls for proc connector events if nl_fd is set, otherwise for the exit
+   of a descendant, walking them again on every wakeup.  The launcher's
+   pidfd only serves to wake up and reap it early. */
+static inline int wait_for_instance(unsigned long long const deadline,
+    int const nl_fd, int const proc_dirfd, int pidfd, int* const out_dirfd,
+    char** const out_exe_path, pid_t* const out_pid)
+{
+    descendant_watch watch;
+    int error = 0;
+    nfds_t i;
+
+    watch.count = 0;
+    for (;;)
+    {
+        struct pollfd fds[2 + WATCH_MAX];
+        unsigned long long const now = now_ms();
+        unsigned long wait;
+        nfds_t nfds = 0;
+        nfds_t watched;
+
+        if (now >= deadline)
+            break;
+        wait = (unsigned long)(deadline - now);
+        if (nl_fd == -1 && wait > WALK_INTERVAL_MS)
+            wait = WALK_INTERVAL_MS;
+
+        if (nl_fd != -1)
+        {
+            fds[nfds].fd = nl_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        if (pidfd != -1)
+        {
+            fds[nfds].fd = pidfd;
+            fds[nfds++].events = POLLIN;
+        }
+        watched = nfds;
+        for (i = 0; i < watch.count; ++i)
+            fds[nfds++] = watch.fds[i];
+        if (poll(fds, nfds, (int)wait) == -1)
+        {
+            /* revents is only filled in when poll returns. */
+            if (errno == EINTR)
+                continue;
+            error = errno;
+            break;
+        }
+
+        /* The launcher exiting is no reason to stop, the game usually
+           outlives it.  Reap it and anything reparented to us. */
+        while (waitpid(-1, 0, WNOHANG) > 0);
+        if (pidfd != -1 && fds[watched - 1].revents)
+        {
+            close(pidfd);
+            pidfd = -1;
+        }
+        for (i = 0; i < watch.count; ++i)
+            watch.fds[i].revents = fds[watched + i].revents;
+        unwatch_exited(&watch);
+
+        if (nl_fd != -1)
+            error = handle_proc_events(nl_fd, proc_dirfd, out_dirfd,
+                out_exe_path, out_pid);
+        else
+            error = walk_descendants(&watch, out_dirfd, out_exe_path,
+                out_pid);
+        if (error != 0 || *out_dirfd != -1)
+            break;
+    }
+
+    if (pidfd != -1)
+        close(pidfd);
+    for (i = 0; i < watch.count; ++i)
+        close(watch.fds[i].fd);
+    return error;
+}
+
+int launch_and_wait(unsigned long const timeout_ms, int* const out_dirfd,
+    char** const out_exe_path, pid_t* const out_pid)
+{
+    unsigned long long const deadline = now_ms() + timeout_ms;
+    char procdir_buffer[PROCDIR_BUFFER_SIZE];
+    procdir_handle pdhandle = 0;
+    int proc_dirfd = -1;
+    int nl_fd;
+    pid_t launcher = -1;
+    int error;
+
+    *out_dirfd = -1;
+
+    /* Orphaned descendants, like a game started by a launcher script that
+       exits, are reparented to us and stay visible in the walk. */
+    prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0);
+
+    /* Subscribed before the launcher exists, so no event can be missed.
+       The procdir handle only provides the procfs directory. */
+    nl_fd = open_proc_connector();
+    if (nl_fd != -1 && open_procdir(&pdhandle, PROCDIR_DESCENDANTS,
+            procdir_buffer, sizeof(procdir_buffer)) == 0)
+        proc_dirfd = procdir_dirfd(pdhandle);
+    if (nl_fd != -1 && proc_dirfd == -1)
+    {
+        close(nl_fd);
+        nl_fd = -1;
+    }
+
+    error = spawn_launcher(&launcher);
+    if (error == 0)
+        error = wait_for_instance(deadline, nl_fd, proc_dirfd,
+            pidfd_open(launcher), out_dirfd, out_exe_path, out_pid);
+
+    if (pdhandle)
+        close_procdir(pdhandle);
+    if (nl_fd != -1)
+        close(nl_fd);
+    /* The flag survives the exec of the wine client, which must not collect
+       the orphans of the game. */
+    prctl(PR_SET_CHILD_SUBREAPER, 0, 0, 0, 0);
+    return error;
+}
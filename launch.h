@@ -0,0 +1,40 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __LAUNCH_H__
+#define __LAUNCH_H__
+
+#include <sys/types.h> /* pid_t */
+
+/* Starts the osu launcher without arguments and waits up to timeout_ms for
+   an osu! instance to appear.  Processes are picked up through proc
+   connector events where those are permitted, otherwise by walking the
+   descendants of the handler whenever one of them exits.  The handler is a
+   child subreaper meanwhile, so that the game stays in that tree.  On
+   success *out_dirfd is the opened /proc directory of the process, or -1
+   if none appeared in time. */
+int launch_and_wait(unsigned long timeout_ms, int* out_dirfd,
+    char** out_exe_path, pid_t* out_pid);
+
+#endif
@@ -21,324 +21,269 @@
  *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
  */
 
-#define _POSIX_C_SOURCE 200809L /* openat, readlinkat */
-#define _DEFAULT_SOURCE /* openat, readlinkat */
-
-#include "attrs.h" /* attr_const */
+#include "arena.h" /* ARENA_RESERVE, arena_init, run_arena */
 #include "bool.h" /* bool */
+#include "coalesce.h" /* coalesce_arguments, reply_to_senders */
+#include "config.h" /* config_bool, config_ulong */
+#include "daemon.h" /* run_daemon, send_to_daemon */
+#include "dedup.h" /* is_duplicate_request */
+#include "discovery.h" /* find_osu_process, open_process_dir, our_uid,
+                          preloader_to_loader, target_prefix, test_uid */
+#include "discovery_cache.h" /* count_discovery_hit, discovery_cache,
+                                load_discovery_cache, read_process_starttime,
+                                store_discovery_scan */
+#include "env_snapshot.h" /* load_env_snapshot, store_env_snapshot */
+#include "environ.h" /* construct_envp_from_environ, load_env_rules,
+                       read_environ */
+#include "fanout.h" /* fan_out */
+#include "import.h" /* IMPORT_NONE, import_archives, import_mode,
+                       parse_import_mode, read_osu_exe */
 #include "inline.h" /* inline */
-#include "procdir.h" /* close_procdir, open_procdir, procdir_dirfd,
-                        procdir_handle, procdir_next_process */
+#include "launch.h" /* launch_and_wait */
+#include "matcher.h" /* load_process_rules */
+#include "procdir.h" /* PROCDIR_BUFFER_SIZE, close_procdir, open_procdir,
+                        parse_procdir_strategy, procdir_dirfd,
+                        procdir_handle */
 #include "notifications.h" /* show_notification */
-#include "static_string.h" /* static_strlen, static_endswith, static_startswith */
+#include "pathmap.h" /* translate_paths */
+#include "pid_path.h" /* pid_path, pid_path_init */
+#include "relay.h" /* lock_relay_start, relay_enabled, send_to_relay,
+                      send_to_starting_relay, start_relay */
+#include "single_flight.h" /* discovery_lease, end_discovery,
+                               join_discovery */
+#include "trace.h" /* trace_begin, trace_end, trace_init, trace_point */
+#include "validate.h" /* validate_archives */
+#include "wineprefix.h" /* find_prefix_wineserver, get_prefix_id,
+                           process_in_prefix, start_at_prefix_wineserver,
+                           wine_prefix_id */
 
-#include <assert.h> /* assert */
 #include <ctype.h> /* toupper */
-#include <dirent.h> /* struct dent */
-#include <errno.h> /* ENOTSUP, errno */
-#include <fcntl.h> /* O_DIRECTORY, O_SEARCH, O_RDONLY, openat */
-#include <stddef.h> /* size_t, ssize_t */
-#include <stdlib.h> /* free, malloc, realloc */
-#include <string.h> /* memcmp, memchr, strerror, strdup */
-#include <sys/stat.h> /* fstat, struct stat */
-#include <sys/types.h> /* uid_t */
-#include <unistd.h> /* close, execve, execvp, getuid, read, readlinkat */
-
-uid_t our_uid;
-
-static inline bool test_uid(int const dirfd)
-{
-    struct stat buf;
-
-    return fstat(dirfd, &buf) != -1 && buf.st_uid == our_uid;
-}
-
-static inline bool test_comm(int const dirfd)
+#include <errno.h> /* ENOENT, ENOTSUP, EWOULDBLOCK, errno */
+#include <limits.h> /* PATH_MAX */
+#include <stdio.h> /* snprintf */
+#include <stddef.h> /* size_t */
+#include <stdlib.h> /* free, getenv */
+#include <string.h> /* memcpy, strcmp, strerror, strdup, strlen, strrchr */
+#include <sys/types.h> /* pid_t */
+#include <unistd.h> /* close, execve, execvp, getuid */
+
+/* Hands argv off to the relay of the instance.  If there is none, one
+   handoff gets *out_lock to start it and the others wait for it.  Returns 0
+   if the relay took argv. */
+static inline int hand_off_to_relay(discovery_cache const* const identity,
+    char* argv[], int* const out_lock)
 {
-    static char wanted_comm[] = "osu!.exe\n";
-    int fd;
-    char buf[static_strlen(wanted_comm)];
-    bool b;
-
-    fd = openat(dirfd, "comm", O_RDONLY);
-    if (fd == -1)
-        return false;
-
-    b = read(fd, buf, sizeof(buf)) == sizeof(buf);
-
-    close(fd);
-
-    return b && memcmp(buf, wanted_comm, static_strlen(wanted_comm)) == 0;
-}
-
-static inline char* get_exe_path(int const dirfd, size_t* const path_len)
-{
-    size_t bufsize;
-    char* buffer;
+    int error;
+    unsigned long long start;
 
-    for (bufsize = 128;;bufsize *= 2)
+    start = trace_begin();
+    error = send_to_relay(identity->pid, identity->starttime, argv);
+    trace_end(start, "relay_send", "\"error\":%d", error);
+    if (error != 0 && lock_relay_start(identity->pid, identity->starttime,
+            out_lock) == EWOULDBLOCK)
     {
-        ssize_t link_len;
-
-        buffer = (char*)malloc(sizeof(char) * bufsize);
-        if (!buffer)
-            break;
-
-        link_len = readlinkat(dirfd, "exe", buffer, bufsize);
-        if (link_len == -1)
-        {
-            free(buffer);
-            buffer = 0;
-            break;
-        }
-
-        if ((size_t)link_len < bufsize)
-        {
-            buffer[(size_t)link_len] = '\0';
-            *path_len = (size_t)link_len;
-            break;
-        }
-
-        free(buffer);
+        start = trace_begin();
+        error = send_to_starting_relay(identity->pid, identity->starttime,
+            argv);
+        trace_end(start, "relay_wait", "\"error\":%d", error);
     }
-
-    return buffer;
-}
-
-static inline bool test_exe(int const dirfd, char** const out_exe_path)
-{
-    char* exe_path;
-    size_t path_len;
-    char* exe_path2;
-
-    exe_path = get_exe_path(dirfd, &path_len);
-    if (!exe_path)
-        return false;
-
-    if (!static_endswith((size_t)path_len, exe_path, "/wine-preloader") &&
-        !static_endswith((size_t)path_len, exe_path, "/wine64-preloader"))
+    /* The relay may have come up since the first try. */
+    else if (error != 0 && *out_lock != -1)
+        error = send_to_relay(identity->pid, identity->starttime, argv);
+    if (error == 0 && *out_lock != -1)
     {
-        free(exe_path);
-        return false;
+        close(*out_lock);
+        *out_lock = -1;
     }
-
-    exe_path2 = (char*)realloc(exe_path, sizeof(char) * (path_len + 1));
-    *out_exe_path = exe_path2 ? exe_path2 : exe_path;
-    return true;
-}
-
-static inline bool test_dir(int const dirfd, char** const out_exe_path)
-{
-    if (!test_uid(dirfd))
-        return false;
-
-    if (!test_comm(dirfd))
-        return false;
-
-    if (!test_exe(dirfd, out_exe_path))
-        return false;
-
-    return true;
+    return error;
 }
 
-static inline bool try_realloc(void** const ptr, size_t const new_size)
+/* identity is the cache entry describing the process, its pid is 0 if the
+   start time could not be read.  A discovery lease held by this invocation
+   is ended as soon as the environment is published, or earlier. */
+static inline int handle_process(int const dirfd, char* const exe_path,
+    discovery_cache const* const identity, discovery_lease* const lease,
+    char* argv[], bool* const out_error)
 {
-    void* const new_ptr = realloc(*ptr, new_size);
-    if (new_ptr) *ptr = new_ptr;
-    return !!new_ptr;
-}
-
-#define malloc_overhead 32
-
-static inline bool read_environ_content(int const fd, char** const out_environ,
-    size_t* const out_environ_size)
-{
-    size_t bufsize;
-    char* buffer;
-    size_t pos;
-    ssize_t n;
-
-    bufsize = 8192 - malloc_overhead;
-    buffer = (char*)malloc(sizeof(char) * bufsize);
-    if (!buffer)
-        return false;
-
-    pos = 0;
-    while ((n = read(fd, &buffer[pos], bufsize - pos)) > 0)
+    char* environ;
+    bool b;
+    size_t environ_size;
+    char** envp;
+    bool relay;
+    bool translate;
+    int relay_lock;
+    import_mode import;
+    char* osu_exe;
+    int error;
+    unsigned long long start;
+
+    /* The command line is only readable while dirfd is open. */
+    import = parse_import_mode(getenv("OSU_HANDLER_IMPORT"));
+    if (import != IMPORT_NONE && read_osu_exe(dirfd, &osu_exe) != 0)
+        import = IMPORT_NONE;
+    translate = config_bool("OSU_HANDLER_TRANSLATE_PATHS", false);
+
+    /* A running relay needs neither the environment nor a wine client,
+       unless the arguments are rewritten first, which takes the environment
+       of the instance.  If the relay does not come up, the handoff falls
+       back to a wine client. */
+    relay = identity->pid && relay_enabled();
+    relay_lock = -1;
+    if (relay && import == IMPORT_NONE && !translate &&
+        hand_off_to_relay(identity, argv, &relay_lock) == 0)
     {
-        pos += (size_t)n;
-        if (pos < bufsize)
-            continue;
+        close(dirfd);
+        end_discovery(lease);
+        return 0;
+    }
 
-        bufsize = (bufsize + malloc_overhead) * 2 - malloc_overhead;
-        if (!try_realloc((void**)&buffer, sizeof(char) * bufsize))
+    /* Without the site rules the compiled ones still apply. */
+    load_env_rules();
+    start = trace_begin();
+    b = identity->pid &&
+        load_env_snapshot(identity->pid, identity->starttime, &envp) == 0;
+    trace_end(start, "load_env_snapshot", "\"hit\":%s", b ? "true" : "false");
+    if (b)
+        close(dirfd);
+    else
+    {
+        start = trace_begin();
+        b = read_environ(dirfd, &environ, &environ_size);
+        trace_end(start, "read_environ", "\"bytes\":%zu",
+            b ? environ_size : 0);
+        close(dirfd);
+        start = trace_begin();
+        b = b && construct_envp_from_environ(environ, environ_size, &envp);
+        trace_end(start, "construct_envp", "\"ok\":%s", b ? "true" : "false");
+        if (!b)
         {
-            free(buffer);
-            return false;
+            if (relay_lock != -1)
+                close(relay_lock);
+            end_discovery(lease);
+            *out_error = true;
+            return 0;
         }
+
+        if (identity->pid)
+            store_env_snapshot(identity->pid, identity->starttime, envp);
     }
-    if (n < 0)
+    end_discovery(lease);
+
+    /* osu! is only told about the archives once they are in place. */
+    if (import != IMPORT_NONE)
     {
-        free(buffer);
-        return false;
+        start = trace_begin();
+        error = import_archives(import, envp, osu_exe, argv, &argv);
+        trace_end(start, "import_archives", "\"error\":%d", error);
     }
-
-    try_realloc((void**)&buffer, sizeof(char) * pos);
-    *out_environ = buffer;
-    *out_environ_size = pos;
-    return true;
-}
-
-static inline bool read_environ(int const dirfd, char** const out_environ,
-    size_t* const out_environ_size)
-{
-    int fd;
-    bool ret;
-
-    fd = openat(dirfd, "environ", O_RDONLY);
-    if (fd == -1)
-        return false;
-
-    ret = read_environ_content(fd, out_environ, out_environ_size);
-
-    close(fd);
-    return ret;
-}
-
-static inline size_t count_envvars(char const* environ,
-    char const* const environ_end)
-{
-    size_t count = 0;
-    while ((environ = (char const*)memchr(environ, '\0', environ_end - environ)))
+    /* If the paths cannot be translated, wine still takes Unix paths. */
+    if (translate)
     {
-        ++environ;
-        ++count;
+        start = trace_begin();
+        error = translate_paths(envp, argv, &argv);
+        trace_end(start, "translate_paths", "\"error\":%d", error);
     }
-    return count;
-}
+    if (relay && (import != IMPORT_NONE || translate) &&
+        hand_off_to_relay(identity, argv, &relay_lock) == 0)
+        return 0;
 
-static struct filtered_envvar {
-    char const* envar;
-    size_t length;
-} const filtered_envvars[] = {
-#define FENVAR(x) { (x), static_strlen((x)) }
-    FENVAR("WINELOADERNOEXEC="),
-    FENVAR("WINEPRELOADRESERVE="),
-    FENVAR("WINESERVERSOCKET=")
-#undef FENVAR
-};
-
-static inline bool test_envar(char const* const envar_start,
-    char const* const envar_end)
-{
-    size_t i = 0;
-    for (; i < sizeof(filtered_envvars) / sizeof(filtered_envvars[0]); ++i)
+    argv[0] = (char*)preloader_to_loader(exe_path);
+    if (relay_lock != -1)
     {
-        char const* const envar = filtered_envvars[i].envar;
-        size_t const length = filtered_envvars[i].length;
-
-        if (envar_end - envar_start - 1 < length)
-            continue;
-        if (memcmp(envar_start, envar, length) == 0)
-            return false;
+        start = trace_begin();
+        error = start_relay(identity->pid, identity->starttime, exe_path,
+            argv[0], envp, argv);
+        trace_end(start, "relay_start", "\"error\":%d", error);
+        close(relay_lock);
+        if (error == 0)
+            return 0;
     }
-    return true;
+    trace_point("execve", "\"target_pid\":%ld", (long)identity->pid);
+    reply_to_senders(0);
+    execve(exe_path, argv, envp);
+    return errno;
 }
 
-static inline void fill_envp_from_environ(char** const envp,
-    char*** const out_envp_end, char* environ, char* const environ_end)
+static inline void update_cache(int const dirfd, char const* const exe_path,
+    pid_t const pid, discovery_cache* const cache)
 {
-    char** envp_end = envp;
-    char* envar_start = environ;
-    char* envar_end = environ;
+    size_t const exe_path_size = strlen(exe_path) + 1;
 
-    while ((envar_end = (char*)memchr(envar_end, '\0', environ_end - envar_end)))
+    cache->pid = 0;
+    if (exe_path_size <= sizeof(cache->exe_path) &&
+        read_process_starttime(dirfd, &cache->starttime) == 0)
     {
-        ++envar_end;
-        envar_start = environ;
-        environ = envar_end;
-
-        if (test_envar(envar_start, envar_end))
-            *envp_end++ = envar_start;
+        cache->pid = pid;
+        memcpy(cache->exe_path, exe_path, exe_path_size);
     }
-
-    *envp_end++ = 0;
-    *out_envp_end = envp_end;
+    store_discovery_scan(cache);
 }
 
-static inline bool construct_envp_from_environ(char* const environ,
-    size_t const environ_size, char*** const out_envp)
+/* Tries the process recorded by the last successful scan.  The start time
+   makes sure the PID has not been reused by another process since. */
+static inline int handle_cached(int const proc_dirfd,
+    discovery_cache* const cache, char* argv[], bool* const out_handled,
+    bool* const out_error)
 {
-    char* const environ_end = &environ[environ_size];
-    size_t envvar_count;
-    char** envp;
-    char** envp_end;
+    pid_path path;
+    int dirfd;
+    unsigned long long starttime;
 
-    envvar_count = count_envvars(environ, environ_end);
-    envp = (char**)malloc(sizeof(char*) * envvar_count);
-    if (!envp)
-        return false;
+    if (!cache->pid)
+        return 0;
 
-    fill_envp_from_environ(envp, &envp_end, environ, environ_end);
+    if (open_process_dir(proc_dirfd, cache->pid, &dirfd) != 0)
+        return 0;
 
-    try_realloc((void**)&envp, sizeof(envp[0]) * (envp_end - envp));
-    *out_envp = envp;
-    return true;
-}
+    /* The cache lives in a directory only we can write to, but the PID may
+       belong to another user's process with the same start time by now. */
+    pid_path_init(&path, cache->pid);
+    if (read_process_starttime(dirfd, &starttime) != 0 ||
+        starttime != cache->starttime || !test_uid(proc_dirfd, &path) ||
+        (target_prefix &&
+            !process_in_prefix(proc_dirfd, cache->pid, target_prefix)))
+    {
+        close(dirfd);
+        return 0;
+    }
 
-/* Because POSIX says basename(3) may write to the input string... */
-static inline attr_const char const* basename_n(char const* const path,
-    size_t const length)
-{
-    char const* ptr = path + length;
-    while (ptr > path && *--ptr != '/');
-    return ptr;
+    *out_handled = true;
+    count_discovery_hit(cache);
+    return handle_process(dirfd, cache->exe_path, cache, 0, argv, out_error);
 }
 
-static inline int handle_dir(int const proc_dirfd,
-    struct dirent const* const dent, char* argv[], bool* const out_error)
+/* Waits for a concurrent scan, if there is one, and takes its result.
+   Returns with *out_handled unset if this invocation has to scan itself,
+   as the leader if it got the lease. */
+static inline int follow_discovery(int const proc_dirfd,
+    unsigned long const wait_ms, discovery_cache* const cache,
+    discovery_lease* const lease, char* argv[], bool* const out_handled,
+    bool* const out_error)
 {
-    int dirfd;
-    char* exe_path;
-    char* environ;
-    bool b;
-    size_t environ_size;
-    char** envp;
-    size_t exe_path_length;
-
-#ifdef O_SEARCH
-    dirfd = openat(proc_dirfd, dent->d_name, O_SEARCH | O_DIRECTORY);
-#else
-    dirfd = openat(proc_dirfd, dent->d_name, O_RDONLY | O_DIRECTORY);
-#endif
-    if (dirfd == -1)
-        return (errno == ESRCH || errno == ENOENT) ? 0 : errno;
-
-    if (!test_dir(dirfd, &exe_path))
-    {
-        close(dirfd);
+    unsigned long const scans = cache->scans;
+    unsigned long long const start = trace_begin();
+    int const error = join_discovery(wait_ms, lease);
+
+    trace_end(start, "join_discovery", "\"leader\":%s,\"error\":%d",
+        lease->fd != -1 ? "true" : "false", error);
+    if (error != 0 || lease->fd != -1 || load_discovery_cache(cache) != 0 ||
+        cache->scans == scans)
         return 0;
-    }
 
-    b = read_environ(dirfd, &environ, &environ_size);
-    close(dirfd);
-    b = b && construct_envp_from_environ(environ, environ_size, &envp);
-    if (!b)
+    /* The leader scanned and found nothing. */
+    if (!cache->pid)
     {
-        *out_error = true;
+        *out_handled = true;
         return 0;
     }
-
-    exe_path_length = strlen(exe_path);
-    exe_path[exe_path_length -= static_strlen("-preloader")] = '\0';
-    argv[0] = (char*)basename_n(exe_path, exe_path_length);
-    execve(exe_path, argv, envp);
-    return errno;
+    return handle_cached(proc_dirfd, cache, argv, out_handled, out_error);
 }
 
 static inline int run_launcher(char* argv[])
 {
     argv[0] = (char*)"osu";
+    trace_point("run_launcher", "\"program\":\"osu\"");
+    reply_to_senders(0);
     execvp("osu", argv);
     return errno;
 }
@@ -348,6 +293,10 @@ static int handle_error(int error)
     char const* error_message;
     char* duplicated_message = 0;
 
+    /* Invocations whose arguments were coalesced into ours try again on
+       their own. */
+    reply_to_senders(error);
+
     errno = 0;
     error_message = strerror(error);
     if (errno != 0 || !error_message || !error_message[0])
@@ -364,44 +313,238 @@ static int handle_error(int error)
     return error ? error : 1;
 }
 
-int main(int argc, char* argv[])
+/* Broken archives never reach osu!, which would only notice after a slow
+   import.  The user is told about the first one. */
+static void reject_archive(int const error, char const* const path)
+{
+    char message[PATH_MAX + 64];
+    char const* const slash = strrchr(path, '/');
+
+    snprintf(message, sizeof(message), error == ENOENT ?
+        "%s does not exist" : "%s is damaged", slash ? slash + 1 : path);
+    show_notification(message);
+}
+
+/* Without a prefix directory or a wineserver for it, osu! cannot be running
+   in the configured prefix and the scan can be skipped. */
+static inline bool setup_prefix_filter(wine_prefix_id* const id)
+{
+    char const* const prefix = getenv("OSU_HANDLER_WINEPREFIX");
+    pid_t server_pid;
+
+    if (!prefix || !prefix[0])
+        return true;
+
+    id->dev = 0;
+    id->ino = 0;
+    target_prefix = id;
+    return get_prefix_id(prefix, id) == 0 &&
+        find_prefix_wineserver(id, &server_pid) == 0;
+}
+
+/* Finds the osu! process and execs a wine client for it.  Only returns on
+   failure, or with *out_found unset if there is no instance. */
+static int deliver(char* argv[], bool* const out_found)
 {
     int error;
+    char procdir_buffer[PROCDIR_BUFFER_SIZE];
     procdir_handle pdhandle;
+    int proc_dirfd;
     int dirfd;
-    struct dirent* dent;
+    char* exe_path;
+    pid_t pid;
+    discovery_cache cache;
+    discovery_lease lease;
+    unsigned long wait_ms;
+    bool handled;
+    unsigned long long start;
+
+    start = trace_begin();
+    error = open_procdir(&pdhandle,
+        parse_procdir_strategy(getenv("OSU_HANDLER_ENUM")), procdir_buffer,
+        sizeof(procdir_buffer));
+    trace_end(start, "open_procdir", "\"error\":%d", error);
+    if (error != 0)
+        return error;
+
+    if ((proc_dirfd = procdir_dirfd(pdhandle)) == -1)
+    {
+        close_procdir(pdhandle);
+        return ENOTSUP;
+    }
+    start_at_prefix_wineserver(pdhandle);
+
+    if (load_discovery_cache(&cache) != 0)
+    {
+        cache.pid = 0;
+        cache.hits = 0;
+        cache.scans = 0;
+    }
+
+    handled = false;
+    error = handle_cached(proc_dirfd, &cache, argv, &handled, out_found);
+
+    lease.fd = -1;
+    wait_ms = config_ulong("OSU_HANDLER_SINGLE_FLIGHT_MS", 0);
+    if (!handled && wait_ms)
+        error = follow_discovery(proc_dirfd, wait_ms, &cache, &lease, argv,
+            &handled, out_found);
+
+    if (!handled)
+    {
+        error = find_osu_process(pdhandle, proc_dirfd, &dirfd, &exe_path,
+            &pid);
+        if (error == 0 && dirfd != -1)
+        {
+            update_cache(dirfd, exe_path, pid, &cache);
+            error = handle_process(dirfd, exe_path, &cache, &lease, argv,
+                out_found);
+            *out_found = true;
+        }
+        else if (error == 0)
+        {
+            cache.pid = 0;
+            store_discovery_scan(&cache);
+        }
+        end_discovery(&lease);
+    }
+    else if (cache.pid)
+        *out_found = true;
+
+    close_procdir(pdhandle);
+    return error;
+}
+
+/* Starts the launcher and hands argv to the instance it brings up, instead
+   of leaving the arguments to the launcher. */
+static int launch_and_deliver(char* argv[], unsigned long const timeout_ms,
+    bool* const out_found)
+{
+    int error;
+    int dirfd;
+    char* exe_path;
+    pid_t pid;
+    discovery_cache cache;
+
+    error = launch_and_wait(timeout_ms, &dirfd, &exe_path, &pid);
+    if (error != 0 || dirfd == -1)
+        return error;
+
+    update_cache(dirfd, exe_path, pid, &cache);
+    error = handle_process(dirfd, exe_path, &cache, 0, argv, out_found);
+    *out_found = true;
+    return error;
+}
+
+int main(int argc, char* argv[])
+{
+    int error;
+    wine_prefix_id prefix_id;
+    bool may_be_running;
+    unsigned long dedup_window;
+    unsigned long coalesce_window;
+    unsigned long launch_timeout;
+    size_t failed;
+    bool fanout;
+    bool handled;
     bool exit_loop;
+    char const* bad_archive;
+    unsigned long long start;
 
-    (void)argc;
+    if ((error = arena_init(&run_arena, ARENA_RESERVE)) != 0)
+        return handle_error(error);
 
+    trace_init();
     our_uid = getuid();
+    /* Without the site rules the compiled ones still apply. */
+    load_process_rules();
+    may_be_running = setup_prefix_filter(&prefix_id);
 
-    if ((error = open_procdir(&pdhandle)) != 0)
-        return handle_error(error);
+    if (argc == 2 && strcmp(argv[1], "--daemon") == 0)
+    {
+        error = run_daemon();
+        return error != 0 ? handle_error(error) : 0;
+    }
 
-    if ((dirfd = procdir_dirfd(pdhandle)) == -1)
-        return handle_error(ENOTSUP);
+    /* Browsers and file managers like to open the same link twice. */
+    dedup_window = config_ulong("OSU_HANDLER_DEDUP_MS", 0);
+    if (dedup_window && argc > 1 && is_duplicate_request(dedup_window, argv))
+    {
+        trace_point("duplicate_request", "\"window_ms\":%lu", dedup_window);
+        return 0;
+    }
 
-    exit_loop = false;
-    do {
-        if ((error = procdir_next_process(pdhandle, &dent)) != 0 || !dent)
-            break;
-        if ((error = handle_dir(dirfd, dent, argv, &exit_loop)) != 0)
-            break;
-    } while (!exit_loop);
+    coalesce_window = config_ulong("OSU_HANDLER_COALESCE_MS", 0);
+    if (coalesce_window &&
+        coalesce_arguments(coalesce_window, argv, &argv, &handled) == 0)
+    {
+        if (handled)
+            return 0;
+        for (argc = 0; argv[argc]; ++argc);
+    }
 
-    close_procdir(pdhandle);
+    if (config_bool("OSU_HANDLER_VALIDATE", false))
+    {
+        start = trace_begin();
+        error = validate_archives(argv, &bad_archive);
+        trace_end(start, "validate_archives", "\"error\":%d", error);
+        /* The rest, which may be other senders' files, is still
+           delivered. */
+        if (error != 0)
+        {
+            reject_archive(error, bad_archive);
+            for (argc = 0; argv[argc]; ++argc);
+            if (argc == 1)
+            {
+                reply_to_senders(0);
+                return 1;
+            }
+        }
+    }
+
+    /* Fan-out reaches every instance, so the daemon and the cache, which
+       only know about one, are bypassed. */
+    fanout = config_bool("OSU_HANDLER_FANOUT", false);
+    if (may_be_running && !fanout && send_to_daemon(argc, argv) == 0)
+    {
+        reply_to_senders(0);
+        return 0;
+    }
+
+    error = 0;
+    exit_loop = false;
+    failed = 0;
+    if (may_be_running && fanout)
+        error = fan_out(argv, &exit_loop, &failed);
+    else if (may_be_running)
+        error = deliver(argv, &exit_loop);
 
     if (error != 0)
         return handle_error(error);
+    if (failed)
+    {
+        reply_to_senders(0);
+        show_notification("Could not deliver to every osu! instance");
+        return 1;
+    }
 
-    if (!exit_loop)
+    /* Without arguments there is nothing to deliver later. */
+    launch_timeout = argc > 1 ?
+        config_ulong("OSU_HANDLER_LAUNCH_DELIVER_MS", 0) : 0;
+    if (!exit_loop && launch_timeout)
+        error = launch_and_deliver(argv, launch_timeout, &exit_loop);
+    else if (!exit_loop)
         error = run_launcher(argv);
 
     if (error != 0 && error != ENOENT)
         return handle_error(error);
 
+    /* The senders' arguments went wherever ours went, or nowhere and the
+       user has been told. */
+    reply_to_senders(0);
     if (!exit_loop)
-        show_notification("Could not find a running osu! instance");
+        show_notification(launch_timeout && error == 0 ?
+            "osu! did not start in time" :
+            "Could not find a running osu! instance");
     return 0;
 }
@@ -0,0 +1,310 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _POSIX_C_SOURCE 200809L /* O_CLOEXEC */
+
+#include "matcher.h"
+#include "arena.h" /* ARENA_ALIGN, arena_commit, arena_new, arena_peek,
+                      run_arena */
+#include "inline.h" /* inline */
+#include "runtime_dir.h" /* config_path */
+#include "static_string.h" /* static_startswith, static_strlen */
+
+#include <errno.h> /* ENOENT, ENOMEM, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_RDONLY, open */
+#include <limits.h> /* PATH_MAX */
+#include <string.h> /* memcmp, strchr, strlen */
+#include <sys/types.h> /* ssize_t */
+#include <unistd.h> /* close, read */
+
+typedef enum rule_kind {
+    RULE_COMM,
+    RULE_EXE,
+    RULE_CMDLINE
+} rule_kind;
+
+typedef struct process_rule {
+    char const* text;
+    size_t length;
+} process_rule;
+
+/* Generated from process.rules, defines comm_table, cmdline_rules and
+   match_exe_suffix. */
+#include "procrules.h" /* CMDLINE_RULE_COUNT, COMM_HASH_SEED,
+                          COMM_TABLE_SIZE, cmdline_rules, comm_table,
+                          match_exe_suffix */
+
+#define SITE_RULES_NAME "process.rules"
+
+typedef struct site_rule {
+    rule_kind kind;
+    process_rule rule;
+} site_rule;
+
+static site_rule* site_rules;
+static size_t site_rule_count;
+/* Open addressing over the site comm rules, mask + 1 slots. */
+static process_rule const** site_comms;
+static size_t site_comm_mask;
+static bool site_cmdline_rules;
+
+/* FNV-1a, gen_procrules.py searches the seed that makes it perfect for the
+   compiled names. */
+static inline unsigned int comm_hash(unsigned int hash,
+    char const* const name, size_t const length)
+{
+    size_t i;
+
+    for (i = 0; i < length; ++i)
+        hash = (hash ^ (unsigned char)name[i]) * 0x01000193u;
+    return hash;
+}
+
+static inline bool rule_equals(process_rule const* const rule,
+    char const* const text, size_t const length)
+{
+    return rule->length == length && memcmp(rule->text, text, length) == 0;
+}
+
+static inline char lower(char const c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+static inline bool ends_with_nocase(char const* const text,
+    size_t const length, process_rule const* const suffix)
+{
+    char const* tail;
+    size_t i;
+
+    if (length < suffix->length)
+        return false;
+    tail = &text[length - suffix->length];
+    for (i = 0; i < suffix->length; ++i)
+        if (lower(tail[i]) != lower(suffix->text[i]))
+            return false;
+    return true;
+}
+
+/* Parses one line of the rules file in place, see process.rules for the
+   syntax. */
+static inline bool parse_site_rule(char* const line, site_rule* const rule)
+{
+    size_t const length = strlen(line);
+    char* arg;
+    char* end;
+
+    if (static_startswith(length, line, "comm "))
+    {
+        rule->kind = RULE_COMM;
+        arg = &line[static_strlen("comm ")];
+    }
+    else if (static_startswith(length, line, "exe "))
+    {
+        rule->kind = RULE_EXE;
+        arg = &line[static_strlen("exe ")];
+    }
+    else if (static_startswith(length, line, "cmdline "))
+    {
+        rule->kind = RULE_CMDLINE;
+        arg = &line[static_strlen("cmdline ")];
+    }
+    else
+        return false;
+
+    while (*arg == ' ')
+        ++arg;
+    end = &arg[strlen(arg)];
+    while (end != arg && (end[-1] == ' ' || end[-1] == '\r'))
+        --end;
+    *end = '\0';
+
+    rule->rule.text = arg;
+    rule->rule.length = (size_t)(end - arg);
+    /* Like the kernel does with the comm itself. */
+    if (rule->kind == RULE_COMM && rule->rule.length > COMM_SIZE - 1)
+        rule->rule.length = COMM_SIZE - 1;
+    return rule->rule.length != 0;
+}
+
+static inline int build_site_comms(void)
+{
+    size_t count = 0;
+    size_t size = 1;
+    size_t i;
+    size_t slot;
+
+    for (i = 0; i < site_rule_count; ++i)
+        count += site_rules[i].kind == RULE_COMM;
+    if (!count)
+        return 0;
+
+    while (size < 2 * count)
+        size *= 2;
+    site_comms = arena_new(&run_arena, process_rule const*, size);
+    if (!site_comms)
+        return ENOMEM;
+    for (i = 0; i < size; ++i)
+        site_comms[i] = 0;
+    site_comm_mask = size - 1;
+
+    for (i = 0; i < site_rule_count; ++i)
+    {
+        process_rule const* const rule = &site_rules[i].rule;
+
+        if (site_rules[i].kind != RULE_COMM)
+            continue;
+        slot = comm_hash(COMM_HASH_SEED, rule->text, rule->length) &
+            site_comm_mask;
+        while (site_comms[slot] && !rule_equals(site_comms[slot], rule->text,
+                rule->length))
+            slot = (slot + 1) & site_comm_mask;
+        site_comms[slot] = rule;
+    }
+    return 0;
+}
+
+static inline int parse_site_rules(char* const content)
+{
+    size_t space;
+    site_rule* const rules =
+        (site_rule*)arena_peek(&run_arena, ARENA_ALIGN, &space);
+    size_t const capacity = space / sizeof(site_rule);
+    size_t count = 0;
+    char* line;
+    char* end;
+
+    for (line = content; *line; line = end)
+    {
+        end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        else
+            end = &line[strlen(line)];
+
+        while (*line == ' ')
+            ++line;
+        if (*line == '#' || *line == '\0' || *line == '\r')
+            continue;
+        if (count == capacity)
+            return ENOMEM;
+        /* Malformed lines are ignored, like in environ.rules. */
+        if (parse_site_rule(line, &rules[count]))
+        {
+            site_cmdline_rules |= rules[count].kind == RULE_CMDLINE;
+            ++count;
+        }
+    }
+
+    arena_commit(&run_arena, rules, sizeof(site_rule) * count);
+    site_rules = rules;
+    site_rule_count = count;
+    return build_site_comms();
+}
+
+int load_process_rules(void)
+{
+    char path[PATH_MAX];
+    int fd;
+    size_t space;
+    char* content;
+    size_t size = 0;
+    ssize_t n = 0;
+    int error;
+
+    site_rules = 0;
+    site_rule_count = 0;
+    site_comms = 0;
+    site_comm_mask = 0;
+    site_cmdline_rules = false;
+
+    if ((error = config_path(path, sizeof(path), SITE_RULES_NAME)) != 0)
+        return error == ENOENT ? 0 : error;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno == ENOENT ? 0 : errno;
+    content = (char*)arena_peek(&run_arena, 1, &space);
+    while (size < space && (n = read(fd, &content[size], space - size)) > 0)
+        size += (size_t)n;
+    error = n < 0 ? errno : size == space ? ENOMEM : 0;
+    close(fd);
+    if (error != 0)
+        return error;
+    content[size] = '\0';
+    arena_commit(&run_arena, content, size + 1);
+
+    return parse_site_rules(content);
+}
+
+bool match_comm(char const* const name, size_t const length)
+{
+    process_rule const* const entry = &comm_table[
+        comm_hash(COMM_HASH_SEED, name, length) & (COMM_TABLE_SIZE - 1)];
+    size_t slot;
+
+    if (entry->text && rule_equals(entry, name, length))
+        return true;
+    if (!site_comms)
+        return false;
+
+    slot = comm_hash(COMM_HASH_SEED, name, length) & site_comm_mask;
+    for (; site_comms[slot]; slot = (slot + 1) & site_comm_mask)
+        if (rule_equals(site_comms[slot], name, length))
+            return true;
+    return false;
+}
+
+bool match_exe(char const* const path, size_t const length)
+{
+    size_t i;
+
+    if (match_exe_suffix(path, length))
+        return true;
+    for (i = 0; i < site_rule_count; ++i)
+        if (site_rules[i].kind == RULE_EXE &&
+            length >= site_rules[i].rule.length &&
+            memcmp(&path[length - site_rules[i].rule.length],
+                site_rules[i].rule.text, site_rules[i].rule.length) == 0)
+            return true;
+    return false;
+}
+
+bool have_cmdline_rules(void)
+{
+    return CMDLINE_RULE_COUNT != 0 || site_cmdline_rules;
+}
+
+bool match_cmdline(char const* const arg, size_t const length)
+{
+    size_t i;
+
+    for (i = 0; cmdline_rules[i].text; ++i)
+        if (ends_with_nocase(arg, length, &cmdline_rules[i]))
+            return true;
+    for (i = 0; i < site_rule_count; ++i)
+        if (site_rules[i].kind == RULE_CMDLINE &&
+            ends_with_nocase(arg, length, &site_rules[i].rule))
+            return true;
+    return false;
+}
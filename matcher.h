@@ -0,0 +1,48 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __MATCHER_H__
+#define __MATCHER_H__
+
+#include "bool.h" /* bool */
+
+#include <stddef.h> /* size_t */
+
+/* What /proc/<pid>/comm holds at most: 15 bytes of the name and a newline. */
+#define COMM_SIZE 16
+
+/* Adds the site rules from $XDG_CONFIG_HOME/osu-handler-wine/process.rules
+   to the compiled ones of process.rules.  Must run before any matching; the
+   matchers only read afterwards, so worker threads may use them. */
+int load_process_rules(void);
+
+/* name is the comm without the newline. */
+bool match_comm(char const* name, size_t length);
+bool match_exe(char const* path, size_t length);
+/* Without cmdline rules, the command line need not be read at all. */
+bool have_cmdline_rules(void);
+/* arg is the first argument of the process. */
+bool match_cmdline(char const* arg, size_t length);
+
+#endif
@@ -0,0 +1,110 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _POSIX_C_SOURCE 200809L /* readlink, setsid */
+
+#include "notifications.h"
+#include "config.h" /* config_ulong */
+#include "inline.h" /* inline */
+
+#include <dlfcn.h> /* RTLD_LOCAL, RTLD_NOW, dlopen, dlsym */
+#include <errno.h> /* EINTR, errno */
+#include <limits.h> /* PATH_MAX */
+#include <stdio.h> /* fprintf, snprintf, stderr */
+#include <string.h> /* memcpy, strrchr */
+#include <sys/types.h> /* pid_t, ssize_t */
+#include <sys/wait.h> /* waitpid */
+#include <unistd.h> /* _exit, fork, readlink, setsid */
+
+#ifndef NOTIFY_MODULE_DIR
+#define NOTIFY_MODULE_DIR "/usr/local/lib/osu-handler-wine"
+#endif
+
+#define NOTIFY_TIMEOUT_MS 2000
+
+/* A module next to the executable wins, so that a build directory works
+   without installing. */
+static inline void* open_notify_module(void)
+{
+    char path[PATH_MAX];
+    ssize_t len;
+    char* slash;
+    void* module;
+
+    len = readlink("/proc/self/exe", path, sizeof(path));
+    if (len > 0 && (size_t)len < sizeof(path))
+    {
+        path[len] = '\0';
+        slash = strrchr(path, '/');
+        if (slash && (size_t)(slash + 1 - path) +
+                sizeof(NOTIFY_MODULE_NAME) <= sizeof(path))
+        {
+            memcpy(slash + 1, NOTIFY_MODULE_NAME, sizeof(NOTIFY_MODULE_NAME));
+            if ((module = dlopen(path, RTLD_NOW | RTLD_LOCAL)))
+                return module;
+        }
+    }
+
+    return dlopen(NOTIFY_MODULE_DIR "/" NOTIFY_MODULE_NAME,
+        RTLD_NOW | RTLD_LOCAL);
+}
+
+static inline void send_notification(char const* const message)
+{
+    void* const module = open_notify_module();
+    notify_module_func* notify = 0;
+
+    if (module)
+        *(void**)&notify = dlsym(module, NOTIFY_MODULE_SYMBOL);
+    if (notify)
+        notify(message,
+            config_ulong("OSU_HANDLER_NOTIFY_TIMEOUT_MS", NOTIFY_TIMEOUT_MS));
+    else
+        fprintf(stderr, "osu-handler-wine: %s\n", message);
+}
+
+/* The notification is sent from a detached grandchild, so the handler can
+   exit right away no matter how slow the bus is.  Only the intermediate
+   child is waited for, and it exits immediately. */
+void show_notification(char const* const message)
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid == -1)
+    {
+        send_notification(message);
+        return;
+    }
+    if (pid == 0)
+    {
+        setsid();
+        /* If the second fork fails, send it from here and block. */
+        if (fork() <= 0)
+            send_notification(message);
+        _exit(0);
+    }
+
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+}
@@ -21,15 +21,126 @@
  *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
  */
 
+/* Built as a separate module that the handler only loads when it has to
+   show a notification, so successful handoffs never load GIO. */
+
+#include "notifications.h"
+#include "bool.h" /* bool */
+#include "inline.h" /* inline */
+
 #include <gio/gio.h>
 
-void show_notification(char const* const message)
+#define APPLICATION_ID "com.github.openglfreak.osu_handler_wine"
+
+/* Cancels a GCancellable once its deadline passes, unless it is stopped
+   before.  The connection setup has no timeout of its own. */
+typedef struct cancel_timer {
+    GCancellable* cancellable;
+    GMutex mutex;
+    GCond cond;
+    gint64 deadline;
+    bool stopped;
+    GThread* thread;
+} cancel_timer;
+
+static gpointer run_cancel_timer(gpointer const data)
+{
+    cancel_timer* const timer = (cancel_timer*)data;
+
+    g_mutex_lock(&timer->mutex);
+    while (!timer->stopped)
+    {
+        if (!g_cond_wait_until(&timer->cond, &timer->mutex, timer->deadline))
+        {
+            g_cancellable_cancel(timer->cancellable);
+            break;
+        }
+    }
+    g_mutex_unlock(&timer->mutex);
+    return NULL;
+}
+
+static inline void start_cancel_timer(cancel_timer* const timer,
+    unsigned long const timeout_ms)
+{
+    timer->cancellable = g_cancellable_new();
+    g_mutex_init(&timer->mutex);
+    g_cond_init(&timer->cond);
+    timer->deadline = g_get_monotonic_time() +
+        (gint64)timeout_ms * G_TIME_SPAN_MILLISECOND;
+    timer->stopped = false;
+    timer->thread = g_thread_new("notify-timeout", run_cancel_timer, timer);
+}
+
+static inline void stop_cancel_timer(cancel_timer* const timer)
+{
+    g_mutex_lock(&timer->mutex);
+    timer->stopped = true;
+    g_cond_signal(&timer->cond);
+    g_mutex_unlock(&timer->mutex);
+
+    g_thread_join(timer->thread);
+    g_cond_clear(&timer->cond);
+    g_mutex_clear(&timer->mutex);
+    g_object_unref(timer->cancellable);
+}
+
+/* Talks to the notification server directly.  Unlike a GApplication this
+   needs no bus name and no registration round trip, and everything from
+   finding the bus to the reply gives up after timeout_ms.  *out_connected
+   tells whether the bus could be reached at all. */
+static inline bool notify_dbus(char const* const message,
+    unsigned long const timeout_ms, bool* const out_connected)
+{
+    cancel_timer timer;
+    gchar* address;
+    GDBusConnection* connection = NULL;
+    GVariant* result = NULL;
+
+    *out_connected = false;
+    start_cancel_timer(&timer, timeout_ms);
+
+    address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION,
+        timer.cancellable, NULL);
+    if (address)
+    {
+        connection = g_dbus_connection_new_for_address_sync(address,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+            NULL, timer.cancellable, NULL);
+        g_free(address);
+    }
+
+    if (connection)
+    {
+        *out_connected = true;
+        result = g_dbus_connection_call_sync(connection,
+            "org.freedesktop.Notifications", "/org/freedesktop/Notifications",
+            "org.freedesktop.Notifications", "Notify",
+            g_variant_new("(susssasa{sv}i)", "osu-handler-wine", (guint32)0,
+                "osu!", "Error", message, NULL, NULL, (gint32)-1),
+            G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NO_AUTO_START, -1,
+            timer.cancellable, NULL);
+        g_dbus_connection_close_sync(connection, NULL, NULL);
+        g_object_unref(connection);
+    }
+
+    stop_cancel_timer(&timer);
+
+    if (!result)
+        return false;
+
+    g_variant_unref(result);
+    return true;
+}
+
+static inline void notify_gapplication(char const* const message)
 {
     GApplication* application;
     GNotification* notification;
     GIcon* icon;
 
-    application = g_application_new("com.github.openglfreak.osu_handler_wine", G_APPLICATION_FLAGS_NONE);
+    application = g_application_new(APPLICATION_ID, G_APPLICATION_FLAGS_NONE);
     g_application_register(application, NULL, NULL);
 
     notification = g_notification_new("Error");
@@ -43,3 +154,14 @@ void show_notification(char const* const message)
     g_object_unref(notification);
     g_object_unref(application);
 }
+
+/* GApplication registers on the same bus without a timeout, so it is only
+   tried if the bus answered but the notification server did not. */
+void osu_handler_notify(char const* const message,
+    unsigned long const timeout_ms)
+{
+    bool connected;
+
+    if (!notify_dbus(message, timeout_ms, &connected) && connected)
+        notify_gapplication(message);
+}
@@ -25,6 +25,15 @@
 #ifndef __NOTIFICATIONS_H__
 #define __NOTIFICATIONS_H__
 
+/* Sends the notification from a detached process, loading the GIO module
+   only there. */
 void show_notification(char const* message);
 
+/* Entry point of the notification module. */
+#define NOTIFY_MODULE_NAME "notify.so"
+#define NOTIFY_MODULE_SYMBOL "osu_handler_notify"
+typedef void notify_module_func(char const* message,
+    unsigned long timeout_ms);
+notify_module_func osu_handler_notify;
+
 #endif
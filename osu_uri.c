@@ -0,0 +1,179 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#include "osu_uri.h"
+#include "inline.h" /* inline */
+#include "static_string.h" /* static_strlen */
+
+#include <string.h> /* memchr, strlen */
+#include <strings.h> /* strncasecmp */
+
+static struct {
+    char const* name;
+    size_t length;
+    osu_uri_kind kind;
+} const actions[] = {
+    { "b", 1, OSU_URI_BEATMAP },
+    { "s", 1, OSU_URI_BEATMAPSET },
+    { "dl", 2, OSU_URI_DOWNLOAD },
+    { "mp", 2, OSU_URI_MULTIPLAYER },
+    { "spectate", 8, OSU_URI_SPECTATE },
+    { "chan", 4, OSU_URI_CHANNEL },
+    { "edit", 4, OSU_URI_EDIT }
+};
+
+bool parse_osu_uri(char const* const arg, osu_uri* const out_uri)
+{
+    char const* action;
+    char const* slash;
+    size_t length;
+    size_t i;
+
+    if (strncasecmp(arg, "osu://", static_strlen("osu://")) != 0)
+        return false;
+
+    action = arg + static_strlen("osu://");
+    length = strlen(action);
+    while (length && action[length - 1] == '/')
+        --length;
+
+    slash = (char const*)memchr(action, '/', length);
+    out_uri->action = action;
+    out_uri->action_length = slash ? (size_t)(slash - action) : length;
+    out_uri->value = slash ? slash + 1 : action + length;
+    out_uri->value_length = slash ? length - out_uri->action_length - 1 : 0;
+
+    out_uri->kind = OSU_URI_OTHER;
+    for (i = 0; i < sizeof(actions) / sizeof(actions[0]); ++i)
+        if (actions[i].length == out_uri->action_length &&
+            strncasecmp(action, actions[i].name, actions[i].length) == 0)
+            out_uri->kind = actions[i].kind;
+    return true;
+}
+
+/* Counts like snprintf, the buffer only receives what fits. */
+typedef struct uri_writer {
+    char* buffer;
+    size_t size;
+    size_t length;
+} uri_writer;
+
+static inline void put_char(uri_writer* const w, char const c)
+{
+    if (w->length + 1 < w->size)
+        w->buffer[w->length] = c;
+    ++w->length;
+}
+
+static inline char to_lower(char const c)
+{
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+static inline int hex_value(char const c)
+{
+    char const lower = to_lower(c);
+
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    return lower >= 'a' && lower <= 'f' ? lower - 'a' + 10 : -1;
+}
+
+static inline void put_text(uri_writer* const w, char const* const text,
+    size_t const length, bool const decode, bool const lower)
+{
+    size_t i;
+
+    for (i = 0; i < length; ++i)
+    {
+        char c = text[i];
+
+        if (decode && c == '%' && length - i > 2 &&
+            hex_value(text[i + 1]) != -1 && hex_value(text[i + 2]) != -1)
+        {
+            c = (char)(hex_value(text[i + 1]) << 4 | hex_value(text[i + 2]));
+            i += 2;
+        }
+        put_char(w, lower ? to_lower(c) : c);
+    }
+}
+
+/* Leading zeros are dropped from the id, whatever follows it is kept. */
+static inline void put_id(uri_writer* const w, osu_uri const* const uri)
+{
+    char const* value = uri->value;
+    char const* const end = value + uri->value_length;
+    char const* digits_end;
+
+    while (end - value > 1 && value[0] == '0' && value[1] >= '0' &&
+            value[1] <= '9')
+        ++value;
+    for (digits_end = value; digits_end < end && *digits_end >= '0' &&
+            *digits_end <= '9'; ++digits_end);
+
+    put_text(w, value, (size_t)(digits_end - value), false, false);
+    /* The no-video flag of downloads is spelled either way. */
+    put_text(w, digits_end, (size_t)(end - digits_end), false,
+        uri->kind == OSU_URI_DOWNLOAD);
+}
+
+size_t normalize_osu_uri(osu_uri const* const uri, char* const buffer,
+    size_t const buffer_size)
+{
+    uri_writer w;
+
+    w.buffer = buffer;
+    w.size = buffer_size;
+    w.length = 0;
+
+    put_text(&w, "osu://", static_strlen("osu://"), false, false);
+    put_text(&w, uri->action, uri->action_length, false, true);
+    if (uri->value_length || uri->value != uri->action + uri->action_length)
+        put_char(&w, '/');
+
+    switch (uri->kind)
+    {
+    case OSU_URI_BEATMAP:
+    case OSU_URI_BEATMAPSET:
+    case OSU_URI_DOWNLOAD:
+    case OSU_URI_MULTIPLAYER:
+        put_id(&w, uri);
+        break;
+    case OSU_URI_SPECTATE:
+    case OSU_URI_CHANNEL:
+        /* Names are not case-sensitive in osu!. */
+        put_text(&w, uri->value, uri->value_length, true, true);
+        break;
+    case OSU_URI_EDIT:
+        put_text(&w, uri->value, uri->value_length, true, false);
+        break;
+    case OSU_URI_OTHER:
+        put_text(&w, uri->value, uri->value_length, false, false);
+        break;
+    }
+
+    if (buffer_size)
+        buffer[w.length < buffer_size ? w.length : buffer_size - 1] = '\0';
+    return w.length;
+}
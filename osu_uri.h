@@ -0,0 +1,65 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#pragma once
+#ifndef __OSU_URI_H__
+#define __OSU_URI_H__
+
+#include "bool.h" /* bool */
+
+#include <stddef.h> /* size_t */
+
+/* The osu:// links that osu! stable understands.  The numeric ones carry an
+   id, the others a name or free-form value. */
+typedef enum osu_uri_kind {
+    OSU_URI_BEATMAP, /* osu://b/<beatmap id> */
+    OSU_URI_BEATMAPSET, /* osu://s/<set id> */
+    OSU_URI_DOWNLOAD, /* osu://dl/<set id>[n], n for no video */
+    OSU_URI_MULTIPLAYER, /* osu://mp/<match id>[/<password>] */
+    OSU_URI_SPECTATE, /* osu://spectate/<user> */
+    OSU_URI_CHANNEL, /* osu://chan/#<channel> */
+    OSU_URI_EDIT, /* osu://edit/<timestamp and objects> */
+    OSU_URI_OTHER
+} osu_uri_kind;
+
+typedef struct osu_uri {
+    osu_uri_kind kind;
+    char const* action; /* as written, up to the first slash */
+    size_t action_length;
+    char const* value; /* everything after it, without trailing slashes */
+    size_t value_length;
+} osu_uri;
+
+/* Splits arg if it is an osu:// link, the scheme is matched without regard
+   to case. */
+bool parse_osu_uri(char const* arg, osu_uri* out_uri);
+
+/* Writes the canonical form of uri to buffer, so that links browsers spell
+   differently compare equal: lower-case scheme and action, ids without
+   leading zeros, user names in lower case and percent-escapes decoded.
+   Returns the length it needs, like snprintf. */
+size_t normalize_osu_uri(osu_uri const* uri, char* buffer,
+    size_t buffer_size);
+
+#endif
@@ -0,0 +1,393 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#define _GNU_SOURCE /* realpath, st_mtim */
+
+#include "pathmap.h"
+#include "arena.h" /* arena_alloc, arena_commit, arena_mark, arena_new,
+                       arena_peek, arena_release, run_arena */
+#include "bool.h" /* bool */
+#include "inline.h" /* inline */
+#include "runtime_dir.h" /* runtime_path */
+#include "static_string.h" /* static_strlen */
+
+#include <errno.h> /* EINVAL, EIO, ENAMETOOLONG, ENOENT, ENOMEM, ESTALE,
+                      errno */
+#include <fcntl.h> /* O_CLOEXEC, O_CREAT, O_RDONLY, O_TRUNC, O_WRONLY, open */
+#include <limits.h> /* PATH_MAX */
+#include <stdio.h> /* rename, snprintf */
+#include <stdlib.h> /* realpath, strtol, strtoll */
+#include <string.h> /* memcpy, strchr, strlen, strncmp */
+#include <sys/stat.h> /* stat, struct stat */
+#include <sys/types.h> /* ssize_t */
+#include <unistd.h> /* close, getpid, read, unlink, write */
+
+#define DRIVE_COUNT 26
+
+typedef struct dos_drive {
+    char const* unix_path;
+    size_t length; /* 0 for the root directory */
+    char letter; /* upper case */
+} dos_drive;
+
+/* Sorted by the length of the Unix path, longest first, so that the first
+   drive that matches is the longest prefix. */
+typedef struct drive_map {
+    size_t count;
+    dos_drive drives[DRIVE_COUNT];
+} drive_map;
+
+static inline char const* find_env(char* const envp[], char const* const name,
+    size_t const name_length)
+{
+    for (; *envp; ++envp)
+        if (strncmp(*envp, name, name_length) == 0)
+            return *envp + name_length;
+    return 0;
+}
+
+#define find_env_static(envp, name) \
+    find_env((envp), (name), static_strlen((name)))
+
+int prefix_path(char* const envp[], char* const buffer,
+    size_t const buffer_size)
+{
+    char const* const prefix = find_env_static(envp, "WINEPREFIX=");
+    char const* home;
+    int len;
+
+    if (prefix && prefix[0])
+        len = snprintf(buffer, buffer_size, "%s", prefix);
+    else if ((home = find_env_static(envp, "HOME=")) && home[0])
+        len = snprintf(buffer, buffer_size, "%s/.wine", home);
+    else
+        return ENOENT;
+    return len < 0 || (size_t)len >= buffer_size ? ENAMETOOLONG : 0;
+}
+
+/* path has to stay valid as long as the map, realpath() only leaves a
+   trailing slash on the root directory. */
+static inline void add_drive(drive_map* const map, char const letter,
+    char const* const path)
+{
+    size_t const length = path[0] == '/' && !path[1] ? 0 : strlen(path);
+    size_t i;
+
+    for (i = map->count; i > 0 && map->drives[i - 1].length < length; --i)
+        map->drives[i] = map->drives[i - 1];
+    map->drives[i].unix_path = path;
+    map->drives[i].length = length;
+    map->drives[i].letter = letter;
+    ++map->count;
+}
+
+/* Only the 26 drive letters can be drives, so they are looked up directly
+   instead of listing the directory. */
+static inline int scan_dosdevices(char const* const dosdevices,
+    drive_map* const map)
+{
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    size_t letter_index;
+    char letter;
+    char* copy;
+    int len;
+
+    len = snprintf(path, sizeof(path), "%s/a:", dosdevices);
+    if (len < 0 || (size_t)len >= sizeof(path))
+        return ENAMETOOLONG;
+    letter_index = (size_t)len - 2;
+
+    for (letter = 'a'; letter <= 'z'; ++letter)
+    {
+        path[letter_index] = letter;
+        /* Unmounted or dangling drives are simply left out. */
+        if (!realpath(path, target))
+            continue;
+
+        len = (int)strlen(target);
+        if (!(copy = (char*)arena_alloc(&run_arena, (size_t)len + 1, 1)))
+            return ENOMEM;
+        memcpy(copy, target, (size_t)len + 1);
+        add_drive(map, (char)(letter - 'a' + 'A'), copy);
+    }
+    return 0;
+}
+
+/* The cache is "mtime=<sec>.<nsec>" of the dosdevices directory, then one
+   "<letter>=<path>" line per drive.  It is read into the arena and the
+   drives point into it. */
+static inline int load_drive_map(char const* const name,
+    struct stat const* const st, drive_map* const map)
+{
+    char path[PATH_MAX];
+    int error;
+    int fd;
+    size_t space;
+    char* const content = (char*)arena_peek(&run_arena, 1, &space);
+    ssize_t n;
+    char* line;
+    char* end;
+    bool fresh = false;
+
+    if ((error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+    if (space < 2)
+        return ENOMEM;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+    n = read(fd, content, space - 1);
+    error = n == -1 ? errno : 0;
+    close(fd);
+    if (error != 0)
+        return error;
+    content[n] = '\0';
+    arena_commit(&run_arena, content, (size_t)n + 1);
+
+    for (line = content; *line; line = end)
+    {
+        end = strchr(line, '\n');
+        if (end)
+            *end++ = '\0';
+        else
+            end = line + strlen(line);
+
+        if (strncmp(line, "mtime=", static_strlen("mtime=")) == 0)
+        {
+            char* nsec;
+            fresh = strtoll(line + static_strlen("mtime="), &nsec, 10) ==
+                    (long long)st->st_mtim.tv_sec && *nsec == '.' &&
+                strtol(nsec + 1, 0, 10) == st->st_mtim.tv_nsec;
+        }
+        else if (line[0] >= 'A' && line[0] <= 'Z' && line[1] == '=' &&
+                line[2] == '/' && map->count < DRIVE_COUNT)
+            add_drive(map, line[0], line + 2);
+        else
+            return EINVAL;
+    }
+    return fresh ? 0 : ESTALE;
+}
+
+/* Like the discovery cache, written to a temporary file first so that
+   concurrent handlers never see a partial map. */
+static inline int store_drive_map(char const* const name,
+    struct stat const* const st, drive_map const* const map)
+{
+    char path[PATH_MAX];
+    char temp_path[PATH_MAX];
+    size_t space;
+    char* const content = (char*)arena_peek(&run_arena, 1, &space);
+    size_t size;
+    size_t i;
+    int error;
+    int fd;
+    int len;
+
+    if ((error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+    len = snprintf(temp_path, sizeof(temp_path), "%s.%ld", path,
+        (long)getpid());
+    if (len < 0 || (size_t)len >= sizeof(temp_path))
+        return ENAMETOOLONG;
+
+    len = snprintf(content, space, "mtime=%lld.%09ld\n",
+        (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec);
+    if (len < 0 || (size_t)len >= space)
+        return ENOMEM;
+    size = (size_t)len;
+    for (i = 0; i < map->count; ++i)
+    {
+        dos_drive const* const drive = &map->drives[i];
+
+        len = snprintf(content + size, space - size, "%c=%s\n",
+            drive->letter, drive->length ? drive->unix_path : "/");
+        if (len < 0 || (size_t)len >= space - size)
+            return ENOMEM;
+        size += (size_t)len;
+    }
+
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return errno;
+
+    error = write(fd, content, size) == (ssize_t)size ? 0 : EIO;
+    if (close(fd) == -1 && error == 0)
+        error = errno;
+    if (error == 0 && rename(temp_path, path) == -1)
+        error = errno;
+    if (error != 0)
+        unlink(temp_path);
+    return error;
+}
+
+/* Returns arg itself if it is not a path, or null if the arena is full. */
+static inline char* translate_path(drive_map const* const map,
+    char* const arg)
+{
+    char resolved[PATH_MAX];
+    char const* path;
+    char const* rest;
+    char letter = 'Z';
+    size_t length;
+    size_t i;
+    char* result;
+
+    if (realpath(arg, resolved))
+        path = resolved;
+    else if (arg[0] == '/')
+        path = arg;
+    else
+        return arg;
+
+    rest = path + 1;
+    for (i = 0; i < map->count; ++i)
+    {
+        dos_drive const* const drive = &map->drives[i];
+        char const next = path[drive->length];
+
+        if (strncmp(path, drive->unix_path, drive->length) == 0 &&
+            (next == '/' || next == '\0'))
+        {
+            letter = drive->letter;
+            rest = next ? &path[drive->length + 1] : &path[drive->length];
+            break;
+        }
+    }
+
+    length = strlen(rest);
+    if (!(result = (char*)arena_alloc(&run_arena, length + 4, 1)))
+        return 0;
+    result[0] = letter;
+    result[1] = ':';
+    result[2] = '\\';
+    for (i = 0; i <= length; ++i)
+        result[3 + i] = rest[i] == '/' ? '\\' : rest[i];
+    return result;
+}
+
+/* Loads the drives of the prefix that envp belongs to, from the cache if
+   dosdevices has not changed since. */
+static int load_prefix_drives(char* const envp[], drive_map* const map)
+{
+    char prefix[PATH_MAX];
+    char dosdevices[PATH_MAX];
+    char name[64];
+    struct stat prefix_st;
+    struct stat st;
+    size_t mark;
+    int error;
+    int len;
+
+    if ((error = prefix_path(envp, prefix, sizeof(prefix))) != 0)
+        return error;
+    len = snprintf(dosdevices, sizeof(dosdevices), "%s/dosdevices", prefix);
+    if (len < 0 || (size_t)len >= sizeof(dosdevices))
+        return ENAMETOOLONG;
+    if (stat(prefix, &prefix_st) == -1 || stat(dosdevices, &st) == -1)
+        return errno;
+
+    /* Named after the prefix like its wineserver directory, so that every
+       prefix has its own map. */
+    len = snprintf(name, sizeof(name), "dosdevices-%llx-%llx",
+        (unsigned long long)prefix_st.st_dev,
+        (unsigned long long)prefix_st.st_ino);
+    if (len < 0 || (size_t)len >= sizeof(name))
+        return ENAMETOOLONG;
+
+    mark = arena_mark(&run_arena);
+    map->count = 0;
+    if (load_drive_map(name, &st, map) != 0)
+    {
+        arena_release(&run_arena, mark);
+        map->count = 0;
+        if ((error = scan_dosdevices(dosdevices, map)) != 0)
+            return error;
+        store_drive_map(name, &st, map);
+    }
+    return 0;
+}
+
+int translate_paths(char* const envp[], char* argv[], char*** const out_argv)
+{
+    drive_map map;
+    size_t argc;
+    size_t i;
+    char** result;
+    int error;
+
+    if ((error = load_prefix_drives(envp, &map)) != 0)
+        return error;
+
+    for (argc = 0; argv[argc]; ++argc);
+    if (!(result = arena_new(&run_arena, char*, argc + 1)))
+        return ENOMEM;
+    result[0] = argv[0];
+    for (i = 1; i < argc; ++i)
+        if (!(result[i] = translate_path(&map, argv[i])))
+            return ENOMEM;
+    result[argc] = 0;
+
+    *out_argv = result;
+    return 0;
+}
+
+int windows_to_unix_path(char* const envp[], char const* const windows_path,
+    char** const out_path)
+{
+    drive_map map;
+    char const letter = (char)(windows_path[0] & ~0x20);
+    dos_drive const* drive = 0;
+    size_t length;
+    size_t i;
+    char* result;
+    int error;
+
+    if (letter < 'A' || letter > 'Z' || windows_path[1] != ':' ||
+        windows_path[2] != '\\')
+        return EINVAL;
+    if ((error = load_prefix_drives(envp, &map)) != 0)
+        return error;
+
+    for (i = 0; i < map.count; ++i)
+        if (map.drives[i].letter == letter)
+            drive = &map.drives[i];
+    if (!drive)
+        return ENOENT;
+
+    /* The backslash after the drive becomes the separator after its
+       path. */
+    length = strlen(&windows_path[2]);
+    if (!(result = (char*)arena_alloc(&run_arena, drive->length + length + 1,
+            1)))
+        return ENOMEM;
+    memcpy(result, drive->unix_path, drive->length);
+    for (i = 0; i <= length; ++i)
+        result[drive->length + i] =
+            windows_path[2 + i] == '\\' ? '/' : windows_path[2 + i];
+
+    *out_path = result;
+    return 0;
+}
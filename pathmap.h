@@ -0,0 +1,51 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#pragma once
+#ifndef __PATHMAP_H__
+#define __PATHMAP_H__
+
+#include <stddef.h> /* size_t */
+
+/* The prefix directory envp belongs to, WINEPREFIX or $HOME/.wine. */
+int prefix_path(char* const envp[], char* buffer, size_t buffer_size);
+
+/* Rewrites the path arguments of argv into Windows paths for the prefix that
+   envp belongs to (WINEPREFIX, default $HOME/.wine), so that wine does not
+   have to translate them itself.  Arguments that are absolute paths, or
+   relative paths of existing files, are mapped through the longest matching
+   drive in the prefix's dosdevices directory, anything else is kept as is.
+   Paths outside every drive get Z: semantics.
+
+   The drive mapping is kept in the runtime directory and only read from
+   dosdevices again when that directory changes.  On success *out_argv is a
+   new vector in the run arena with argv[0] copied over. */
+int translate_paths(char* const envp[], char* argv[], char*** out_argv);
+
+/* The reverse, for a "X:\..." path inside the same prefix.  The result is
+   in the run arena, ENOENT means that the drive does not exist. */
+int windows_to_unix_path(char* const envp[], char const* windows_path,
+    char** out_path);
+
+#endif
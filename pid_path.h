@@ -0,0 +1,76 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __PID_PATH_H__
+#define __PID_PATH_H__
+
+#include "inline.h" /* inline */
+#include "static_string.h" /* static_strlen */
+
+#include <stddef.h> /* size_t */
+#include <string.h> /* memcpy */
+#include <sys/types.h> /* pid_t */
+
+/* "<pid>/<file>" relative to the procfs directory, so that files of a process
+   can be opened without opening its directory first. */
+typedef struct pid_path {
+    char path[3 * sizeof(pid_t) + 2 + 32];
+    size_t length; /* of "<pid>/" */
+} pid_path;
+
+static inline void pid_path_init(pid_path* const p, pid_t pid)
+{
+    char digits[3 * sizeof(pid_t)];
+    size_t n = 0;
+
+    do {
+        digits[n++] = (char)('0' + pid % 10);
+        pid /= 10;
+    } while (pid);
+
+    p->length = 0;
+    while (n)
+        p->path[p->length++] = digits[--n];
+    p->path[p->length++] = '/';
+    p->path[p->length] = '\0';
+}
+
+/* Returns "<pid>/" */
+static inline char const* pid_path_dir(pid_path* const p)
+{
+    p->path[p->length] = '\0';
+    return p->path;
+}
+
+static inline char const* pid_path_file_n(pid_path* const p,
+    char const* const name, size_t const length)
+{
+    memcpy(&p->path[p->length], name, length + 1);
+    return p->path;
+}
+
+#define pid_path_file(p, name) \
+    pid_path_file_n((p), (name), static_strlen((name)))
+
+#endif
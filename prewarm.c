@@ -0,0 +1,178 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _DEFAULT_SOURCE /* MAP_POPULATE */
+
+#include "prewarm.h"
+#include "inline.h" /* inline */
+#include "pathmap.h" /* prefix_path */
+
+#include <errno.h> /* ENAMETOOLONG, ENOENT */
+#include <fcntl.h> /* O_CLOEXEC, O_RDONLY, POSIX_FADV_WILLNEED, open,
+                      posix_fadvise */
+#include <limits.h> /* PATH_MAX */
+#include <stdio.h> /* snprintf */
+#include <string.h> /* memcpy, strcmp, strlen, strrchr */
+#include <sys/mman.h> /* MAP_FAILED, MAP_POPULATE, MAP_SHARED, PROT_READ,
+                         mlock, mmap, munmap */
+#include <sys/stat.h> /* S_ISREG, fstat, struct stat */
+#include <unistd.h> /* close */
+
+/* Relative to the installation root of the wine build, the directory above
+   its bin.  Builds differ in layout, files that do not exist are skipped. */
+static char const* const build_files[] = {
+    "bin/wine",
+    "bin/wine-preloader",
+    "bin/wine64",
+    "bin/wine64-preloader",
+    "lib/wine/x86_64-unix/ntdll.so",
+    "lib/wine/x86_64-windows/ntdll.dll",
+    "lib/wine/x86_64-windows/kernel32.dll",
+    "lib/wine/x86_64-windows/kernelbase.dll",
+    "lib/wine/i386-windows/ntdll.dll",
+    "lib/wine/i386-windows/kernel32.dll",
+    "lib/wine/i386-windows/kernelbase.dll",
+    /* Proton and some distributions. */
+    "lib64/wine/x86_64-unix/ntdll.so",
+    "lib64/wine/x86_64-windows/ntdll.dll",
+    "lib64/wine/x86_64-windows/kernel32.dll",
+    "lib64/wine/x86_64-windows/kernelbase.dll",
+    /* Builds before the PE conversion. */
+    "lib/wine/ntdll.dll.so",
+    "lib/wine/kernel32.dll.so",
+    "lib/wine/kernelbase.dll.so",
+    0
+};
+
+/* Relative to the prefix. */
+static char const* const prefix_files[] = {
+    "drive_c/windows/system32/ntdll.dll",
+    "drive_c/windows/system32/kernel32.dll",
+    "drive_c/windows/system32/kernelbase.dll",
+    "drive_c/windows/syswow64/ntdll.dll",
+    "drive_c/windows/syswow64/kernel32.dll",
+    "drive_c/windows/syswow64/kernelbase.dll",
+    0
+};
+
+prewarm_mode parse_prewarm_mode(char const* const name)
+{
+    if (!name)
+        return PREWARM_NONE;
+    if (strcmp(name, "lock") == 0)
+        return PREWARM_LOCK;
+    return PREWARM_NONE;
+}
+
+/* Locking that fails, over RLIMIT_MEMLOCK for example, still leaves the
+   pages populated and mapped.  Past PREWARM_MAX_FILES, the reads are only
+   started. */
+static inline void prewarm_file(prewarm_mode const mode,
+    char const* const path, prewarm_set* const set, size_t* const out_bytes)
+{
+    int const fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    void* address;
+
+    if (fd == -1)
+        return;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+    *out_bytes += (size_t)st.st_size;
+
+    if (mode == PREWARM_LOCK && set->count < PREWARM_MAX_FILES)
+    {
+        address = mmap(0, (size_t)st.st_size, PROT_READ,
+            MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            mlock(address, (size_t)st.st_size);
+            set->mappings[set->count].address = address;
+            set->mappings[set->count++].size = (size_t)st.st_size;
+            close(fd);
+            return;
+        }
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+/* base has room for PATH_MAX bytes, the names are appended at base_length. */
+static inline void prewarm_list(prewarm_mode const mode, char* const base,
+    size_t const base_length, char const* const* names,
+    prewarm_set* const set, size_t* const out_bytes)
+{
+    for (; *names; ++names)
+    {
+        size_t const length = strlen(*names) + 1;
+
+        if (base_length + length > PATH_MAX)
+            continue;
+        memcpy(&base[base_length], *names, length);
+        prewarm_file(mode, base, set, out_bytes);
+    }
+}
+
+int prewarm_files(prewarm_mode const mode, char const* const loader_path,
+    char* const envp[], prewarm_set* const set, size_t* const out_bytes)
+{
+    char path[PATH_MAX];
+    char const* bin;
+    size_t length;
+    int error;
+
+    *out_bytes = 0;
+    if (mode == PREWARM_NONE)
+        return 0;
+
+    /* /usr/bin/wine is in the build rooted at /usr/. */
+    bin = strrchr(loader_path, '/');
+    while (bin && bin > loader_path && bin[-1] != '/')
+        --bin;
+    if (!bin || bin == loader_path)
+        return ENOENT;
+    length = (size_t)(bin - loader_path);
+    if (length >= sizeof(path))
+        return ENAMETOOLONG;
+    memcpy(path, loader_path, length);
+    prewarm_list(mode, path, length, build_files, set, out_bytes);
+
+    if ((error = prefix_path(envp, path, sizeof(path) - 1)) != 0)
+        return error;
+    length = strlen(path);
+    path[length++] = '/';
+    prewarm_list(mode, path, length, prefix_files, set, out_bytes);
+    return 0;
+}
+
+void release_prewarm(prewarm_set* const set)
+{
+    size_t i;
+
+    for (i = 0; i < set->count; ++i)
+        munmap(set->mappings[i].address, set->mappings[i].size);
+    set->count = 0;
+}
@@ -0,0 +1,62 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __PREWARM_H__
+#define __PREWARM_H__
+
+#include <stddef.h> /* size_t */
+
+/* OSU_HANDLER_PREWARM has the daemon keep the files a new wine client
+   starts from in the page cache: the loader and preloader, ntdll, kernel32
+   and kernelbase of the wine build the loader belongs to, and their copies
+   in the prefix. */
+typedef enum prewarm_mode {
+    PREWARM_NONE,
+    PREWARM_LOCK /* map and mlock the files until release_prewarm */
+} prewarm_mode;
+
+/* Maps "lock" to PREWARM_LOCK, anything else to PREWARM_NONE. */
+prewarm_mode parse_prewarm_mode(char const* name);
+
+#define PREWARM_MAX_FILES 32
+
+typedef struct prewarm_mapping {
+    void* address;
+    size_t size;
+} prewarm_mapping;
+
+typedef struct prewarm_set {
+    size_t count;
+    prewarm_mapping mappings[PREWARM_MAX_FILES];
+} prewarm_set;
+
+/* loader_path is the wine loader, envp the environment of the client.
+   Files that do not fit into the set or cannot be mapped are only read
+   ahead.  *out_bytes is the size of all files found. */
+int prewarm_files(prewarm_mode mode, char const* loader_path,
+    char* const envp[], prewarm_set* set, size_t* out_bytes);
+/* Unmaps what PREWARM_LOCK mapped into set. */
+void release_prewarm(prewarm_set* set);
+
+#endif
@@ -21,41 +21,119 @@
  *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
  */
 
-#define _POSIX_C_SOURCE 200809L /* dirfd */
-#define _DEFAULT_SOURCE /* DT_DIR, DT_UNKNOWN, dirfd */
+#define _GNU_SOURCE /* DT_DIR, DT_UNKNOWN, SYS_getdents64, SYS_pidfd_getfd,
+                       SYS_pidfd_open, struct ucred */
 
-#include "is_number.h" /* is_number */
+#include "procdir.h"
+#include "bool.h" /* bool */
+#include "inline.h" /* inline */
+#include "is_number.h" /* is_digit */
+#include "pid_path.h" /* pid_path, pid_path_file, pid_path_init */
+#include "static_string.h" /* static_startswith, static_strlen */
 
-#include <dirent.h> /* DIR, DT_DIR, DT_UNKNOWN, _DIRENT_HAVE_D_TYPE, closedir,
-                       struct dirent, dirfd, opendir, readdir */
-#include <errno.h> /* ENOMEM, errno */
-#include <stdlib.h> /* free, malloc */
+#include <dirent.h> /* DT_DIR, DT_UNKNOWN */
+#include <errno.h> /* EINVAL, ENOENT, ENOSPC, ENOTSUP, ESRCH, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_DIRECTORY, O_RDONLY, open, openat */
+#include <limits.h> /* PATH_MAX */
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uintptr_t */
+#include <stdio.h> /* snprintf */
+#include <stdlib.h> /* getenv */
+#include <string.h> /* memchr, memcmp, memcpy, strcmp, strlen, strstr */
+#include <sys/socket.h> /* SOL_SOCKET, SO_PEERCRED, getsockopt, socklen_t,
+                           struct ucred */
+#include <sys/syscall.h> /* SYS_getdents64, SYS_pidfd_getfd, SYS_pidfd_open */
+#include <sys/types.h> /* ssize_t */
+#include <unistd.h> /* close, getpid, getsid, getuid, read, readlinkat,
+                       syscall */
 
+/* The default, OSU_HANDLER_PROCFS can point the scan at another tree at
+   runtime, e.g. a benchmark fixture. */
 #ifndef PROCFS_PATH
 #define PROCFS_PATH "/proc"
 #endif
 
+#ifndef CGROUPFS_PATH
+#define CGROUPFS_PATH "/sys/fs/cgroup"
+#endif
+
+/* Nesting limit for the cgroup walk, user slices are rarely deeper than 4. */
+#define CGROUP_MAX_DEPTH 16
+
+/* The kernel's record layout, glibc does not declare it everywhere. */
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* Lives at the start of the caller's buffer.  The remainder receives either
+   directory entries (full scan) or the collected PID list (cgroup and tree
+   strategies). */
 typedef struct procdir_struct {
-    DIR* dirptr;
+    procdir_strategy requested;
+    procdir_strategy current;
+    pid_t server_pid; /* for PROCDIR_WINESERVER */
     int dirfd;
+    bool eof;
+    bool collected;
+    bool cgroup_complete;
+    char* entries;
+    size_t entries_size;
+    size_t pos;
+    size_t end;
 } procdir_struct;
 
-int open_procdir(procdir_struct** const out_pdhandle)
+#define PROCDIR_ALIGN 8
+
+procdir_strategy parse_procdir_strategy(char const* const name)
+{
+    if (!name || !name[0] || strcmp(name, "full") == 0)
+        return PROCDIR_FULL;
+    if (strcmp(name, "cgroup") == 0)
+        return PROCDIR_CGROUP;
+    if (strcmp(name, "tree") == 0)
+        return PROCDIR_TREE;
+    if (strcmp(name, "auto") == 0)
+        return PROCDIR_AUTO;
+    return PROCDIR_FULL;
+}
+
+int open_procdir(procdir_struct** const out_pdhandle,
+    procdir_strategy const strategy, void* const buffer,
+    size_t const buffer_size)
 {
+    uintptr_t const start = ((uintptr_t)buffer + PROCDIR_ALIGN - 1) &
+        ~(uintptr_t)(PROCDIR_ALIGN - 1);
+    size_t const header_size = (sizeof(procdir_struct) + PROCDIR_ALIGN - 1) &
+        ~(size_t)(PROCDIR_ALIGN - 1);
     procdir_struct* p;
+    char const* procfs;
 
-    p = (procdir_struct*)malloc(sizeof(procdir_struct));
-    if (!p)
-        return ENOMEM;
+    if (buffer_size < (start - (uintptr_t)buffer) + header_size + 1024)
+        return EINVAL;
 
-    p->dirptr = opendir(PROCFS_PATH);
-    p->dirfd = -1;
+    p = (procdir_struct*)start;
+    p->requested = strategy;
+    /* Cheapest first. */
+    p->current = strategy == PROCDIR_AUTO ? PROCDIR_TREE : strategy;
+    p->server_pid = 0;
+    p->entries = (char*)(start + header_size);
+    p->entries_size = buffer_size - (start - (uintptr_t)buffer) - header_size;
+    p->pos = 0;
+    p->end = 0;
+    p->eof = false;
+    p->collected = false;
+    p->cgroup_complete = false;
 
-    if (!p->dirptr)
-    {
-        free(p);
+    procfs = getenv("OSU_HANDLER_PROCFS");
+    if (!procfs || !procfs[0])
+        procfs = PROCFS_PATH;
+    p->dirfd = open(procfs, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (p->dirfd == -1)
         return errno;
-    }
 
     *out_pdhandle = p;
     return 0;
@@ -63,35 +141,494 @@ int open_procdir(procdir_struct** const out_pdhandle)
 
 int procdir_dirfd(procdir_struct* const p)
 {
-    if (p->dirfd == -1)
-        p->dirfd = dirfd(p->dirptr);
-
     return p->dirfd;
 }
 
-#ifdef _DIRENT_HAVE_D_TYPE
-#define may_be_dir(dent) \
-    ((dent)->d_type == DT_DIR || (dent)->d_type == DT_UNKNOWN)
-#define is_process_dir(dent) (may_be_dir((dent)) && is_number((dent)->d_name))
-#else
-#define is_process_dir(dent) (is_number((dent)->d_name))
-#endif
+void procdir_start_at_wineserver(procdir_struct* const p,
+    pid_t const server_pid)
+{
+    p->current = PROCDIR_WINESERVER;
+    p->server_pid = server_pid;
+    p->collected = false;
+}
 
-int procdir_next_process(procdir_struct* const p, struct dirent** const out_dent)
+static inline bool parse_pid(char const* name, pid_t* const out_pid)
 {
-    struct dirent* dent;
+    pid_t pid = 0;
 
-    errno = 0;
+    if (!is_digit(*name))
+        return false;
     do {
-        dent = readdir(p->dirptr);
-    } while (errno == 0 && dent && !is_process_dir(dent));
+        pid = pid * 10 + (*name - '0');
+    } while (is_digit(*++name));
+
+    *out_pid = pid;
+    return *name == '\0';
+}
+
+static int next_full(procdir_struct* const p, pid_t* const pids,
+    size_t const max_count, size_t* const out_count)
+{
+    size_t count = 0;
+
+    while (count < max_count)
+    {
+        struct linux_dirent64 const* dent;
+
+        if (p->pos >= p->end)
+        {
+            long n;
+
+            if (p->eof || count)
+                break;
+
+            n = syscall(SYS_getdents64, p->dirfd, p->entries, p->entries_size);
+            if (n == -1)
+                return errno;
+            if (n == 0)
+            {
+                p->eof = true;
+                break;
+            }
+            p->pos = 0;
+            p->end = (size_t)n;
+        }
+
+        dent = (struct linux_dirent64 const*)&p->entries[p->pos];
+        p->pos += dent->d_reclen;
+
+        if (dent->d_type != DT_DIR && dent->d_type != DT_UNKNOWN)
+            continue;
+        if (parse_pid(dent->d_name, &pids[count]))
+            ++count;
+    }
+
+    *out_count = count;
+    return 0;
+}
+
+/* The cgroup and tree strategies collect their PIDs up front into the
+   entries area, p->end counts PIDs there. */
+#define collected_pids(p) ((pid_t*)(p)->entries)
+#define collected_capacity(p) ((p)->entries_size / sizeof(pid_t))
+
+/* Appends the whitespace separated PIDs in the file at dirfd/path. */
+static int read_pid_list(procdir_struct* const p, int const dirfd,
+    char const* const path)
+{
+    char buf[4096];
+    int fd;
+    ssize_t n;
+    pid_t pid = 0;
+    bool in_number = false;
+    int error = 0;
+
+    fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        ssize_t i;
+
+        for (i = 0; i < n; ++i)
+        {
+            if (is_digit(buf[i]))
+            {
+                pid = pid * 10 + (buf[i] - '0');
+                in_number = true;
+                continue;
+            }
+            if (!in_number)
+                continue;
+            if (p->end == collected_capacity(p))
+            {
+                error = ENOSPC;
+                goto out;
+            }
+            collected_pids(p)[p->end++] = pid;
+            pid = 0;
+            in_number = false;
+        }
+    }
+    if (n == -1)
+        error = errno;
+    else if (in_number)
+    {
+        if (p->end == collected_capacity(p))
+            error = ENOSPC;
+        else
+            collected_pids(p)[p->end++] = pid;
+    }
+
+out:
+    close(fd);
+    return error;
+}
+
+static int walk_cgroup(procdir_struct* const p, int const dirfd,
+    unsigned const depth)
+{
+    char buf[2048];
+    long n;
+    int error;
+
+    if ((error = read_pid_list(p, dirfd, "cgroup.procs")) != 0)
+        return error;
+    if (depth == CGROUP_MAX_DEPTH)
+        return ENOTSUP;
+
+    while ((n = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0)
+    {
+        long pos = 0;
+
+        while (pos < n)
+        {
+            struct linux_dirent64 const* const dent =
+                (struct linux_dirent64 const*)&buf[pos];
+            int subdirfd;
+
+            pos += dent->d_reclen;
+            if (dent->d_type != DT_DIR || dent->d_name[0] == '.')
+                continue;
+
+            subdirfd = openat(dirfd, dent->d_name,
+                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (subdirfd == -1)
+            {
+                /* Removed while we were walking. */
+                if (errno == ENOENT)
+                    continue;
+                return errno;
+            }
+            error = walk_cgroup(p, subdirfd, depth + 1);
+            close(subdirfd);
+            if (error != 0)
+                return error;
+        }
+    }
+    return n == -1 ? errno : 0;
+}
+
+/* Finds "/user.slice/user-<uid>.slice" in our cgroup v2 path. */
+static int user_slice_path(procdir_struct* const p, char* const path,
+    size_t const path_size)
+{
+    char buf[1024];
+    char slice[64];
+    int fd;
+    ssize_t n;
+    char const* line;
+    char const* found;
+    char const* end;
+    int len;
+
+    fd = openat(p->dirfd, "self/cgroup", O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return n == 0 ? ENOTSUP : errno;
+    buf[n] = '\0';
+
+    /* Only the unified hierarchy has the "0::" line. */
+    line = strstr(buf, "0::/");
+    if (!line || (line != buf && line[-1] != '\n'))
+        return ENOTSUP;
+    line += static_strlen("0::");
+
+    snprintf(slice, sizeof(slice), "/user-%lu.slice", (unsigned long)getuid());
+    found = strstr(line, slice);
+    end = (char const*)memchr(line, '\n', (size_t)(&buf[n] - line));
+    if (!found || (end && found > end))
+        return ENOTSUP;
+
+    len = snprintf(path, path_size, CGROUPFS_PATH "%.*s",
+        (int)(found - line + strlen(slice)), line);
+    if (len < 0 || (size_t)len >= path_size)
+        return ENOTSUP;
+    return 0;
+}
 
-    *out_dent = dent;
-    return errno;
+static int collect_cgroup(procdir_struct* const p)
+{
+    char path[PATH_MAX];
+    int dirfd;
+    int error;
+
+    if ((error = user_slice_path(p, path, sizeof(path))) != 0)
+        return error;
+
+    dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1)
+        return errno;
+    error = walk_cgroup(p, dirfd, 0);
+    close(dirfd);
+
+    p->cgroup_complete = error == 0;
+    return error;
+}
+
+/* Breadth-first walk from the session leader, or from this process for
+   PROCDIR_DESCENDANTS; the collected list doubles as the queue. */
+static int collect_tree(procdir_struct* const p)
+{
+    pid_t const root =
+        p->current == PROCDIR_DESCENDANTS ? getpid() : getsid(0);
+    size_t index;
+    int error;
+
+    if (root == -1)
+        return errno;
+
+    collected_pids(p)[p->end++] = root;
+    for (index = 0; index < p->end; ++index)
+    {
+        pid_path path;
+        int task_dirfd;
+        char buf[1024];
+        long n;
+
+        pid_path_init(&path, collected_pids(p)[index]);
+        task_dirfd = openat(p->dirfd, pid_path_file(&path, "task"),
+            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (task_dirfd == -1)
+        {
+            if (errno == ENOENT && index != 0)
+                continue;
+            return errno;
+        }
+
+        while ((n = syscall(SYS_getdents64, task_dirfd, buf, sizeof(buf))) > 0)
+        {
+            long pos = 0;
+
+            while (pos < n)
+            {
+                struct linux_dirent64 const* const dent =
+                    (struct linux_dirent64 const*)&buf[pos];
+                char children[3 * sizeof(pid_t) + sizeof("/children")];
+                size_t const name_length = strlen(dent->d_name);
+                pid_t tid;
+
+                pos += dent->d_reclen;
+                if (!parse_pid(dent->d_name, &tid) ||
+                    name_length + sizeof("/children") > sizeof(children))
+                    continue;
+
+                memcpy(children, dent->d_name, name_length);
+                memcpy(&children[name_length], "/children",
+                    sizeof("/children"));
+
+                error = read_pid_list(p, task_dirfd, children);
+                /* No CONFIG_PROC_CHILDREN, or the task is gone. */
+                if (error == ENOENT && index == 0)
+                {
+                    close(task_dirfd);
+                    return ENOTSUP;
+                }
+                if (error != 0 && error != ENOENT && error != ESRCH)
+                {
+                    close(task_dirfd);
+                    return error;
+                }
+            }
+        }
+        close(task_dirfd);
+    }
+    return 0;
+}
+
+static inline bool is_collected(procdir_struct const* const p,
+    pid_t const pid)
+{
+    size_t i;
+
+    for (i = 0; i < p->end; ++i)
+        if (collected_pids(p)[i] == pid)
+            return true;
+    return false;
+}
+
+/* Collects the peer of every socket the wineserver has open, apart from its
+   own listening socket: the server accepts one connection per client
+   process, and the peer credentials name the process that connected. */
+static int collect_wineserver(procdir_struct* const p)
+{
+    pid_path path;
+    int pidfd;
+    int fd_dirfd;
+    char buf[1024];
+    long n = 0;
+    int error = 0;
+
+    pidfd = (int)syscall(SYS_pidfd_open, p->server_pid, 0);
+    if (pidfd == -1)
+        return errno;
+
+    pid_path_init(&path, p->server_pid);
+    fd_dirfd = openat(p->dirfd, pid_path_file(&path, "fd"),
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd_dirfd == -1)
+    {
+        error = errno;
+        close(pidfd);
+        return error;
+    }
+
+    while (error == 0 &&
+        (n = syscall(SYS_getdents64, fd_dirfd, buf, sizeof(buf))) > 0)
+    {
+        long pos = 0;
+
+        while (pos < n)
+        {
+            struct linux_dirent64 const* const dent =
+                (struct linux_dirent64 const*)&buf[pos];
+            char link[32];
+            ssize_t link_len;
+            pid_t server_fd;
+            int fd;
+            struct ucred cred;
+            socklen_t cred_size = sizeof(cred);
+
+            pos += dent->d_reclen;
+            if (!parse_pid(dent->d_name, &server_fd))
+                continue;
+            link_len = readlinkat(fd_dirfd, dent->d_name, link, sizeof(link));
+            if (link_len == -1 ||
+                !static_startswith((size_t)link_len, link, "socket:"))
+                continue;
+
+            fd = (int)syscall(SYS_pidfd_getfd, pidfd, server_fd, 0);
+            if (fd == -1)
+            {
+                /* Closed in the meantime. */
+                if (errno == EBADF)
+                    continue;
+                error = errno;
+                break;
+            }
+            if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred,
+                    &cred_size) == 0 &&
+                cred.pid > 0 && cred.pid != p->server_pid &&
+                !is_collected(p, cred.pid))
+            {
+                if (p->end == collected_capacity(p))
+                    error = ENOSPC;
+                else
+                    collected_pids(p)[p->end++] = cred.pid;
+            }
+            close(fd);
+            if (error != 0)
+                break;
+        }
+    }
+    if (n == -1 && error == 0)
+        error = errno;
+
+    close(fd_dirfd);
+    close(pidfd);
+    return error;
+}
+
+static int next_collected(procdir_struct* const p, pid_t* const pids,
+    size_t const max_count, size_t* const out_count)
+{
+    size_t count;
+
+    if (!p->collected)
+    {
+        int error;
+
+        p->collected = true;
+        p->pos = 0;
+        p->end = 0;
+        if (p->current == PROCDIR_WINESERVER)
+            error = collect_wineserver(p);
+        else if (p->current == PROCDIR_CGROUP)
+            error = collect_cgroup(p);
+        else
+            error = collect_tree(p);
+        if (error != 0)
+        {
+            p->end = 0;
+            return error;
+        }
+    }
+
+    count = p->end - p->pos;
+    if (count > max_count)
+        count = max_count;
+    memcpy(pids, &collected_pids(p)[p->pos], sizeof(pid_t) * count);
+    p->pos += count;
+
+    *out_count = count;
+    return 0;
+}
+
+/* Moves an automatic enumeration on to the next more expensive strategy.
+   On systemd hosts every process of ours is in the user slice, so the full
+   scan only runs if the slice could not be walked.  A cgroup or tree that
+   has more PIDs than fit the buffer is scanned in full by any strategy, as
+   nothing has been returned from it yet and the full scan streams.  The
+   clients of a wineserver are all processes in its prefix, once they were
+   listed there is nothing left to enumerate.  A cgroup or tree that was
+   asked for explicitly but is not available on this host falls back to the
+   full scan as well, instead of finding nothing. */
+static inline bool advance_strategy(procdir_struct* const p, int const error)
+{
+    bool const collected = p->current == PROCDIR_CGROUP ||
+        p->current == PROCDIR_TREE;
+    bool const overflow = collected && error == ENOSPC;
+    bool const unavailable = collected && p->requested != PROCDIR_AUTO &&
+        (error == ENOTSUP || error == ENOENT);
+
+    if (p->current == PROCDIR_WINESERVER ? error == 0 :
+        p->requested != PROCDIR_AUTO && !overflow && !unavailable)
+        return false;
+
+    p->collected = false;
+    p->pos = 0;
+    p->end = 0;
+
+    if (p->current == PROCDIR_WINESERVER)
+        p->current = p->requested == PROCDIR_AUTO ? PROCDIR_TREE :
+            p->requested;
+    else if (overflow || unavailable)
+        p->current = PROCDIR_FULL;
+    else if (p->current == PROCDIR_TREE)
+        p->current = PROCDIR_CGROUP;
+    else if (p->current == PROCDIR_CGROUP && !p->cgroup_complete)
+        p->current = PROCDIR_FULL;
+    else
+        return false;
+    return true;
+}
+
+int procdir_next_processes(procdir_struct* const p, pid_t* const pids,
+    size_t const max_count, size_t* const out_count)
+{
+    int error;
+
+    for (;;)
+    {
+        if (p->current == PROCDIR_FULL)
+            return next_full(p, pids, max_count, out_count);
+
+        error = next_collected(p, pids, max_count, out_count);
+        if (error == 0 && *out_count)
+            return 0;
+        if (!advance_strategy(p, error))
+        {
+            *out_count = 0;
+            return error;
+        }
+    }
 }
 
 void close_procdir(procdir_struct* const p)
 {
-    closedir(p->dirptr);
-    free(p);
+    close(p->dirfd);
 }
@@ -25,13 +25,40 @@
 #ifndef __PROCDIR_H__
 #define __PROCDIR_H__
 
-#include <dirent.h> /* struct dirent */
+#include <stddef.h> /* size_t */
+#include <sys/types.h> /* pid_t */
 
 typedef struct procdir_struct* procdir_handle;
 
-int open_procdir(procdir_handle* out_pdhandle);
+typedef enum procdir_strategy {
+    PROCDIR_FULL, /* every numeric entry of /proc */
+    PROCDIR_CGROUP, /* cgroup.procs of our systemd user slice */
+    PROCDIR_TREE, /* descendants of our session leader */
+    PROCDIR_AUTO, /* tree, then cgroup, then full */
+    PROCDIR_DESCENDANTS, /* descendants of this process */
+    PROCDIR_WINESERVER /* clients of a wineserver, see
+                          procdir_start_at_wineserver */
+} procdir_strategy;
+
+/* Maps "full", "cgroup", "tree" and "auto" to a strategy, anything else to
+   PROCDIR_FULL. */
+procdir_strategy parse_procdir_strategy(char const* name);
+
+/* A reasonable size for the buffer passed to open_procdir.  The handle and
+   the raw directory entries live in that buffer, nothing is allocated. */
+#define PROCDIR_BUFFER_SIZE (32 * 1024)
+
+int open_procdir(procdir_handle* out_pdhandle, procdir_strategy strategy,
+    void* buffer, size_t buffer_size);
 int procdir_dirfd(procdir_handle);
-int procdir_next_process(procdir_handle, struct dirent** out_dent);
+/* Makes the enumeration return only the processes connected to the
+   wineserver server_pid.  If they cannot be listed, e.g. because reading a
+   descriptor of the server with pidfd_getfd needs ptrace access, it goes on
+   with the strategy it was opened with instead. */
+void procdir_start_at_wineserver(procdir_handle, pid_t server_pid);
+/* Stores up to max_count PIDs, *out_count is 0 once all were returned. */
+int procdir_next_processes(procdir_handle, pid_t* pids, size_t max_count,
+    size_t* out_count);
 void close_procdir(procdir_handle);
 
 #endif
@@ -0,0 +1,266 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#define _GNU_SOURCE /* POSIX_SPAWN_SETSID */
+
+#include "relay.h"
+#include "config.h" /* config_ulong */
+#include "inline.h" /* inline */
+#include "ipc.h" /* ipc_connect, ipc_recv_status, ipc_send_strings */
+#include "runtime_dir.h" /* runtime_path */
+
+#include <errno.h> /* ECONNREFUSED, ENAMETOOLONG, ENOENT, EWOULDBLOCK, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_CREAT, O_RDWR, open */
+#include <limits.h> /* PATH_MAX */
+#include <spawn.h> /* POSIX_SPAWN_SETSID, posix_spawn,
+                      posix_spawn_file_actions_*, posix_spawnattr_* */
+#include <stdio.h> /* snprintf */
+#include <stdlib.h> /* getenv */
+#include <sys/file.h> /* LOCK_EX, LOCK_NB, LOCK_SH, LOCK_UN, flock */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, nanosleep,
+                     struct timespec */
+#include <unistd.h> /* STDERR_FILENO, STDIN_FILENO, STDOUT_FILENO, close,
+                       getcwd */
+
+/* "relay-<pid>-<starttime>.sock" */
+#define RELAY_SOCKET_NAME_SIZE 64
+
+/* How long a started relay gets to come up, and how often it is tried
+   meanwhile. */
+#define RELAY_START_MS 2000
+#define RELAY_RETRY_MS 10
+
+static inline int relay_name(char* const buffer, pid_t const pid,
+    unsigned long long const starttime, char const* const suffix)
+{
+    int const n = snprintf(buffer, RELAY_SOCKET_NAME_SIZE,
+        "relay-%ld-%llu.%s", (long)pid, starttime, suffix);
+
+    return n < 0 || n >= RELAY_SOCKET_NAME_SIZE ? ENAMETOOLONG : 0;
+}
+
+static inline int relay_socket_name(char* const buffer, pid_t const pid,
+    unsigned long long const starttime)
+{
+    return relay_name(buffer, pid, starttime, "sock");
+}
+
+static inline unsigned long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 +
+        (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+static inline void sleep_ms(unsigned long const ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ms / 1000);
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep(&ts, 0);
+}
+
+static inline char const* relay_program(void)
+{
+    char const* const program = getenv("OSU_HANDLER_RELAY");
+    return program && program[0] ? program : 0;
+}
+
+bool relay_enabled(void)
+{
+    return relay_program() != 0;
+}
+
+int send_to_relay(pid_t const pid, unsigned long long const starttime,
+    char* argv[])
+{
+    char name[RELAY_SOCKET_NAME_SIZE];
+    char cwd[PATH_MAX];
+    char* argv0;
+    size_t argc;
+    int error;
+    int fd;
+    int status;
+
+    if ((error = relay_socket_name(name, pid, starttime)) != 0)
+        return error;
+    if (!getcwd(cwd, sizeof(cwd)))
+        return errno;
+    if ((error = ipc_connect(name, &fd)) != 0)
+        return error;
+
+    for (argc = 0; argv[argc]; ++argc);
+
+    /* argv[0] is replaced by the working directory, like for the daemon. */
+    argv0 = argv[0];
+    argv[0] = cwd;
+    if ((error = ipc_send_strings(fd, argc, (char const* const*)argv)) == 0)
+        error = ipc_recv_status(fd, &status);
+    argv[0] = argv0;
+    close(fd);
+
+    return error ? error : status;
+}
+
+/* Connecting fails with one of these until the relay listens. */
+static inline bool relay_not_up(int const error)
+{
+    return error == ENOENT || error == ECONNREFUSED;
+}
+
+static inline int open_start_lock(pid_t const pid,
+    unsigned long long const starttime, int* const out_fd)
+{
+    char name[RELAY_SOCKET_NAME_SIZE];
+    char path[PATH_MAX];
+    int error;
+    int fd;
+
+    if ((error = relay_name(name, pid, starttime, "start")) != 0 ||
+        (error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return errno;
+    *out_fd = fd;
+    return 0;
+}
+
+int lock_relay_start(pid_t const pid, unsigned long long const starttime,
+    int* const out_fd)
+{
+    int error;
+    int fd;
+
+    *out_fd = -1;
+    if ((error = open_start_lock(pid, starttime, &fd)) != 0)
+        return error;
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+    {
+        error = errno;
+        close(fd);
+        return error;
+    }
+
+    *out_fd = fd;
+    return 0;
+}
+
+/* The relay is given up on once the handler starting it has given up, or
+   after as long as that one waits at most. */
+int send_to_starting_relay(pid_t const pid,
+    unsigned long long const starttime, char* argv[])
+{
+    unsigned long long const deadline = now_ms() +
+        config_ulong("OSU_HANDLER_RELAY_START_MS", RELAY_START_MS);
+    bool starting = true;
+    int error;
+    int fd;
+
+    if ((error = open_start_lock(pid, starttime, &fd)) != 0)
+        return error;
+
+    while (relay_not_up(error = send_to_relay(pid, starttime, argv)) &&
+        starting && now_ms() < deadline)
+    {
+        /* One more try after the starter is done, it may have been the
+           relay coming up that let it go. */
+        if (flock(fd, LOCK_SH | LOCK_NB) == 0)
+            starting = false;
+        else
+            sleep_ms(RELAY_RETRY_MS);
+    }
+
+    close(fd);
+    return error;
+}
+
+/* The relay outlives the handler and the wine client it execs into, so it
+   gets its own session and no terminal or pipes of ours. */
+static inline int spawn_relay(pid_t const pid,
+    unsigned long long const starttime, char const* const loader_path,
+    char const* const loader_name, char* const envp[])
+{
+    char name[RELAY_SOCKET_NAME_SIZE];
+    char socket_path[PATH_MAX];
+    char* argv[4];
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    pid_t relay_pid;
+    int error;
+
+    if (!(argv[1] = (char*)relay_program()))
+        return ENOENT;
+    if ((error = relay_socket_name(name, pid, starttime)) != 0 ||
+        (error = runtime_path(socket_path, sizeof(socket_path), name)) != 0)
+        return error;
+
+    argv[0] = (char*)loader_name;
+    argv[2] = socket_path;
+    argv[3] = 0;
+
+    if ((error = posix_spawn_file_actions_init(&actions)) != 0)
+        return error;
+    if ((error = posix_spawnattr_init(&attr)) != 0)
+    {
+        posix_spawn_file_actions_destroy(&actions);
+        return error;
+    }
+
+    if ((error = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+            "/dev/null", O_RDWR, 0)) == 0 &&
+        (error = posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO,
+            STDOUT_FILENO)) == 0 &&
+        (error = posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO,
+            STDERR_FILENO)) == 0 &&
+        (error = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID)) == 0)
+        error = posix_spawn(&relay_pid, loader_path, &actions, &attr, argv,
+            envp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return error;
+}
+
+int start_relay(pid_t const pid, unsigned long long const starttime,
+    char const* const loader_path, char const* const loader_name,
+    char* const envp[], char* argv[])
+{
+    unsigned long long const deadline = now_ms() +
+        config_ulong("OSU_HANDLER_RELAY_START_MS", RELAY_START_MS);
+    int error;
+
+    if ((error = spawn_relay(pid, starttime, loader_path, loader_name,
+            envp)) != 0)
+        return error;
+
+    while (relay_not_up(error = send_to_relay(pid, starttime, argv)) &&
+        now_ms() < deadline)
+        sleep_ms(RELAY_RETRY_MS);
+    return error;
+}
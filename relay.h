@@ -0,0 +1,68 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#pragma once
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include "bool.h" /* bool */
+
+#include <sys/types.h> /* pid_t */
+
+/* A relay is a long-lived helper inside the prefix of one osu! instance that
+   passes requests on to osu! itself, so that a handoff does not have to
+   start a wine client.  OSU_HANDLER_RELAY names the program, which is run
+   through the instance's wine loader with the path of its socket as the
+   only argument.  bench/relay_stub.py is a Linux stand-in.
+
+   The socket lives in the runtime directory and is named after the PID and
+   start time of the instance.  Requests use the ipc format, the first
+   string is the working directory of the handler and the rest is its argv
+   without argv[0]. */
+
+/* Whether OSU_HANDLER_RELAY is set. */
+bool relay_enabled(void);
+
+/* Hands argv off to the relay of the instance.  Returns 0 if the relay
+   accepted it, otherwise the handler has to start a wine client. */
+int send_to_relay(pid_t pid, unsigned long long starttime, char* argv[]);
+
+/* Only one handoff at a time starts the relay of an instance.  Returns 0
+   with *out_fd holding the lock if it is this one, EWOULDBLOCK if another
+   handoff is starting it. */
+int lock_relay_start(pid_t pid, unsigned long long starttime, int* out_fd);
+/* Like send_to_relay, but keeps trying while another handoff is starting
+   the relay, up to OSU_HANDLER_RELAY_START_MS. */
+int send_to_starting_relay(pid_t pid, unsigned long long starttime,
+    char* argv[]);
+
+/* Starts the relay of the instance in its own session, detached from the
+   handler, and hands argv off to it once it is up.  Gives up after
+   OSU_HANDLER_RELAY_START_MS, the handoff then goes through a wine client.
+   The caller holds the lock from lock_relay_start. */
+int start_relay(pid_t pid, unsigned long long starttime,
+    char const* loader_path, char const* loader_name, char* const envp[],
+    char* argv[]);
+
+#endif
@@ -0,0 +1,82 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _POSIX_C_SOURCE 200809L /* mkdir */
+
+#include "runtime_dir.h"
+
+#include <errno.h> /* EEXIST, ENAMETOOLONG, ENOENT, errno */
+#include <stdio.h> /* snprintf */
+#include <stdlib.h> /* getenv */
+#include <sys/stat.h> /* mkdir */
+
+#define RUNTIME_SUBDIR "osu-handler-wine"
+
+int runtime_path(char* const buffer, size_t const buffer_size,
+    char const* const name)
+{
+    char const* runtime_dir;
+    int len;
+
+    runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir || runtime_dir[0] != '/')
+        return ENOENT;
+
+    len = snprintf(buffer, buffer_size, "%s/" RUNTIME_SUBDIR, runtime_dir);
+    if (len < 0 || (size_t)len >= buffer_size)
+        return ENAMETOOLONG;
+
+    if (mkdir(buffer, 0700) == -1 && errno != EEXIST)
+        return errno;
+
+    len = snprintf(buffer, buffer_size, "%s/" RUNTIME_SUBDIR "/%s",
+        runtime_dir, name);
+    if (len < 0 || (size_t)len >= buffer_size)
+        return ENAMETOOLONG;
+
+    return 0;
+}
+
+int config_path(char* const buffer, size_t const buffer_size,
+    char const* const name)
+{
+    char const* config_dir;
+    int len;
+
+    config_dir = getenv("XDG_CONFIG_HOME");
+    if (config_dir && config_dir[0] == '/')
+        len = snprintf(buffer, buffer_size, "%s/" RUNTIME_SUBDIR "/%s",
+            config_dir, name);
+    else
+    {
+        config_dir = getenv("HOME");
+        if (!config_dir || config_dir[0] != '/')
+            return ENOENT;
+        len = snprintf(buffer, buffer_size,
+            "%s/.config/" RUNTIME_SUBDIR "/%s", config_dir, name);
+    }
+    if (len < 0 || (size_t)len >= buffer_size)
+        return ENAMETOOLONG;
+
+    return 0;
+}
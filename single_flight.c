@@ -0,0 +1,174 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _DEFAULT_SOURCE /* ftruncate, syscall */
+
+#include "single_flight.h"
+#include "inline.h" /* inline */
+#include "runtime_dir.h" /* runtime_path */
+#include "wineprefix.h" /* PREFIXED_NAME_SIZE, prefixed_name */
+
+#include <errno.h> /* EWOULDBLOCK, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_CREAT, O_RDWR, open */
+#include <limits.h> /* INT_MAX, PATH_MAX */
+#include <linux/futex.h> /* FUTEX_WAIT, FUTEX_WAKE */
+#include <sys/file.h> /* LOCK_EX, LOCK_NB, LOCK_SH, flock */
+#include <sys/mman.h> /* MAP_FAILED, MAP_SHARED, PROT_READ, PROT_WRITE,
+                         mmap, munmap */
+#include <sys/stat.h> /* fstat, struct stat */
+#include <sys/syscall.h> /* SYS_futex */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+#include <unistd.h> /* close, ftruncate, syscall */
+
+#define LEASE_NAME "discovery.lease"
+
+/* How often a follower checks whether the leader is still alive. */
+#define WAIT_SLICE_MS 50
+
+static inline unsigned long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 +
+        (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+/* Not the private variants, the word is shared through the file. */
+static inline void futex_wait(unsigned int* const word,
+    unsigned int const value, unsigned long const timeout_ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(timeout_ms / 1000);
+    ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &ts, 0, 0);
+}
+
+static inline void futex_wake_all(unsigned int* const word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+/* The lease file holds the generation, which the leader bumps when it is
+   done.  The flock on it says whether a leader is still around, so one
+   that dies mid-scan does not hold up the others for long. */
+static inline int open_lease(int* const out_fd,
+    unsigned int** const out_generation)
+{
+    char name[PREFIXED_NAME_SIZE];
+    char path[PATH_MAX];
+    int error;
+    int fd;
+    struct stat st;
+    void* generation;
+
+    if ((error = prefixed_name(name, LEASE_NAME)) != 0 ||
+        (error = runtime_path(path, sizeof(path), name)) != 0)
+        return error;
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return errno;
+    if (fstat(fd, &st) == -1 || ((size_t)st.st_size < sizeof(unsigned int) &&
+            ftruncate(fd, sizeof(unsigned int)) == -1))
+    {
+        error = errno;
+        close(fd);
+        return error;
+    }
+
+    generation = mmap(0, sizeof(unsigned int), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (generation == MAP_FAILED)
+    {
+        error = errno;
+        close(fd);
+        return error;
+    }
+
+    *out_fd = fd;
+    *out_generation = (unsigned int*)generation;
+    return 0;
+}
+
+int join_discovery(unsigned long const wait_ms, discovery_lease* const lease)
+{
+    unsigned long long const deadline = now_ms() + wait_ms;
+    int error;
+    int fd;
+    unsigned int* generation;
+    unsigned int seen;
+
+    lease->fd = -1;
+    lease->generation = 0;
+
+    if ((error = open_lease(&fd, &generation)) != 0)
+        return error;
+
+    /* Read before trying the lock, so that a leader finishing in between
+       is not waited for. */
+    seen = __atomic_load_n(generation, __ATOMIC_ACQUIRE);
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+    {
+        lease->fd = fd;
+        lease->generation = generation;
+        return 0;
+    }
+    if (errno != EWOULDBLOCK)
+        error = errno;
+
+    /* A shared lock is only refused while a leader holds the lease. */
+    while (error == 0 && flock(fd, LOCK_SH | LOCK_NB) == -1)
+    {
+        unsigned long long const now = now_ms();
+        unsigned long long wait;
+
+        if (errno != EWOULDBLOCK)
+            error = errno;
+        if (error != 0 || now >= deadline)
+            break;
+        wait = deadline - now;
+        futex_wait(generation, seen, wait < WAIT_SLICE_MS ?
+            (unsigned long)wait : WAIT_SLICE_MS);
+        if (__atomic_load_n(generation, __ATOMIC_ACQUIRE) != seen)
+            break;
+    }
+
+    munmap(generation, sizeof(unsigned int));
+    close(fd);
+    return error;
+}
+
+void end_discovery(discovery_lease* const lease)
+{
+    if (!lease || lease->fd == -1)
+        return;
+
+    __atomic_add_fetch(lease->generation, 1, __ATOMIC_RELEASE);
+    futex_wake_all(lease->generation);
+    munmap(lease->generation, sizeof(unsigned int));
+    close(lease->fd);
+    lease->fd = -1;
+    lease->generation = 0;
+}
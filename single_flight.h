@@ -0,0 +1,45 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __SINGLE_FLIGHT_H__
+#define __SINGLE_FLIGHT_H__
+
+/* Lets one of many concurrent invocations scan /proc while the others wait
+   for it to publish the discovery cache and the env snapshot. */
+
+typedef struct discovery_lease {
+    int fd; /* -1 unless this invocation is the leader */
+    unsigned int* generation;
+} discovery_lease;
+
+/* Makes this invocation the leader if nobody else is scanning.  Otherwise
+   waits up to wait_ms for the leader to end its lease and returns with
+   lease->fd set to -1; the result is then in the discovery cache, unless
+   the leader died or the wait timed out. */
+int join_discovery(unsigned long wait_ms, discovery_lease* lease);
+/* Publishes by waking the waiting invocations.  Does nothing for a null or
+   follower lease, or if the lease has already been ended. */
+void end_discovery(discovery_lease* lease);
+
+#endif
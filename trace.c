@@ -0,0 +1,88 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _POSIX_C_SOURCE 200809L /* O_CLOEXEC, clock_gettime */
+
+#include "trace.h"
+#include "is_number.h" /* is_number */
+
+#include <fcntl.h> /* O_APPEND, O_CLOEXEC, O_CREAT, O_WRONLY, open */
+#include <stdarg.h> /* va_end, va_list, va_start */
+#include <stdio.h> /* snprintf, vsnprintf */
+#include <stdlib.h> /* getenv, strtoul */
+#include <time.h> /* CLOCK_MONOTONIC, clock_gettime, struct timespec */
+#include <unistd.h> /* getpid, write */
+
+int trace_fd = -1;
+
+void trace_init(void)
+{
+    char const* const value = getenv("OSU_HANDLER_TRACE");
+
+    if (!value || !value[0])
+        return;
+    if (is_number(value))
+        trace_fd = (int)strtoul(value, 0, 10);
+    else
+        trace_fd = open(value, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+            0644);
+}
+
+unsigned long long trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull +
+        (unsigned long long)ts.tv_nsec;
+}
+
+/* Each event is a single write, so events of concurrent handlers appending
+   to the same file do not interleave. */
+void trace_event(unsigned long long const start, char const* const phase,
+    char const* const fields, ...)
+{
+    char line[512];
+    unsigned long long const end = trace_now();
+    int len;
+    int n;
+    va_list args;
+
+    len = snprintf(line, sizeof(line),
+        "{\"ts_ns\":%llu,\"pid\":%ld,\"phase\":\"%s\",\"dur_ns\":%llu,",
+        start, (long)getpid(), phase, end - start);
+    if (len < 0 || (size_t)len >= sizeof(line))
+        return;
+
+    va_start(args, fields);
+    n = vsnprintf(&line[len], sizeof(line) - (size_t)len, fields, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= sizeof(line) - (size_t)len - 2)
+        return;
+    len += n;
+
+    line[len++] = '}';
+    line[len++] = '\n';
+    if (write(trace_fd, line, (size_t)len) == -1)
+        trace_fd = -1;
+}
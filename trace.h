@@ -0,0 +1,110 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "attrs.h" /* attr_printf */
+#include "bool.h" /* bool */
+#include "inline.h" /* inline */
+
+/* OSU_HANDLER_TRACE names a file, or a file descriptor number, that receives
+   one JSON object per line for every traced phase:
+
+     {"ts_ns":...,"pid":...,"phase":"read_environ","dur_ns":...,"bytes":...}
+
+   ts_ns is CLOCK_MONOTONIC at the start of the phase.  Without the trace
+   build option trace_enabled() is the constant 0 and everything below
+   compiles away, with it a disabled trace costs one predictable branch. */
+
+typedef struct trace_counter {
+    unsigned long count;
+    unsigned long long ns;
+    unsigned long long start;
+} trace_counter;
+
+#ifdef ENABLE_TRACE
+
+extern int trace_fd;
+#define trace_enabled() (trace_fd != -1)
+
+void trace_init(void);
+unsigned long long trace_now(void);
+/* fields are the extra members of the JSON object, without braces. */
+void trace_event(unsigned long long start, char const* phase,
+    char const* fields, ...) attr_printf(3, 4);
+
+#else
+
+#define trace_enabled() 0
+
+static inline void trace_init(void)
+{
+}
+
+static inline unsigned long long trace_now(void)
+{
+    return 0;
+}
+
+static inline attr_printf(3, 4) void trace_event(unsigned long long start,
+    char const* phase, char const* fields, ...)
+{
+    (void)start;
+    (void)phase;
+    (void)fields;
+}
+
+#endif
+
+#define trace_begin() (trace_enabled() ? trace_now() : 0ull)
+#define trace_end(start, phase, ...) \
+    do { \
+        if (trace_enabled()) \
+            trace_event((start), (phase), __VA_ARGS__); \
+    } while (0)
+#define trace_point(phase, ...) trace_end(trace_now(), (phase), __VA_ARGS__)
+
+static inline bool trace_check_end(trace_counter* const counter,
+    bool const result)
+{
+    if (trace_enabled())
+    {
+        ++counter->count;
+        counter->ns += trace_now() - counter->start;
+    }
+    return result;
+}
+
+/* Evaluates the check expr, adding its count and duration to counter. */
+#define trace_check(counter, expr) \
+    ((void)(trace_enabled() && ((counter)->start = trace_now())), \
+    trace_check_end((counter), (expr)))
+
+/* Reports the totals of a counter as an event without duration. */
+#define trace_counter_end(counter, phase) \
+    trace_point((phase), "\"count\":%lu,\"total_ns\":%llu", \
+        (counter)->count, (counter)->ns)
+
+#endif
@@ -0,0 +1,426 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _GNU_SOURCE /* SYS_io_uring_enter, SYS_io_uring_register,
+                       SYS_io_uring_setup */
+
+#include "uring_probe.h"
+#include "bool.h" /* bool */
+#include "discovery.h" /* test_process_comm_matched */
+#include "inline.h" /* inline */
+#include "matcher.h" /* COMM_SIZE, match_comm */
+#include "pid_path.h" /* pid_path, pid_path_file, pid_path_init */
+
+#include <errno.h> /* EINTR, ENOTSUP, errno */
+#include <fcntl.h> /* AT_FDCWD, O_RDONLY */
+#include <linux/io_uring.h> /* IORING_*, IOSQE_*, IO_URING_OP_SUPPORTED,
+                              struct io_uring_cqe, struct io_uring_params,
+                              struct io_uring_probe,
+                              struct io_uring_probe_op, struct io_uring_sqe */
+#include <stdint.h> /* uint32_t, uint64_t */
+#include <string.h> /* memset */
+#include <sys/mman.h> /* MAP_*, PROT_*, mmap, munmap */
+#include <sys/syscall.h> /* SYS_io_uring_enter, SYS_io_uring_register,
+                            SYS_io_uring_setup */
+#include <unistd.h> /* close, syscall */
+
+/* Every PID takes three linked requests: open comm into a direct descriptor
+   slot, read it, close the slot. */
+#define URING_SLOTS 64
+#define URING_ENTRIES (URING_SLOTS * 4)
+
+enum {
+    URING_OP_OPEN,
+    URING_OP_READ,
+    URING_OP_CLOSE
+};
+
+typedef struct uring_slot {
+    pid_path path;
+    char comm[COMM_SIZE];
+    int read_result;
+} uring_slot;
+
+typedef struct uring_prober_struct {
+    int ring_fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    uint32_t* sq_tail;
+    uint32_t sq_mask;
+    uint32_t* sq_array;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe* cqes;
+
+    uring_slot slots[URING_SLOTS];
+} uring_prober_struct;
+
+/* Only one prober is ever open, and it should not cost a heap allocation. */
+static uring_prober_struct prober;
+
+static inline int io_uring_setup(unsigned const entries,
+    struct io_uring_params* const params)
+{
+    return (int)syscall(SYS_io_uring_setup, entries, params);
+}
+
+static inline int io_uring_enter(int const fd, unsigned const to_submit,
+    unsigned const min_complete, unsigned const flags)
+{
+    return (int)syscall(SYS_io_uring_enter, fd, to_submit, min_complete,
+        flags, 0, 0);
+}
+
+static inline int io_uring_register(int const fd, unsigned const opcode,
+    void const* const arg, unsigned const nr_args)
+{
+    return (int)syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+#define ring_ptr(base, offset) ((void*)((char*)(base) + (offset)))
+
+/* Room for every opcode an io_uring_probe can describe. */
+#define URING_PROBE_OPS 256
+
+static inline bool supports_ops(uring_prober_struct const* const p)
+{
+    static uint8_t const needed[] = {
+        IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE
+    };
+    uint64_t buffer[(sizeof(struct io_uring_probe) +
+        URING_PROBE_OPS * sizeof(struct io_uring_probe_op) + 7) / 8];
+    struct io_uring_probe* const probe = (struct io_uring_probe*)buffer;
+    size_t i;
+
+    memset(buffer, 0, sizeof(buffer));
+    if (io_uring_register(p->ring_fd, IORING_REGISTER_PROBE, probe,
+            URING_PROBE_OPS) == -1)
+        return false;
+
+    for (i = 0; i < sizeof(needed) / sizeof(needed[0]); ++i)
+        if (needed[i] > probe->last_op ||
+            !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    return true;
+}
+
+static inline struct io_uring_sqe* queue_sqe(uring_prober_struct* const p,
+    uint32_t const tail, uint8_t const opcode, size_t const slot,
+    unsigned const op)
+{
+    uint32_t const index = tail & p->sq_mask;
+    struct io_uring_sqe* const sqe = &p->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = (uint64_t)slot << 2 | op;
+    p->sq_array[index] = index;
+    return sqe;
+}
+
+/* Submits the one request queued at the tail and returns its result. */
+static inline int run_one(uring_prober_struct* const p, uint32_t const tail,
+    int* const out_result)
+{
+    uint32_t to_submit = 1;
+    uint32_t head;
+
+    __atomic_store_n(p->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    while ((head = *p->cq_head) ==
+        __atomic_load_n(p->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        int const n = io_uring_enter(p->ring_fd, to_submit, 1,
+            IORING_ENTER_GETEVENTS);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        to_submit -= (uint32_t)n < to_submit ? (uint32_t)n : to_submit;
+    }
+
+    *out_result = p->cqes[head & p->cq_mask].res;
+    __atomic_store_n(p->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Opening into a direct descriptor slot needs 5.15, older kernels ignore
+   file_index and hand out a regular descriptor instead. */
+static inline int try_direct_open(uring_prober_struct* const p)
+{
+    struct io_uring_sqe* sqe;
+    uint32_t tail;
+    int result = 0;
+    int error;
+
+    tail = *p->sq_tail;
+    sqe = queue_sqe(p, tail, IORING_OP_OPENAT, 0, URING_OP_OPEN);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)"/";
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = 1;
+    if ((error = run_one(p, tail, &result)) != 0)
+        return error;
+    if (result > 0)
+    {
+        close(result);
+        return ENOTSUP;
+    }
+    if (result < 0)
+        return -result;
+
+    tail = *p->sq_tail;
+    sqe = queue_sqe(p, tail, IORING_OP_CLOSE, 0, URING_OP_CLOSE);
+    sqe->file_index = 1;
+    if ((error = run_one(p, tail, &result)) != 0)
+        return error;
+    return result < 0 ? -result : 0;
+}
+
+void close_uring_prober(uring_prober_struct* const p)
+{
+    if (p->sqes)
+        munmap(p->sqes, p->sqes_size);
+    if (p->cq_ring && p->cq_ring != p->sq_ring)
+        munmap(p->cq_ring, p->cq_ring_size);
+    if (p->sq_ring)
+        munmap(p->sq_ring, p->sq_ring_size);
+    close(p->ring_fd);
+}
+
+int open_uring_prober(uring_prober_struct** const out_handle)
+{
+    struct io_uring_params params;
+    uring_prober_struct* p;
+    int files[URING_SLOTS];
+    size_t i;
+    int error;
+
+    p = &prober;
+    p->sq_ring = 0;
+    p->cq_ring = 0;
+    p->sqes = 0;
+
+    memset(&params, 0, sizeof(params));
+    p->ring_fd = io_uring_setup(URING_ENTRIES, &params);
+    if (p->ring_fd == -1)
+        return errno;
+
+    p->sq_ring_size = params.sq_off.array + params.sq_entries *
+        sizeof(uint32_t);
+    p->cq_ring_size = params.cq_off.cqes + params.cq_entries *
+        sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP &&
+        p->cq_ring_size > p->sq_ring_size)
+        p->sq_ring_size = p->cq_ring_size;
+
+    p->sq_ring = mmap(0, p->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, p->ring_fd, IORING_OFF_SQ_RING);
+    if (p->sq_ring == MAP_FAILED)
+    {
+        p->sq_ring = 0;
+        goto fail;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        p->cq_ring = p->sq_ring;
+    else
+    {
+        p->cq_ring = mmap(0, p->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, p->ring_fd, IORING_OFF_CQ_RING);
+        if (p->cq_ring == MAP_FAILED)
+        {
+            p->cq_ring = 0;
+            goto fail;
+        }
+    }
+
+    p->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    p->sqes = (struct io_uring_sqe*)mmap(0, p->sqes_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p->ring_fd,
+        IORING_OFF_SQES);
+    if (p->sqes == MAP_FAILED)
+    {
+        p->sqes = 0;
+        goto fail;
+    }
+
+    p->sq_tail = (uint32_t*)ring_ptr(p->sq_ring, params.sq_off.tail);
+    p->sq_mask = *(uint32_t*)ring_ptr(p->sq_ring, params.sq_off.ring_mask);
+    p->sq_array = (uint32_t*)ring_ptr(p->sq_ring, params.sq_off.array);
+    p->cq_head = (uint32_t*)ring_ptr(p->cq_ring, params.cq_off.head);
+    p->cq_tail = (uint32_t*)ring_ptr(p->cq_ring, params.cq_off.tail);
+    p->cq_mask = *(uint32_t*)ring_ptr(p->cq_ring, params.cq_off.ring_mask);
+    p->cqes = (struct io_uring_cqe*)ring_ptr(p->cq_ring, params.cq_off.cqes);
+
+    if (!supports_ops(p))
+    {
+        close_uring_prober(p);
+        return ENOTSUP;
+    }
+
+    /* An empty table of direct descriptors for the comm files. */
+    for (i = 0; i < URING_SLOTS; ++i)
+        files[i] = -1;
+    if (io_uring_register(p->ring_fd, IORING_REGISTER_FILES, files,
+            URING_SLOTS) == -1)
+        goto fail;
+
+    if ((error = try_direct_open(p)) != 0)
+    {
+        close_uring_prober(p);
+        return error;
+    }
+
+    *out_handle = p;
+    return 0;
+
+fail:
+    error = errno;
+    close_uring_prober(p);
+    return error;
+}
+
+/* Queues open + read + close of "<pid>/comm" for each slot.  Hard links keep
+   the chain going when a process has already exited, so the slot is always
+   released. */
+static inline uint32_t queue_batch(uring_prober_struct* const p,
+    int const proc_dirfd, size_t const count)
+{
+    uint32_t tail = *p->sq_tail;
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        uring_slot* const slot = &p->slots[i];
+        struct io_uring_sqe* sqe;
+
+        sqe = queue_sqe(p, tail++, IORING_OP_OPENAT, i, URING_OP_OPEN);
+        sqe->fd = proc_dirfd;
+        sqe->addr = (uint64_t)(uintptr_t)pid_path_file(&slot->path, "comm");
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = (uint32_t)i + 1;
+        sqe->flags = IOSQE_IO_HARDLINK;
+
+        sqe = queue_sqe(p, tail++, IORING_OP_READ, i, URING_OP_READ);
+        sqe->fd = (int)i;
+        sqe->addr = (uint64_t)(uintptr_t)slot->comm;
+        sqe->len = sizeof(slot->comm);
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+
+        sqe = queue_sqe(p, tail++, IORING_OP_CLOSE, i, URING_OP_CLOSE);
+        sqe->file_index = (uint32_t)i + 1;
+    }
+
+    __atomic_store_n(p->sq_tail, tail, __ATOMIC_RELEASE);
+    return (uint32_t)count * 3;
+}
+
+static inline int wait_batch(uring_prober_struct* const p,
+    uint32_t const submitted)
+{
+    uint32_t remaining = submitted;
+    uint32_t to_submit = submitted;
+
+    while (remaining)
+    {
+        uint32_t head;
+        uint32_t tail;
+        int n;
+
+        n = io_uring_enter(p->ring_fd, to_submit, remaining,
+            IORING_ENTER_GETEVENTS);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        to_submit -= (uint32_t)n < to_submit ? (uint32_t)n : to_submit;
+
+        head = *p->cq_head;
+        tail = __atomic_load_n(p->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head, --remaining)
+        {
+            struct io_uring_cqe const* const cqe = &p->cqes[head & p->cq_mask];
+
+            if ((cqe->user_data & 3) == URING_OP_READ)
+                p->slots[cqe->user_data >> 2].read_result = cqe->res;
+        }
+        __atomic_store_n(p->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+int uring_probe_batch(uring_prober_struct* const p, int const proc_dirfd,
+    pid_t const* const pids, size_t const count, size_t* const out_index,
+    char** const out_exe_path)
+{
+    size_t base;
+    size_t i;
+    int error;
+
+    for (base = 0; base < count; base += URING_SLOTS)
+    {
+        size_t const n = count - base < URING_SLOTS ? count - base :
+            URING_SLOTS;
+
+        for (i = 0; i < n; ++i)
+        {
+            pid_path_init(&p->slots[i].path, pids[base + i]);
+            p->slots[i].read_result = -1;
+        }
+
+        if ((error = wait_batch(p, queue_batch(p, proc_dirfd, n))) != 0)
+            return error;
+
+        /* First match wins, the exe checks of the remaining processes are
+           never issued. */
+        for (i = 0; i < n; ++i)
+        {
+            uring_slot const* const slot = &p->slots[i];
+
+            if (slot->read_result <= 0 ||
+                slot->comm[slot->read_result - 1] != '\n' ||
+                !match_comm(slot->comm, (size_t)slot->read_result - 1))
+                continue;
+
+            if (test_process_comm_matched(proc_dirfd, pids[base + i],
+                    out_exe_path))
+            {
+                *out_index = base + i;
+                return 0;
+            }
+        }
+    }
+
+    *out_index = count;
+    return 0;
+}
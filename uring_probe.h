@@ -0,0 +1,44 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __URING_PROBE_H__
+#define __URING_PROBE_H__
+
+#include <stddef.h> /* size_t */
+#include <sys/types.h> /* pid_t */
+
+typedef struct uring_prober_struct* uring_prober_handle;
+
+/* Fails with an errno value if io_uring, one of the operations or opening
+   into direct descriptors (Linux 5.15) is not available, the caller then
+   probes synchronously. */
+int open_uring_prober(uring_prober_handle* out_handle);
+/* Reads "<pid>/comm" of all pids with a single submission and checks the
+   matching ones further in order.  *out_index is the index of the first
+   osu! process, or count if there was none. */
+int uring_probe_batch(uring_prober_handle, int proc_dirfd,
+    pid_t const* pids, size_t count, size_t* out_index, char** out_exe_path);
+void close_uring_prober(uring_prober_handle);
+
+#endif
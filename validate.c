@@ -0,0 +1,516 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#define _DEFAULT_SOURCE /* pread */
+
+#include "validate.h"
+#include "arena.h" /* arena_new, run_arena */
+#include "bool.h" /* bool */
+#include "config.h" /* config_ulong */
+#include "inline.h" /* inline */
+
+#include <dlfcn.h> /* RTLD_LOCAL, RTLD_NOW, dlopen, dlsym */
+#include <errno.h> /* EBADMSG, EINTR, ENOENT, ENOMEM, errno */
+#include <fcntl.h> /* O_CLOEXEC, O_RDONLY, POSIX_FADV_SEQUENTIAL, open,
+                      posix_fadvise */
+#include <pthread.h> /* pthread_create, pthread_join, pthread_t */
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint16_t, uint32_t, uint64_t */
+#include <stdlib.h> /* free, malloc */
+#include <string.h> /* memcmp, memset, strlen */
+#include <strings.h> /* strcasecmp */
+#include <sys/stat.h> /* S_ISREG, fstat, struct stat */
+#include <sys/types.h> /* off_t, ssize_t */
+#include <unistd.h> /* _SC_NPROCESSORS_ONLN, close, pread, sysconf */
+/* Only the types and constants, libz itself is loaded when needed. */
+#include <zlib.h> /* MAX_WBITS, ZLIB_VERSION, Z_*, uInt, uLong, z_stream */
+
+#define ZLIB_SONAME "libz.so.1"
+#define MAX_THREADS 16
+#define INFLATE_CHUNK (64 * 1024)
+#define READ_CHUNK (256 * 1024)
+
+#define EOCD_SIZE 22
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP64_EOCD_SIZE 56
+#define CENTRAL_HEADER_SIZE 46
+#define LOCAL_HEADER_SIZE 30
+/* Room for the end of central directory record, its comment and the ZIP64
+   locator before it. */
+#define TAIL_SIZE (ZIP64_LOCATOR_SIZE + EOCD_SIZE + 0xFFFF)
+
+/* The CRC is whatever the installed zlib provides, which is word-parallel
+   in zlib since 1.2.12 and uses PCLMULQDQ in zlib-ng. */
+typedef struct zlib_api {
+    uLong (*crc)(uLong crc, Bytef const* buf, uInt len);
+    int (*inflate_init)(z_streamp strm, int window_bits, char const* version,
+        int stream_size);
+    int (*inflate)(z_streamp strm, int flush);
+    int (*inflate_end)(z_streamp strm);
+} zlib_api;
+
+typedef struct validate_job {
+    zlib_api const* zlib; /* null to check only the layout */
+    char const* const* paths;
+    int* results;
+    size_t count;
+    size_t next;
+} validate_job;
+
+/* Never closed, the handler execs soon after. */
+static inline bool load_zlib(zlib_api* const z)
+{
+    void* const module = dlopen(ZLIB_SONAME, RTLD_NOW | RTLD_LOCAL);
+
+    if (!module)
+        return false;
+    *(void**)&z->crc = dlsym(module, "crc32");
+    *(void**)&z->inflate_init = dlsym(module, "inflateInit2_");
+    *(void**)&z->inflate = dlsym(module, "inflate");
+    *(void**)&z->inflate_end = dlsym(module, "inflateEnd");
+    return z->crc && z->inflate_init && z->inflate && z->inflate_end;
+}
+
+static inline uint16_t le16(unsigned char const* const p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t le32(unsigned char const* const p)
+{
+    return (uint32_t)le16(p) | (uint32_t)le16(p + 2) << 16;
+}
+
+static inline uint64_t le64(unsigned char const* const p)
+{
+    return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static inline bool is_archive(char const* const path)
+{
+    size_t const length = strlen(path);
+
+    return length >= 4 && (strcasecmp(&path[length - 4], ".osz") == 0 ||
+        strcasecmp(&path[length - 4], ".osk") == 0);
+}
+
+/* Archives are read rather than mapped, a file that is truncated while it
+   is checked must fail the check and not fault.  Reading past the end is
+   a broken archive. */
+static inline int read_at(int const fd, unsigned char* const buffer,
+    size_t const size, uint64_t const offset)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < size)
+    {
+        n = pread(fd, &buffer[done], size - done, (off_t)(offset + done));
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (n == 0)
+            return EBADMSG;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/* The end of central directory record is last, followed only by a comment
+   of at most 64 KiB. */
+static inline int find_central_directory(int const fd, uint64_t const size,
+    uint64_t* const out_offset, uint64_t* const out_size,
+    uint64_t* const out_count)
+{
+    unsigned char tail[TAIL_SIZE];
+    unsigned char record[ZIP64_EOCD_SIZE];
+    size_t const tail_size = size < TAIL_SIZE ? (size_t)size : TAIL_SIZE;
+    uint64_t const base = size - tail_size;
+    size_t pos;
+    size_t min;
+    uint64_t end;
+    uint64_t offset;
+    uint64_t cd_size;
+    uint64_t count;
+    int error;
+
+    if (size < EOCD_SIZE)
+        return EBADMSG;
+    if ((error = read_at(fd, tail, tail_size, base)) != 0)
+        return error;
+    min = tail_size - EOCD_SIZE > 0xFFFF ? tail_size - EOCD_SIZE - 0xFFFF : 0;
+    for (pos = tail_size - EOCD_SIZE; ; --pos)
+    {
+        if (memcmp(&tail[pos], "PK\5\6", 4) == 0 &&
+            le16(&tail[pos + 20]) <= tail_size - pos - EOCD_SIZE)
+            break;
+        if (pos == min)
+            return EBADMSG;
+    }
+
+    count = le16(&tail[pos + 10]);
+    cd_size = le32(&tail[pos + 12]);
+    offset = le32(&tail[pos + 16]);
+    end = base + pos;
+
+    /* Saturated fields mean that the real values are in the ZIP64 record,
+       which the locator right before this one points to. */
+    if (count == 0xFFFF || cd_size == 0xFFFFFFFF || offset == 0xFFFFFFFF)
+    {
+        unsigned char const* locator;
+        uint64_t const locator_offset = base + pos - ZIP64_LOCATOR_SIZE;
+
+        if (pos < ZIP64_LOCATOR_SIZE)
+            return EBADMSG;
+        locator = &tail[pos - ZIP64_LOCATOR_SIZE];
+        end = le64(&locator[8]);
+        if (memcmp(locator, "PK\6\7", 4) != 0 || end > locator_offset ||
+            locator_offset - end < ZIP64_EOCD_SIZE)
+            return EBADMSG;
+        if ((error = read_at(fd, record, sizeof(record), end)) != 0)
+            return error;
+        if (memcmp(record, "PK\6\6", 4) != 0)
+            return EBADMSG;
+        count = le64(&record[32]);
+        cd_size = le64(&record[40]);
+        offset = le64(&record[48]);
+    }
+
+    if (offset > end || cd_size > end - offset)
+        return EBADMSG;
+    *out_offset = offset;
+    *out_size = cd_size;
+    *out_count = count;
+    return 0;
+}
+
+/* Replaces the saturated sizes and offset by their ZIP64 extra field
+   values, which only exist for the saturated ones, in this order. */
+static inline bool read_zip64_extra(unsigned char const* extra,
+    size_t length, uint64_t* const usize, uint64_t* const csize,
+    uint64_t* const offset)
+{
+    while (length >= 4)
+    {
+        uint16_t const id = le16(extra);
+        size_t const field_length = le16(&extra[2]);
+        unsigned char const* field = &extra[4];
+        size_t needed = 0;
+
+        if (field_length > length - 4)
+            return false;
+        if (id == 0x0001)
+        {
+            needed = 8 * ((*usize == 0xFFFFFFFF) + (*csize == 0xFFFFFFFF) +
+                (*offset == 0xFFFFFFFF));
+            if (field_length < needed)
+                return false;
+            if (*usize == 0xFFFFFFFF)
+                *usize = le64(field), field += 8;
+            if (*csize == 0xFFFFFFFF)
+                *csize = le64(field), field += 8;
+            if (*offset == 0xFFFFFFFF)
+                *offset = le64(field);
+            return true;
+        }
+        extra += 4 + field_length;
+        length -= 4 + field_length;
+    }
+    return true;
+}
+
+static inline int check_stored(zlib_api const* const z, int const fd,
+    unsigned char* const buffer, uint64_t offset, uint64_t size,
+    uint32_t const crc)
+{
+    uLong actual = 0;
+    int error;
+
+    while (size)
+    {
+        size_t const n = size > READ_CHUNK ? READ_CHUNK : (size_t)size;
+
+        if ((error = read_at(fd, buffer, n, offset)) != 0)
+            return error;
+        actual = z->crc(actual, buffer, (uInt)n);
+        offset += n;
+        size -= n;
+    }
+    return (uint32_t)actual == crc ? 0 : EBADMSG;
+}
+
+/* Inflates into a small buffer that is only ever used for the CRC. */
+static inline int check_deflated(zlib_api const* const z, int const fd,
+    unsigned char* const buffer, uint64_t offset, uint64_t const csize,
+    uint64_t const usize, uint32_t const crc)
+{
+    unsigned char out[INFLATE_CHUNK];
+    z_stream stream;
+    uint64_t left = csize;
+    uint64_t total = 0;
+    uLong actual = 0;
+    int error = 0;
+    int ret;
+
+    memset(&stream, 0, sizeof(stream));
+    if (z->inflate_init(&stream, -MAX_WBITS, ZLIB_VERSION,
+            (int)sizeof(stream)) != Z_OK)
+        return 0;
+
+    do
+    {
+        if (!stream.avail_in && left)
+        {
+            size_t const n = left > READ_CHUNK ? READ_CHUNK : (size_t)left;
+
+            if ((error = read_at(fd, buffer, n, offset)) != 0)
+                break;
+            stream.next_in = buffer;
+            stream.avail_in = (uInt)n;
+            offset += n;
+            left -= n;
+        }
+        stream.next_out = out;
+        stream.avail_out = sizeof(out);
+        ret = z->inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END)
+            break;
+        actual = z->crc(actual, out, (uInt)(sizeof(out) - stream.avail_out));
+        total += sizeof(out) - stream.avail_out;
+    } while (ret != Z_STREAM_END && total <= usize);
+
+    z->inflate_end(&stream);
+    if (error != 0)
+        return error;
+    return ret == Z_STREAM_END && total == usize && (uint32_t)actual == crc ?
+        0 : EBADMSG;
+}
+
+/* Entry data has to lie between its local header and the central
+   directory. */
+static inline int check_entry(zlib_api const* const z, int const fd,
+    unsigned char* const buffer, uint64_t const limit,
+    unsigned char const* const header, uint64_t const csize,
+    uint64_t const usize, uint64_t const offset)
+{
+    uint16_t const flags = le16(&header[8]);
+    uint16_t const method = le16(&header[10]);
+    uint32_t const crc = le32(&header[16]);
+    unsigned char local[LOCAL_HEADER_SIZE];
+    uint64_t start;
+    int error;
+
+    if (offset > limit || limit - offset < LOCAL_HEADER_SIZE)
+        return EBADMSG;
+    if ((error = read_at(fd, local, sizeof(local), offset)) != 0)
+        return error;
+    if (memcmp(local, "PK\3\4", 4) != 0)
+        return EBADMSG;
+    start = offset + LOCAL_HEADER_SIZE + le16(&local[26]) + le16(&local[28]);
+    if (start > limit || csize > limit - start)
+        return EBADMSG;
+
+    /* The CRC of encrypted entries is that of the plain text, and other
+       methods than store and deflate only get their layout checked. */
+    if (!z || flags & 1)
+        return 0;
+    if (method == 0)
+        return csize == usize ?
+            check_stored(z, fd, buffer, start, csize, crc) : EBADMSG;
+    if (method == 8)
+        return check_deflated(z, fd, buffer, start, csize, usize, crc);
+    return 0;
+}
+
+/* The central directory is read in one go, entry data in READ_CHUNK
+   pieces into the same allocation. */
+static inline int check_zip(zlib_api const* const z, int const fd,
+    uint64_t const size)
+{
+    uint64_t cd_offset;
+    uint64_t cd_size;
+    uint64_t count;
+    uint64_t pos;
+    uint64_t i;
+    unsigned char* buffer;
+    unsigned char* cd;
+    int error;
+
+    if ((error = find_central_directory(fd, size, &cd_offset, &cd_size,
+            &count)) != 0)
+        return error;
+
+    if (!(buffer = (unsigned char*)malloc(READ_CHUNK + (size_t)cd_size)))
+        return ENOMEM;
+    cd = &buffer[READ_CHUNK];
+    if ((error = read_at(fd, cd, (size_t)cd_size, cd_offset)) != 0)
+    {
+        free(buffer);
+        return error;
+    }
+
+    for (pos = 0, i = 0; error == 0 && i < count; ++i)
+    {
+        unsigned char const* const header = &cd[pos];
+        uint64_t csize;
+        uint64_t usize;
+        uint64_t offset;
+        size_t name_length;
+        size_t extra_length;
+        uint64_t length;
+
+        if (cd_size - pos < CENTRAL_HEADER_SIZE ||
+            memcmp(header, "PK\1\2", 4) != 0)
+        {
+            error = EBADMSG;
+            break;
+        }
+        csize = le32(&header[20]);
+        usize = le32(&header[24]);
+        offset = le32(&header[42]);
+        name_length = le16(&header[28]);
+        extra_length = le16(&header[30]);
+        length = CENTRAL_HEADER_SIZE + name_length + extra_length +
+            le16(&header[32]);
+        if (cd_size - pos < length ||
+            !read_zip64_extra(&header[CENTRAL_HEADER_SIZE + name_length],
+                extra_length, &usize, &csize, &offset))
+        {
+            error = EBADMSG;
+            break;
+        }
+
+        error = check_entry(z, fd, buffer, cd_offset, header, csize, usize,
+            offset);
+        pos += length;
+    }
+
+    free(buffer);
+    return error;
+}
+
+static int validate_file(zlib_api const* const z, char const* const path)
+{
+    int fd;
+    struct stat st;
+    int error;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        close(fd);
+        return EBADMSG;
+    }
+
+    /* Past the central directory, entries are read front to back. */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    error = check_zip(z, fd, (uint64_t)st.st_size);
+    close(fd);
+    return error;
+}
+
+static void* validate_worker(void* const arg)
+{
+    validate_job* const job = (validate_job*)arg;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+            job->count)
+        job->results[i] = validate_file(job->zlib, job->paths[i]);
+    return 0;
+}
+
+int validate_archives(char* argv[], char const** const out_bad)
+{
+    zlib_api z;
+    validate_job job;
+    pthread_t threads[MAX_THREADS - 1];
+    size_t thread_count;
+    size_t started = 0;
+    char const** paths;
+    size_t count = 0;
+    size_t i;
+    size_t j;
+    long cpus;
+    int error;
+
+    for (i = 1; argv[i]; ++i)
+        count += is_archive(argv[i]);
+    if (!count)
+        return 0;
+
+    /* Workers must not touch the arena, everything they need is allocated
+       up front. */
+    paths = arena_new(&run_arena, char const*, count);
+    job.results = arena_new(&run_arena, int, count);
+    if (!paths || !job.results)
+        return 0;
+    for (count = 0, i = 1; argv[i]; ++i)
+        if (is_archive(argv[i]))
+            paths[count++] = argv[i];
+
+    job.zlib = load_zlib(&z) ? &z : 0;
+    job.paths = paths;
+    job.count = count;
+    job.next = 0;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = config_ulong("OSU_HANDLER_VALIDATE_THREADS",
+        cpus > 0 ? (unsigned long)cpus : 1);
+    if (thread_count > MAX_THREADS)
+        thread_count = MAX_THREADS;
+    if (thread_count > count)
+        thread_count = count;
+
+    /* The calling thread is a worker too, failing to start the others only
+       makes it slower. */
+    while (started + 1 < thread_count &&
+            pthread_create(&threads[started], 0, validate_worker, &job) == 0)
+        ++started;
+    validate_worker(&job);
+    for (i = 0; i < started; ++i)
+        pthread_join(threads[i], 0);
+
+    /* Broken archives are taken out, the results are in argv order. */
+    error = 0;
+    for (count = 0, i = 1, j = 1; argv[i]; ++i)
+    {
+        int const result = is_archive(argv[i]) ? job.results[count++] : 0;
+
+        if (result != EBADMSG && result != ENOENT)
+            argv[j++] = argv[i];
+        else if (error == 0)
+        {
+            *out_bad = argv[i];
+            error = result;
+        }
+    }
+    argv[j] = 0;
+    return error;
+}
@@ -0,0 +1,40 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+
+#pragma once
+#ifndef __VALIDATE_H__
+#define __VALIDATE_H__
+
+/* Checks every .osz and .osk argument before the handoff: the central
+   directory of the archive is read and walked, and the CRC32 of every entry
+   is verified, inflating deflated ones.  Packs are spread over
+   OSU_HANDLER_VALIDATE_THREADS threads (default: one per CPU).
+
+   Broken and missing archives are removed from argv, the other arguments
+   keep their order.  Returns EBADMSG or ENOENT for the first of them, with
+   *out_bad set to its path, or 0.  Anything that keeps the check itself
+   from running, like a missing zlib, lets the archives pass. */
+int validate_archives(char* argv[], char const** out_bad);
+
+#endif
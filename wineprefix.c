@@ -0,0 +1,177 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#define _POSIX_C_SOURCE 200809L /* O_CLOEXEC */
+
+#include "wineprefix.h"
+#include "arena.h" /* arena_mark, arena_release, run_arena */
+#include "discovery.h" /* open_process_dir, target_prefix */
+#include "environ.h" /* read_environ */
+#include "procdir.h" /* procdir_handle, procdir_start_at_wineserver */
+#include "static_string.h" /* static_strlen */
+
+#include <errno.h> /* ENAMETOOLONG, ENOENT, errno */
+#include <fcntl.h> /* F_GETLK, F_UNLCK, F_WRLCK, O_CLOEXEC, O_RDONLY, fcntl,
+                      open, struct flock */
+#include <limits.h> /* PATH_MAX */
+#include <stdio.h> /* snprintf */
+#include <stdlib.h> /* getenv */
+#include <string.h> /* memchr, memcmp */
+#include <sys/stat.h> /* stat, struct stat */
+#include <unistd.h> /* SEEK_SET, close, getuid */
+
+#define WINE_SERVER_ROOT "/tmp"
+
+int get_prefix_id(char const* const prefix, wine_prefix_id* const out_id)
+{
+    struct stat st;
+
+    if (stat(prefix, &st) == -1)
+        return errno;
+
+    out_id->dev = st.st_dev;
+    out_id->ino = st.st_ino;
+    return 0;
+}
+
+int find_prefix_wineserver(wine_prefix_id const* const id,
+    pid_t* const out_server_pid)
+{
+    char path[PATH_MAX];
+    int len;
+    int fd;
+    struct flock lock;
+    int error;
+
+    /* Same format as wine's init_server_dir(). */
+    len = snprintf(path, sizeof(path),
+        WINE_SERVER_ROOT "/.wine-%lu/server-%llx-%llx/lock",
+        (unsigned long)getuid(), (unsigned long long)id->dev,
+        (unsigned long long)id->ino);
+    if (len < 0 || (size_t)len >= sizeof(path))
+        return ENAMETOOLONG;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return errno;
+
+    /* A running wineserver holds a write lock on the whole file, the
+       directory of a crashed one stays around unlocked. */
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+    lock.l_pid = 0;
+    error = fcntl(fd, F_GETLK, &lock) == -1 ? errno : 0;
+    close(fd);
+
+    if (error != 0)
+        return error;
+    if (lock.l_type == F_UNLCK)
+        return ENOENT;
+
+    *out_server_pid = lock.l_pid;
+    return 0;
+}
+
+static inline char const* find_envvar(char const* environ,
+    char const* const environ_end, char const* const name,
+    size_t const name_length)
+{
+    while (environ < environ_end)
+    {
+        char const* const end = (char const*)memchr(environ, '\0',
+            environ_end - environ);
+        if (!end)
+            break;
+        if ((size_t)(end - environ) > name_length &&
+            memcmp(environ, name, name_length) == 0)
+            return environ + name_length;
+        environ = end + 1;
+    }
+    return 0;
+}
+
+bool process_in_prefix(int const proc_dirfd, pid_t const pid,
+    wine_prefix_id const* const id)
+{
+    int dirfd;
+    char* environ;
+    size_t environ_size;
+    char const* prefix;
+    char default_prefix[PATH_MAX];
+    struct stat st;
+    bool b;
+
+    size_t const mark = arena_mark(&run_arena);
+
+    if (open_process_dir(proc_dirfd, pid, &dirfd) != 0)
+        return false;
+    b = read_environ(dirfd, &environ, &environ_size);
+    close(dirfd);
+    if (!b)
+        return false;
+
+    prefix = find_envvar(environ, &environ[environ_size], "WINEPREFIX=",
+        static_strlen("WINEPREFIX="));
+    if (!prefix)
+    {
+        char const* home;
+        int len;
+
+        home = find_envvar(environ, &environ[environ_size], "HOME=",
+            static_strlen("HOME="));
+        if (!home)
+            home = getenv("HOME");
+        len = snprintf(default_prefix, sizeof(default_prefix), "%s/.wine",
+            home ? home : "");
+        prefix = home && len > 0 && (size_t)len < sizeof(default_prefix) ?
+            default_prefix : 0;
+    }
+
+    b = prefix && stat(prefix, &st) != -1 && st.st_dev == id->dev &&
+        st.st_ino == id->ino;
+    arena_release(&run_arena, mark);
+    return b;
+}
+
+void start_at_prefix_wineserver(procdir_handle const pdhandle)
+{
+    pid_t server_pid;
+
+    if (target_prefix &&
+        find_prefix_wineserver(target_prefix, &server_pid) == 0 &&
+        server_pid > 0)
+        procdir_start_at_wineserver(pdhandle, server_pid);
+}
+
+int prefixed_name(char* const buffer, char const* const name)
+{
+    int const len = target_prefix ?
+        snprintf(buffer, PREFIXED_NAME_SIZE, "%s-%llx-%llx", name,
+            (unsigned long long)target_prefix->dev,
+            (unsigned long long)target_prefix->ino) :
+        snprintf(buffer, PREFIXED_NAME_SIZE, "%s", name);
+
+    return len < 0 || len >= PREFIXED_NAME_SIZE ? ENAMETOOLONG : 0;
+}
@@ -0,0 +1,64 @@
+/* Copyright (C) 2021 Torge Matthies */
+/*
+ * This file is part of osu-handler-wine.
+ *
+ * osu-handler-wine is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * osu-handler-wine is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/*
+ * Author contact info:
+ *   E-Mail address: openglfreak@googlemail.com
+ *   GPG key fingerprint: 0535 3830 2F11 C888 9032 FAD2 7C95 CD70 C9E8 438D
+ */
+
+#pragma once
+#ifndef __WINEPREFIX_H__
+#define __WINEPREFIX_H__
+
+#include "bool.h" /* bool */
+#include "procdir.h" /* procdir_handle */
+
+#include <stddef.h> /* size_t */
+#include <sys/types.h> /* dev_t, ino_t, pid_t */
+
+/* wineserver names its directory after the device and inode of the prefix,
+   so that is what identifies a prefix. */
+typedef struct wine_prefix_id {
+    dev_t dev;
+    ino_t ino;
+} wine_prefix_id;
+
+int get_prefix_id(char const* prefix, wine_prefix_id* out_id);
+
+/* Looks up the server directory of the prefix in /tmp/.wine-<uid> and asks
+   the lock file who holds it.  Returns ENOENT if no wineserver is running
+   for the prefix.  *out_server_pid may be 0 if the holder lives in another
+   PID namespace. */
+int find_prefix_wineserver(wine_prefix_id const* id, pid_t* out_server_pid);
+
+/* Whether the WINEPREFIX of the process (default ~/.wine of its HOME) is
+   the prefix. */
+bool process_in_prefix(int proc_dirfd, pid_t pid, wine_prefix_id const* id);
+
+/* If a prefix is targeted and its wineserver runs, only its clients are
+   enumerated. */
+void start_at_prefix_wineserver(procdir_handle pdhandle);
+
+/* Enough for the names of the runtime files plus a prefix id. */
+#define PREFIXED_NAME_SIZE 64
+
+/* Appends "-<dev>-<ino>" of the targeted prefix to a runtime file name, so
+   that what was learned about one prefix is never used for another. */
+int prefixed_name(char* buffer, char const* name);
+
+#endif